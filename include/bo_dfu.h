@@ -9,6 +9,7 @@
 
 #include "bo_dfu_usb.h"
 #include "bo_dfu_descriptor.h"
+#include "bo_dfu_alt.h"
 #include "bo_dfu_internal.h"
 #include "bo_dfu_clk.h"
 #include "bo_dfu_ota.h"
@@ -22,6 +23,10 @@
 #include "bo_dfu_gpio.h"
 #include "bo_dfu_log.h"
 #include "bo_dfu_time.h"
+#include "bo_dfu_timer.h"
+#include "bo_dfu_fault.h"
+#include "bo_dfu_trace.h"
+#include "bo_dfu_rtc.h"
 
 #include "sdkconfig.h"
 
@@ -36,14 +41,16 @@ static IRAM_ATTR void bo_dfu_fsm(bo_dfu_t *dfu)
             {
                 break;
             }
-            ESP_LOGD(BO_DFU_TAG, "[%s] initial bus reset", __func__);
+            BO_DFU_LOGD("[%s] initial bus reset", __func__);
             bo_dfu_update_state(dfu, IDLE, BO_DFU_STATUS_OK);
             dfu->state = BO_DFU_BUS_RESET;
         }
         /* falls through */
         case BO_DFU_BUS_RESET:
         {
-            ESP_LOGD(BO_DFU_TAG, "[%s] bus reset", __func__);
+            BO_DFU_LOGD("[%s] bus reset", __func__);
+            BO_DFU_STATS_INC(dfu, bus_resets);
+            BO_DFU_TRACE(BUS, BO_DFU_BUS_RESET, 0);
             memset(BO_DFU_T_TO_BUS_RESET_PTR(dfu), 0, BO_DFU_T_BUS_RESET_SIZE);
             dfu->state = BO_DFU_BUS_DESYNCED;
         }
@@ -64,9 +71,17 @@ static IRAM_ATTR void bo_dfu_fsm(bo_dfu_t *dfu)
         case BO_DFU_BUS_OK:
         {
             dfu->state = bo_dfu_usb_transaction_next(dfu);
+            if(dfu->state == BO_DFU_BUS_DESYNCED)
+            {
+                BO_DFU_STATS_INC(dfu, desyncs);
+                BO_DFU_TRACE(BUS, BO_DFU_BUS_DESYNCED, 0);
+            }
+            bo_dfu_hooks_check_state(dfu);
+            BO_DFU_SCHED_RUN(dfu);
             break;
         }
     }
+    bo_dfu_trace_flush();
 }
 
 static bool IRAM_ATTR bo_dfu_is_compatible_reset_type(void)
@@ -87,21 +102,33 @@ static esp_err_t IRAM_ATTR bo_dfu_init(bo_dfu_t *dfu)
     memset(dfu, 0, sizeof(*dfu));
     dfu->state = BO_DFU_BUS_INIT;
 
-    if(ESP_OK != bo_dfu_ota_init(&dfu->ota))
-    {
-        // No OTA partition?
-        ESP_LOGE(BO_DFU_TAG, "[%s] invalid OTA configuration", __func__);
-        return ESP_FAIL;
-    }
+    #ifndef CONFIG_BO_DFU_LAZY_OTA_INIT
+        // Otherwise, this is deferred until the first block is received.
+        const uint32_t ota_init_start = bo_dfu_ccount();
+        if(ESP_OK != bo_dfu_ota_init(&dfu->ota))
+        {
+            // No OTA partition?
+            ESP_LOGE(BO_DFU_TAG, "[%s] invalid OTA configuration", __func__);
+            return ESP_FAIL;
+        }
+        ESP_LOGD(BO_DFU_TAG, "[%s] OTA init: %u cycles at %u MHz", __func__, bo_dfu_ccount() - ota_init_start, esp_rom_get_cpu_ticks_per_us());
+    #endif
 
     bo_dfu_descriptor_init();
+    bo_dfu_alt_init();
     bo_dfu_clock_init();
+    bo_dfu_fault_init();
+    bo_dfu_trace_start();
     return ESP_OK;
 }
 
-static void IRAM_ATTR bo_dfu_deinit(void)
+static void IRAM_ATTR bo_dfu_deinit(bo_dfu_t *dfu)
 {
+    // A background erase may still be in progress, and the flash must be idle before the app is read.
+    bo_dfu_flash_wait_idle();
+    bo_dfu_trace_end(BO_DFU_T_IS_COMPLETE(dfu));
     bo_dfu_clock_deinit();
+    bo_dfu_log_flush();
 }
 
 #endif /* BO_DFU_H */
@@ -0,0 +1,93 @@
+#ifndef BO_DFU_ALT_H
+#define BO_DFU_ALT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_flash_partitions.h"
+
+#include "bo_dfu_usb.h"
+#include "bo_dfu_ota.h"
+#include "bo_dfu_log.h"
+#include "bo_dfu_descriptor.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Alternate setting 0 is always the app, downloaded to the next OTA slot as usual.
+ * With CONFIG_BO_DFU_ALT_SETTINGS, alternate settings 1..n are added for each writable data partition in the partition table
+ * (excluding OTA data, which is managed here, and encrypted partitions), named by their labels. These are written as raw
+ * images, without any header checks or verification, and return to dfuIDLE after manifestation so that further downloads may
+ * follow in the same session.
+*/
+
+#ifdef CONFIG_BO_DFU_ALT_SETTINGS
+
+typedef struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t string[sizeof(((esp_partition_info_t*)0)->label)];
+} bo_dfu_alt_string_descriptor_t;
+
+static struct {
+    uint32_t count;
+    esp_partition_pos_t partitions[CONFIG_BO_DFU_ALT_SETTINGS_MAX];
+    bo_dfu_alt_string_descriptor_t strings[CONFIG_BO_DFU_ALT_SETTINGS_MAX];
+} s_bo_dfu_alt;
+
+static IRAM_ATTR void bo_dfu_alt_init(void)
+{
+    s_bo_dfu_alt.count = 0;
+    const esp_partition_info_t *partitions = bootloader_mmap(ESP_PARTITION_TABLE_OFFSET, ESP_PARTITION_TABLE_MAX_LEN);
+    if(!partitions)
+    {
+        ESP_LOGW(BO_DFU_TAG, "[%s] partition table unavailable", __func__);
+        return;
+    }
+    for(size_t i = 0; i < ESP_PARTITION_TABLE_MAX_LEN / sizeof(esp_partition_info_t); ++i)
+    {
+        // The table ends with an MD5 entry or erased flash.
+        if(partitions[i].magic != ESP_PARTITION_MAGIC)
+        {
+            break;
+        }
+        if(!bo_dfu_ota_is_writable_data(&partitions[i]))
+        {
+            continue;
+        }
+        if(s_bo_dfu_alt.count >= CONFIG_BO_DFU_ALT_SETTINGS_MAX)
+        {
+            ESP_LOGW(BO_DFU_TAG, "[%s] too many partitions", __func__);
+            break;
+        }
+        const uint32_t alt = s_bo_dfu_alt.count++;
+        s_bo_dfu_alt.partitions[alt] = partitions[i].pos;
+
+        bo_dfu_alt_string_descriptor_t *string = &s_bo_dfu_alt.strings[alt];
+        const size_t label_len = strnlen((const char*)partitions[i].label, sizeof(partitions[i].label));
+        for(size_t c = 0; c < label_len; ++c)
+        {
+            string->string[c] = partitions[i].label[c];
+        }
+        string->bLength = offsetof(bo_dfu_alt_string_descriptor_t, string) + label_len * sizeof(uint16_t);
+        string->bDescriptorType = BO_DFU_USB_DESCRIPTOR_TYPE_STRING;
+
+        bo_dfu_usb_interface_descriptor_t *interface = &g_usb_descriptor_configuration.alt_interfaces[alt];
+        *interface = g_usb_descriptor_configuration.interfaces[0];
+        interface->bAlternateSetting = 1 + alt;
+        interface->iInterface = BO_DFU_DESCRIPTOR_STRING_INDEX_ALT_FIRST + alt;
+
+        ESP_LOGD(BO_DFU_TAG, "[%s] alt %u: 0x%x (size: 0x%X)", __func__, 1 + alt, partitions[i].pos.offset, partitions[i].pos.size);
+    }
+    bootloader_munmap(partitions);
+    g_usb_descriptor_configuration.configuration.wTotalLength = offsetof(typeof(g_usb_descriptor_configuration), alt_interfaces) + s_bo_dfu_alt.count * sizeof(bo_dfu_usb_interface_descriptor_t);
+}
+
+#else
+
+FORCE_INLINE_ATTR void bo_dfu_alt_init(void) {}
+
+#endif
+
+#endif /* BO_DFU_ALT_H */
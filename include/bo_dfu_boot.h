@@ -0,0 +1,40 @@
+#ifndef BO_DFU_BOOT_H
+#define BO_DFU_BOOT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_flash_partitions.h"
+#include "esp_image_format.h"
+
+#include "sdkconfig.h"
+
+/**
+ * With CONFIG_BO_DFU_BOOT_SKIP_REVERIFY, the image verified on manifestation is remembered so that, when the bootloader goes on
+ * to load it, the second full verification can be skipped. bootloader_load_image is wrapped at link time (see CMakeLists.txt
+ * and src/bo_dfu_boot.c); any other partition, or a remembered image which no longer matches, is loaded as usual.
+*/
+
+#ifdef CONFIG_BO_DFU_BOOT_SKIP_REVERIFY
+
+typedef struct {
+    esp_partition_pos_t partition;  // Zero size if nothing has been verified
+    esp_image_metadata_t metadata;
+} bo_dfu_boot_verified_t;
+
+extern bo_dfu_boot_verified_t g_bo_dfu_boot_verified;
+
+static IRAM_ATTR void bo_dfu_boot_set_verified(const esp_partition_pos_t *partition, const esp_image_metadata_t *metadata)
+{
+    g_bo_dfu_boot_verified.partition = *partition;
+    g_bo_dfu_boot_verified.metadata = *metadata;
+}
+
+#else
+
+FORCE_INLINE_ATTR void bo_dfu_boot_set_verified(const esp_partition_pos_t *partition, const esp_image_metadata_t *metadata) {}
+
+#endif
+
+#endif /* BO_DFU_BOOT_H */
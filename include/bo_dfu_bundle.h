@@ -0,0 +1,212 @@
+#ifndef BO_DFU_BUNDLE_H
+#define BO_DFU_BUNDLE_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_attr.h"
+#include "bootloader_sha.h"
+
+#include "bo_dfu_usb.h"
+#include "bo_dfu_ota.h"
+#include "bo_dfu_log.h"
+
+#include "sdkconfig.h"
+
+/**
+ * A bundle carries several images in one download. The first block holds a header listing the entries, and each entry's
+ * payload follows at a sector-aligned offset within the download (any gaps are padding and are discarded):
+ *      [header][pad][entry 0 payload][pad][entry 1 payload]...
+ * An entry with an empty label is the app, written to the next OTA slot. Others are written to the data partition with that
+ * label. On manifestation, every payload's SHA-256 is checked, and the app verified, before the OTA data is written last.
+ * A bundle is not atomic: there is nowhere to stage data payloads, so they overwrite their partitions as they arrive, before
+ * anything is verified. If the download fails or is abandoned, the running app stays active but its data partitions may hold
+ * part of the new contents. Each partition may only appear once in a bundle.
+*/
+
+#ifdef CONFIG_BO_DFU_BUNDLE
+
+#define BO_DFU_BUNDLE_MAGIC 0x55424F42 // "BOBU"
+#define BO_DFU_BUNDLE_VERSION 1
+#define BO_DFU_BUNDLE_SECTOR_SIZE SPI_SEC_SIZE
+
+typedef struct __attribute__((packed)) {
+    uint8_t label[16];      // Partition label, NUL-padded. Empty for the app.
+    uint32_t offset;        // Offset of the payload within the download, a multiple of 4096
+    uint32_t length;        // Payload length in bytes
+    uint8_t sha256[32];     // Payload SHA-256
+} bo_dfu_bundle_entry_t;
+_Static_assert(sizeof(bo_dfu_bundle_entry_t) == 56, "");
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t reserved;
+    bo_dfu_bundle_entry_t entries[];
+} bo_dfu_bundle_header_t;
+_Static_assert(sizeof(bo_dfu_bundle_header_t) == 16, "");
+_Static_assert(sizeof(bo_dfu_bundle_header_t) + CONFIG_BO_DFU_BUNDLE_MAX_ENTRIES * sizeof(bo_dfu_bundle_entry_t) <= BO_DFU_BUNDLE_SECTOR_SIZE, "");
+
+typedef struct {
+    uint32_t active;            // Set if the current download is a bundle
+    uint32_t entry_count;
+    int32_t app_entry;          // Index of the app entry, or -1 if none
+    uint32_t end;               // End of the last payload within the download
+    struct {
+        esp_partition_pos_t partition;
+        uint32_t offset;
+        uint32_t length;
+        uint8_t sha256[32];
+    } entries[CONFIG_BO_DFU_BUNDLE_MAX_ENTRIES];
+} bo_dfu_bundle_t;
+
+static IRAM_ATTR void bo_dfu_bundle_init(bo_dfu_bundle_t *bundle, const uint8_t *block, size_t len)
+{
+    memset(bundle, 0, sizeof(*bundle));
+    uint32_t magic;
+    if(len >= sizeof(magic))
+    {
+        memcpy(&magic, block, sizeof(magic));
+        bundle->active = (magic == BO_DFU_BUNDLE_MAGIC);
+    }
+}
+
+/**
+ * Checks the header in the first block and resolves each entry's partition. The app's partition (ie. the next OTA slot) must
+ * already be resolved in app_partition.
+*/
+static IRAM_ATTR usb_dfu_status_t bo_dfu_bundle_parse(bo_dfu_bundle_t *bundle, const uint8_t *block, const esp_partition_pos_t *app_partition)
+{
+    const bo_dfu_bundle_header_t *header = (const bo_dfu_bundle_header_t*)block;
+    if(
+        header->version != BO_DFU_BUNDLE_VERSION ||
+        header->entry_count == 0 ||
+        header->entry_count > CONFIG_BO_DFU_BUNDLE_MAX_ENTRIES
+    )
+    {
+        BO_DFU_LOGE("[%s] invalid header", __func__);
+        return BO_DFU_STATUS_errFILE;
+    }
+    bundle->app_entry = -1;
+    // Payloads must be in order, not overlapping each other or the header.
+    uint32_t min_offset = BO_DFU_BUNDLE_SECTOR_SIZE;
+    for(uint32_t i = 0; i < header->entry_count; ++i)
+    {
+        const bo_dfu_bundle_entry_t *entry = &header->entries[i];
+        const uint32_t sectors = (entry->length + (BO_DFU_BUNDLE_SECTOR_SIZE - 1)) / BO_DFU_BUNDLE_SECTOR_SIZE;
+        if(
+            entry->length == 0 ||
+            (entry->offset % BO_DFU_BUNDLE_SECTOR_SIZE) != 0 ||
+            entry->offset < min_offset ||
+            sectors > (UINT32_MAX - entry->offset) / BO_DFU_BUNDLE_SECTOR_SIZE
+        )
+        {
+            BO_DFU_LOGE("[%s] invalid entry %u", __func__, i);
+            return BO_DFU_STATUS_errFILE;
+        }
+        min_offset = entry->offset + sectors * BO_DFU_BUNDLE_SECTOR_SIZE;
+
+        esp_partition_pos_t partition;
+        if(entry->label[0] == '\0')
+        {
+            if(bundle->app_entry >= 0)
+            {
+                BO_DFU_LOGE("[%s] multiple apps", __func__);
+                return BO_DFU_STATUS_errFILE;
+            }
+            bundle->app_entry = i;
+            partition = *app_partition;
+        }
+        else if(ESP_OK != bo_dfu_ota_find_data(entry->label, &partition))
+        {
+            BO_DFU_LOGE("[%s] entry %u: partition not found", __func__, i);
+            return BO_DFU_STATUS_errTARGET;
+        }
+        if(entry->length > partition.size)
+        {
+            BO_DFU_LOGE("[%s] entry %u: too large for 0x%x (size: 0x%X)", __func__, i, partition.offset, partition.size);
+            return BO_DFU_STATUS_errADDRESS;
+        }
+        for(uint32_t j = 0; j < i; ++j)
+        {
+            // Including the same label twice, which would write the partition twice and leave only one payload to verify.
+            const esp_partition_pos_t *other = &bundle->entries[j].partition;
+            if(partition.offset < other->offset + other->size && other->offset < partition.offset + partition.size)
+            {
+                BO_DFU_LOGE("[%s] entry %u: overlaps entry %u", __func__, i, j);
+                return BO_DFU_STATUS_errFILE;
+            }
+        }
+        bundle->entries[i].partition = partition;
+        bundle->entries[i].offset = entry->offset;
+        bundle->entries[i].length = entry->length;
+        memcpy(bundle->entries[i].sha256, entry->sha256, sizeof(bundle->entries[i].sha256));
+        BO_DFU_LOGI("[%s] entry %u: 0x%X bytes to 0x%x", __func__, i, entry->length, partition.offset);
+    }
+    bundle->entry_count = header->entry_count;
+    bundle->end = min_offset;
+    return BO_DFU_STATUS_OK;
+}
+
+/**
+ * Finds the entry that a block of the download belongs to, and the sector within its partition. Returns -1 if the block is
+ * the header or padding.
+*/
+static IRAM_ATTR int bo_dfu_bundle_route(const bo_dfu_bundle_t *bundle, uint32_t block, uint32_t *sector)
+{
+    for(uint32_t i = 0; i < bundle->entry_count; ++i)
+    {
+        const uint32_t first = bundle->entries[i].offset / BO_DFU_BUNDLE_SECTOR_SIZE;
+        const uint32_t count = (bundle->entries[i].length + (BO_DFU_BUNDLE_SECTOR_SIZE - 1)) / BO_DFU_BUNDLE_SECTOR_SIZE;
+        if(block >= first && block - first < count)
+        {
+            *sector = block - first;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Checks each payload's SHA-256 as written. blocks is the number of blocks received.
+static IRAM_ATTR usb_dfu_status_t bo_dfu_bundle_verify(const bo_dfu_bundle_t *bundle, uint32_t blocks)
+{
+    if(blocks < bundle->end / BO_DFU_BUNDLE_SECTOR_SIZE)
+    {
+        BO_DFU_LOGE("[%s] incomplete (%u of %u blocks)", __func__, blocks, bundle->end / BO_DFU_BUNDLE_SECTOR_SIZE);
+        return BO_DFU_STATUS_errNOTDONE;
+    }
+    for(uint32_t i = 0; i < bundle->entry_count; ++i)
+    {
+        // Mapped in chunks as the mmap window is limited.
+        #define BO_DFU_BUNDLE_VERIFY_CHUNK (16 * BO_DFU_BUNDLE_SECTOR_SIZE)
+        bootloader_sha256_handle_t sha = bootloader_sha256_start();
+        for(uint32_t offset = 0; offset < bundle->entries[i].length; offset += BO_DFU_BUNDLE_VERIFY_CHUNK)
+        {
+            const uint32_t len = MIN(BO_DFU_BUNDLE_VERIFY_CHUNK, bundle->entries[i].length - offset);
+            const void *data = bootloader_mmap(bundle->entries[i].partition.offset + offset, len);
+            if(!data)
+            {
+                bootloader_sha256_finish(sha, NULL);
+                return BO_DFU_STATUS_errVERIFY;
+            }
+            bootloader_sha256_data(sha, data, len);
+            bootloader_munmap(data);
+        }
+        #undef BO_DFU_BUNDLE_VERIFY_CHUNK
+        uint8_t digest[32];
+        bootloader_sha256_finish(sha, digest);
+        if(0 != memcmp(digest, bundle->entries[i].sha256, sizeof(digest)))
+        {
+            BO_DFU_LOGE("[%s] entry %u: SHA-256 mismatch", __func__, i);
+            return BO_DFU_STATUS_errVERIFY;
+        }
+    }
+    return BO_DFU_STATUS_OK;
+}
+
+#endif
+
+#endif /* BO_DFU_BUNDLE_H */
@@ -26,6 +26,14 @@ enum {
     BO_DFU_DESCRIPTOR_STRING_INDEX_DEVICE,
     BO_DFU_DESCRIPTOR_STRING_INDEX_SERIAL,
     BO_DFU_DESCRIPTOR_STRING_INDEX_INTERFACE,
+    #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+    BO_DFU_DESCRIPTOR_STRING_INDEX_INSTALLED,
+    #endif
+    #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+    // Partition labels (see bo_dfu_alt.h)
+    BO_DFU_DESCRIPTOR_STRING_INDEX_ALT_FIRST,
+    BO_DFU_DESCRIPTOR_STRING_INDEX_ALT_LAST = BO_DFU_DESCRIPTOR_STRING_INDEX_ALT_FIRST + CONFIG_BO_DFU_ALT_SETTINGS_MAX - 1,
+    #endif
 };
 
 BO_DFU_DESCRIPTOR_ATTR struct {
@@ -62,6 +70,20 @@ BO_DFU_DESCRIPTOR_ATTR struct {
     .string = STRINGIFY16(CONFIG_BO_DFU_INTERFACE_NAME),
 };
 
+#ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+// Reported in GETSTATUS iString while the download is being skipped.
+#define BO_DFU_INSTALLED_STRING "Already installed"
+BO_DFU_DESCRIPTOR_ATTR struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t string[sizeof(BO_DFU_INSTALLED_STRING) - 1];
+} g_usb_descriptor_string_installed = {
+    .bLength = sizeof(g_usb_descriptor_string_installed),
+    .bDescriptorType = BO_DFU_USB_DESCRIPTOR_TYPE_STRING,
+    .string = STRINGIFY16(BO_DFU_INSTALLED_STRING),
+};
+#endif
+
 BO_DFU_DESCRIPTOR_ATTR struct {
     uint8_t bLength;
     uint8_t bDescriptorType;
@@ -107,11 +129,19 @@ BO_DFU_DESCRIPTOR_ATTR struct {
     bo_dfu_usb_configuration_descriptor_t configuration;
     bo_dfu_usb_interface_descriptor_t interfaces[1];
     bo_dfu_functional_descriptor_t dfu_functional_descriptor;
+    #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+    // Alternate settings of interface 0, one per data partition. Only the first s_bo_dfu_alt.count are sent (see wTotalLength).
+    bo_dfu_usb_interface_descriptor_t alt_interfaces[CONFIG_BO_DFU_ALT_SETTINGS_MAX];
+    #endif
 } g_usb_descriptor_configuration = {
     .configuration = {
         .bLength = sizeof(bo_dfu_usb_configuration_descriptor_t),
         .bDescriptorType = BO_DFU_USB_DESCRIPTOR_TYPE_CONFIGURATION,
+        #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+        .wTotalLength = 0, // Set at runtime
+        #else
         .wTotalLength = sizeof(g_usb_descriptor_configuration),
+        #endif
         .bNumInterfaces = ARRAY_SIZE(g_usb_descriptor_configuration.interfaces),
         .bConfigurationValue = 1,
         .iConfiguration = 0,
@@ -0,0 +1,124 @@
+#ifndef BO_DFU_FAULT_H
+#define BO_DFU_FAULT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
+
+#include "bo_dfu_time.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Link fault injection for exercising the bus recovery paths (desync, wrong-toggle resync, lost handshakes).
+ * This is strictly a debugging aid. On real hardware, retry rate and throughput are measured from a real host at the configured
+ * rates; the host tests sweep each rate against a simulated bus (test/host/test_link.c). The rates need only be expressions, not
+ * constants, for the latter.
+ * Every fault affecting a packet is drawn from a cheap PRNG before waiting for that packet (bo_dfu_fault_draw), so that receiving
+ * and responding to it only consume decisions already made: a flag test, or a countdown for the glitched bus read.
+*/
+
+#ifdef CONFIG_BO_DFU_FAULT_INJECTION
+
+    #define BO_DFU_FAULT_SKEW_CYCLES CONFIG_BO_DFU_FAULT_RX_SKEW_CYCLES
+
+    // Faults occur when a random 32 bit value is below this, avoiding a division.
+    #define BO_DFU_FAULT_THRESHOLD(per_mille) ((uint32_t)(((uint64_t)(per_mille) << 32) / 1000))
+
+    typedef struct {
+        uint32_t prng;
+        uint32_t glitch_countdown;  // Bus reads remaining until the glitched one, or 0 if none
+        uint32_t glitch_mask;
+        uint32_t bit_flip;          // Position of the flipped bit as a fraction of the packet (of 2^32), or 0 if none
+        int32_t jitter;
+        bool se0;
+        bool drop_ack;
+        bool lost_ack;
+    } bo_dfu_fault_t;
+
+    static bo_dfu_fault_t s_bo_dfu_fault;
+
+    static IRAM_ATTR void bo_dfu_fault_init(void)
+    {
+        s_bo_dfu_fault = (bo_dfu_fault_t){ .prng = bo_dfu_ccount() | 1 };
+    }
+
+    static IRAM_ATTR uint32_t bo_dfu_fault_rand(void)
+    {
+        // xorshift32
+        uint32_t x = s_bo_dfu_fault.prng;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        s_bo_dfu_fault.prng = x;
+        return x;
+    }
+
+    // A random value in [0, n).
+    static IRAM_ATTR uint32_t bo_dfu_fault_range(uint32_t n)
+    {
+        return ((uint64_t)bo_dfu_fault_rand() * n) >> 32;
+    }
+
+    #define BO_DFU_FAULT_DRAW(name) (CONFIG_BO_DFU_FAULT_ ## name ## _PER_MILLE >= 1000 || bo_dfu_fault_rand() < BO_DFU_FAULT_THRESHOLD(CONFIG_BO_DFU_FAULT_ ## name ## _PER_MILLE))
+
+    // Draws every fault for the next packet received, and the handshake sent in reply. bus_reads is the most it may take.
+    static IRAM_ATTR void bo_dfu_fault_draw(uint32_t bus_reads)
+    {
+        s_bo_dfu_fault.se0 = BO_DFU_FAULT_DRAW(SE0);
+        s_bo_dfu_fault.drop_ack = BO_DFU_FAULT_DRAW(DROP_ACK);
+        s_bo_dfu_fault.lost_ack = BO_DFU_FAULT_DRAW(LOST_ACK);
+        s_bo_dfu_fault.bit_flip = BO_DFU_FAULT_DRAW(BIT_FLIP) ? (bo_dfu_fault_rand() | 1) : 0;
+        s_bo_dfu_fault.glitch_countdown = 0;
+        if(BO_DFU_FAULT_DRAW(RX_GLITCH))
+        {
+            s_bo_dfu_fault.glitch_countdown = 1 + bo_dfu_fault_range(bus_reads);
+            s_bo_dfu_fault.glitch_mask = 1 + bo_dfu_fault_range(3);
+        }
+        if(CONFIG_BO_DFU_FAULT_RX_JITTER_CYCLES > 0)
+        {
+            s_bo_dfu_fault.jitter = (int32_t)bo_dfu_fault_range(2 * CONFIG_BO_DFU_FAULT_RX_JITTER_CYCLES + 1) - CONFIG_BO_DFU_FAULT_RX_JITTER_CYCLES;
+        }
+    }
+
+    #define BO_DFU_FAULT(name) (s_bo_dfu_fault.name)
+
+    static IRAM_ATTR void bo_dfu_fault_jitter(uint32_t *bit_time)
+    {
+        *bit_time += s_bo_dfu_fault.jitter;
+    }
+
+    // Corrupts one or both lines of the bus read chosen for this packet, if any.
+    FORCE_INLINE_ATTR uint32_t bo_dfu_fault_glitch(uint32_t bus)
+    {
+        if(s_bo_dfu_fault.glitch_countdown != 0 && --s_bo_dfu_fault.glitch_countdown == 0)
+        {
+            bus ^= s_bo_dfu_fault.glitch_mask;
+        }
+        return bus;
+    }
+
+    static IRAM_ATTR void bo_dfu_fault_bit_flip(uint8_t *buffer, int len)
+    {
+        if(len > 0 && s_bo_dfu_fault.bit_flip != 0)
+        {
+            const uint32_t bit = ((uint64_t)s_bo_dfu_fault.bit_flip * (len * 8)) >> 32;
+            buffer[bit / 8] ^= (1 << (bit % 8));
+        }
+    }
+
+#else
+
+    #define BO_DFU_FAULT_SKEW_CYCLES 0
+    #define BO_DFU_FAULT(name) (false)
+
+    FORCE_INLINE_ATTR void bo_dfu_fault_init(void) {}
+    FORCE_INLINE_ATTR void bo_dfu_fault_draw(uint32_t bus_reads) {}
+    FORCE_INLINE_ATTR void bo_dfu_fault_jitter(uint32_t *bit_time) {}
+    FORCE_INLINE_ATTR uint32_t bo_dfu_fault_glitch(uint32_t bus) { return bus; }
+    FORCE_INLINE_ATTR void bo_dfu_fault_bit_flip(uint8_t *buffer, int len) {}
+
+#endif
+
+#endif /* BO_DFU_FAULT_H */
@@ -0,0 +1,68 @@
+#ifndef BO_DFU_FLASH_H
+#define BO_DFU_FLASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
+#include "soc/spi_reg.h"
+
+#include "bo_dfu_ota.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Flash operations which return without waiting for the flash to finish, for CONFIG_BO_DFU_BACKGROUND_FLASH.
+ * These drive SPI1 directly, as the ROM does. While the flash is busy, nothing else may access it (including via the cache),
+ * so callers must check bo_dfu_flash_is_busy (or bo_dfu_flash_wait_idle) first.
+*/
+
+#ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+
+#define BO_DFU_FLASH_PAGE_SIZE 256
+// Worst-case page program time (tPP max) of common SPI NOR flash, for which bootloader_flash_write blocks.
+#define BO_DFU_FLASH_PAGE_PROGRAM_MAX_US 3000
+#define BO_DFU_FLASH_STATUS_WIP (1 << 0)
+#define BO_DFU_FLASH_STATUS_WEL (1 << 1)
+
+static IRAM_ATTR uint32_t bo_dfu_flash_read_status(void)
+{
+    REG_WRITE(SPI_RD_STATUS_REG(1), 0);
+    REG_WRITE(SPI_CMD_REG(1), SPI_FLASH_RDSR);
+    while(REG_READ(SPI_CMD_REG(1)) != 0);
+    return REG_READ(SPI_RD_STATUS_REG(1));
+}
+
+static IRAM_ATTR bool bo_dfu_flash_is_busy(void)
+{
+    return (bo_dfu_flash_read_status() & BO_DFU_FLASH_STATUS_WIP) != 0;
+}
+
+static IRAM_ATTR void bo_dfu_flash_wait_idle(void)
+{
+    while(bo_dfu_flash_is_busy());
+}
+
+// Begins erasing the sector at address.
+static IRAM_ATTR esp_err_t bo_dfu_flash_erase_sector_start(uint32_t address)
+{
+    bo_dfu_flash_wait_idle();
+    REG_WRITE(SPI_CMD_REG(1), SPI_FLASH_WREN);
+    while(REG_READ(SPI_CMD_REG(1)) != 0);
+    if(!(bo_dfu_flash_read_status() & BO_DFU_FLASH_STATUS_WEL))
+    {
+        return ESP_FAIL;
+    }
+    REG_WRITE(SPI_ADDR_REG(1), address & 0xFFFFFF);
+    REG_WRITE(SPI_CMD_REG(1), SPI_FLASH_SE);
+    while(REG_READ(SPI_CMD_REG(1)) != 0);
+    return ESP_OK;
+}
+
+#else
+
+FORCE_INLINE_ATTR void bo_dfu_flash_wait_idle(void) {}
+
+#endif
+
+#endif /* BO_DFU_FLASH_H */
@@ -0,0 +1,39 @@
+#ifndef BO_DFU_HOOKS_H
+#define BO_DFU_HOOKS_H
+
+#include <stdint.h>
+
+#include "bo_dfu_usb.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Event hooks for custom DFU loops, for CONFIG_BO_DFU_HOOKS. All of these functions must be defined (IRAM_ATTR), even if empty.
+ * There are no weak defaults, as a weak definition linked first would keep the linker from extracting the integrator's from a later
+ * archive; instead, each is required with --require-defined (see CMakeLists.txt). They are only called where the host is not waiting on the bus: in the completion of a
+ * request (after its status stage), or at the end of bo_dfu_fsm. They must still return quickly, as with any work between
+ * bo_dfu_fsm calls, unless the host has been asked to wait (see bo_dfu_sched.h).
+ * This header only declares them, so that it may be included by the files defining them.
+*/
+
+#ifdef CONFIG_BO_DFU_HOOKS
+
+    /**
+     * A sector of the download has been written (or needed no writing). block is its index within the download (the DNLOAD block
+     * number, unless CONFIG_BO_DFU_ANY_BLOCK_SIZE), and bytes is the length of the download up to and including it.
+    */
+    void bo_dfu_on_block_committed(uint32_t block, uint32_t bytes);
+    /**
+     * Called at the end of bo_dfu_fsm if the state (a bo_dfu_fsm_t, see bo_dfu_internal_types.h) differs from the last call. Any
+     * passed through during one request aren't seen.
+    */
+    void bo_dfu_on_state_change(uint8_t previous, uint8_t state);
+    // Called with on_state_change upon entering dfuERROR.
+    void bo_dfu_on_error(usb_dfu_status_t status);
+    void bo_dfu_on_manifest_begin(void);
+    // status is BO_DFU_STATUS_OK if the image was written and verified.
+    void bo_dfu_on_manifest_end(usb_dfu_status_t status);
+
+#endif
+
+#endif /* BO_DFU_HOOKS_H */
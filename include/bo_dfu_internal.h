@@ -2,14 +2,23 @@
 #define BO_DFU_INTERNAL_H
 
 #include <stdint.h>
+#include <sys/param.h>
 
 #if __has_include("esp_app_desc.h")
 #   include "esp_app_desc.h"
 #endif
 #include "esp_image_format.h"
+#include "esp_rom_crc.h"
 
 #include "bo_dfu_log.h"
 #include "bo_dfu_internal_types.h"
+#include "bo_dfu_time.h"
+#include "bo_dfu_trace.h"
+#include "bo_dfu_descriptor.h"
+#include "bo_dfu_alt.h"
+#include "bo_dfu_flash.h"
+#include "bo_dfu_boot.h"
+#include "bo_dfu_hooks.h"
 
 #include "sdkconfig.h"
 
@@ -20,6 +29,16 @@ FORCE_INLINE_ATTR void IRAM_ATTR bo_dfu_update_state_impl(uint8_t current_state,
         case BO_DFU_FSM_IDLE:
             dfu->dfu.status_and_poll_timeout = 0;
             dfu->dfu.state_set = BO_DFU_SET_FSM(IDLE);
+            #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                // Any partial sector is abandoned (ABORT, CLRSTATUS, bus reset), unless the download may yet be resumed.
+                #ifdef CONFIG_BO_DFU_RESUME
+                if(!dfu->dfu.resumable)
+                #endif
+                {
+                    dfu->dfu.fill = 0;
+                    dfu->dfu.host_block = 0;
+                }
+            #endif
             break;
         case BO_DFU_FSM_DNLOAD_IDLE:
             dfu->dfu.status_and_poll_timeout = 0;
@@ -37,6 +56,12 @@ FORCE_INLINE_ATTR void IRAM_ATTR bo_dfu_update_state_impl(uint8_t current_state,
             dfu->dfu.status_and_poll_timeout = 0;
             dfu->dfu.state_set = BO_DFU_SET_FSM(DNLOAD_SYNC_DONE);
             break;
+        #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+        case BO_DFU_FSM_DNLOAD_BUSY:
+            dfu->dfu.status_and_poll_timeout = BO_DFU_STATUS_AND_POLL_TIMEOUT32(0, CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS);
+            dfu->dfu.state_set = BO_DFU_SET_FSM(DNLOAD_BUSY);
+            break;
+        #endif
         case BO_DFU_FSM_MANIFEST_SYNC_DONE:
             dfu->dfu.status_and_poll_timeout = 0;
             dfu->dfu.state_set = BO_DFU_SET_FSM(MANIFEST_SYNC_DONE);
@@ -57,10 +82,46 @@ FORCE_INLINE_ATTR void IRAM_ATTR bo_dfu_update_state_impl(uint8_t current_state,
         default:
             asm("error");
     }
+    #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+        // Let the host know it may end the download early.
+        if((new_state == BO_DFU_FSM_DNLOAD_SYNC_DONE || new_state == BO_DFU_FSM_DNLOAD_IDLE) && dfu->ota.installed && BO_DFU_T_IS_APP(dfu))
+        {
+            dfu->dfu.status_response.iString = BO_DFU_DESCRIPTOR_STRING_INDEX_INSTALLED;
+        }
+    #endif
+    BO_DFU_TRACE(STATE, BO_DFU_T_GET_STATE(dfu), status);
 }
 #define bo_dfu_update_state_known(current_state, dfu, state, status) bo_dfu_update_state_impl(current_state, (dfu), BO_DFU_FSM(state), status)
 #define bo_dfu_update_state(dfu, state, status) bo_dfu_update_state_impl(BO_DFU_T_GET_STATE(dfu), (dfu), BO_DFU_FSM(state), status)
 
+#ifdef CONFIG_BO_DFU_HOOKS
+
+    #define BO_DFU_HOOK(name, ...) bo_dfu_on_ ## name(__VA_ARGS__)
+
+    static IRAM_ATTR void bo_dfu_hooks_check_state(bo_dfu_t *dfu)
+    {
+        const bo_dfu_fsm_t state = BO_DFU_T_GET_STATE(dfu);
+        if(state == dfu->hook_state)
+        {
+            return;
+        }
+        const bo_dfu_fsm_t previous = dfu->hook_state;
+        dfu->hook_state = state;
+        bo_dfu_on_state_change(previous, state);
+        if(state == BO_DFU_FSM(ERROR))
+        {
+            bo_dfu_on_error(dfu->dfu.status);
+        }
+    }
+
+#else
+
+    #define BO_DFU_HOOK(name, ...) do {} while(0)
+
+    FORCE_INLINE_ATTR void bo_dfu_hooks_check_state(bo_dfu_t *dfu) {}
+
+#endif
+
 static void IRAM_ATTR bo_dfu_usb_set_address(bo_dfu_t *dfu, uint32_t address)
 {
     // Setting the 32b value (<=127) also clears configuration.
@@ -81,7 +142,7 @@ static IRAM_ATTR esp_err_t bo_dfu_verify_image_header(const esp_image_header_t *
         header->segment_count > ESP_IMAGE_MAX_SEGMENTS
     )
     {
-        ESP_LOGE(BO_DFU_TAG, "[%s] invalid image header", __func__);
+        BO_DFU_LOGE("[%s] invalid image header", __func__);
         return ESP_ERR_IMAGE_INVALID;
     }
     return ESP_OK;
@@ -93,14 +154,171 @@ static IRAM_ATTR esp_err_t bo_dfu_verify_image_app_desc(const esp_app_desc_t *ap
         app_desc->magic_word != ESP_APP_DESC_MAGIC_WORD
     )
     {
-        ESP_LOGE(BO_DFU_TAG, "[%s] invalid app_desc", __func__);
+        BO_DFU_LOGE("[%s] invalid app_desc", __func__);
         return ESP_ERR_IMAGE_INVALID;
     }
     return ESP_OK;
 }
 
+// The partition written by the current download.
+static IRAM_ATTR const esp_partition_pos_t *bo_dfu_target(const bo_dfu_t *dfu)
+{
+    #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+        if(dfu->dfu.alt > 0)
+        {
+            return &s_bo_dfu_alt.partitions[dfu->dfu.alt - 1];
+        }
+    #endif
+    return &dfu->ota.partition;
+}
+
+// Erases and writes the block to a sector of the partition.
+static IRAM_ATTR usb_dfu_status_t bo_dfu_write_block(bo_dfu_t *dfu, const esp_partition_pos_t *partition, size_t write_sector)
+{
+    const size_t write_offset = write_sector * 0x1000;
+    const size_t write_size = sizeof(dfu->dfu.buffer);
+    // Compare in sectors so that a large block number can't wrap write_offset back into range.
+    if(write_sector >= (partition->size / write_size))
+    {
+        BO_DFU_LOGE("[%s] address out of range (0x%X, 0x%x, 0x%X)", __func__, write_offset, write_size, partition->size);
+        return BO_DFU_STATUS_errADDRESS;
+    }
+
+    const size_t write_destination = partition->offset + write_offset;
+
+    #ifdef CONFIG_BO_DFU_MINIMISE_FLASH_WORK
+        // Reading back the sector is far quicker than erasing it, so check whether that (or programming) can be skipped.
+        bool skip_erase = false;
+        const uint32_t *existing = bootloader_mmap(write_destination, write_size);
+        if(existing)
+        {
+            if(0 == memcmp(existing, dfu->dfu.buffer_aligned, write_size))
+            {
+                bootloader_munmap(existing);
+                BO_DFU_LOGI("[%s] 0x%08X unchanged", __func__, write_destination);
+                return BO_DFU_STATUS_OK;
+            }
+            skip_erase = true;
+            for(size_t i = 0; i < write_size / sizeof(uint32_t); ++i)
+            {
+                if(existing[i] != UINT32_MAX)
+                {
+                    skip_erase = false;
+                    break;
+                }
+            }
+            bootloader_munmap(existing);
+        }
+    #else
+        const bool skip_erase = false;
+    #endif
+
+    #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+        // Only begin the erase. The rest continues in DNLOAD_BUSY (see bo_dfu_flash_step) while the host polls.
+        BO_DFU_LOGI("[%s] writing to 0x%08X in the background", __func__, write_destination);
+        if(!skip_erase && ESP_OK != bo_dfu_flash_erase_sector_start(write_destination))
+        {
+            BO_DFU_LOGE("[%s] erase error", __func__);
+            return BO_DFU_STATUS_errERASE;
+        }
+        dfu->dfu.flash.address = write_destination;
+        dfu->dfu.flash.written = 0;
+        dfu->dfu.flash.pending = 1;
+        return BO_DFU_STATUS_OK;
+    #endif
+
+    BO_DFU_LOGI("[%s] writing to 0x%08X", __func__, write_destination);
+    const uint32_t erase_start = bo_dfu_ccount();
+    if(!skip_erase && ESP_OK != bootloader_flash_erase_range(write_destination, write_size))
+    {
+        BO_DFU_LOGE("[%s] erase error", __func__);
+        return BO_DFU_STATUS_errERASE;
+    }
+    const uint32_t program_start = bo_dfu_ccount();
+    if(ESP_OK != bootloader_flash_write(write_destination, dfu->dfu.buffer, write_size, false))
+    {
+        BO_DFU_LOGE("[%s] write error", __func__);
+        return BO_DFU_STATUS_errPROG;
+    }
+    BO_DFU_STATS_BLOCK(dfu, program_start - erase_start, bo_dfu_ccount() - program_start);
+    return BO_DFU_STATUS_OK;
+}
+
+#ifdef CONFIG_BO_DFU_BUNDLE
+static IRAM_ATTR usb_dfu_status_t bo_dfu_process_bundle_block(bo_dfu_t *dfu)
+{
+    if(dfu->dfu.block_num == 0)
+    {
+        // The header. As with a sparse image, the app's destination is always the next OTA slot.
+        memset(&dfu->ota, 0, sizeof(dfu->ota));
+        if(ESP_OK != bo_dfu_ota_init(&dfu->ota))
+        {
+            // Only an error if the bundle includes an app, which won't fit a zero-size partition.
+            memset(&dfu->ota, 0, sizeof(dfu->ota));
+        }
+        return bo_dfu_bundle_parse(&dfu->bundle, dfu->dfu.buffer, &dfu->ota.partition);
+    }
+
+    uint32_t sector;
+    const int entry = bo_dfu_bundle_route(&dfu->bundle, dfu->dfu.block_num_counter, &sector);
+    if(entry < 0)
+    {
+        // Padding
+        return BO_DFU_STATUS_OK;
+    }
+    if(entry == dfu->bundle.app_entry && sector == 0)
+    {
+        const struct {
+            esp_image_header_t image_header;
+            esp_image_segment_header_t segment_header;
+            esp_app_desc_t app_desc;
+        } *image = (typeof(image)) dfu->dfu.buffer;
+        if(
+            ESP_OK != bo_dfu_verify_image_header(&image->image_header) ||
+            ESP_OK != bo_dfu_verify_image_app_desc(&image->app_desc)
+        )
+        {
+            return BO_DFU_STATUS_errTARGET;
+        }
+    }
+    return bo_dfu_write_block(dfu, &dfu->bundle.entries[entry].partition, sector);
+}
+#endif
+
 static IRAM_ATTR usb_dfu_status_t bo_dfu_process_block(bo_dfu_t *dfu)
 {
+    #ifdef CONFIG_BO_DFU_SPARSE
+        if(dfu->sparse.active)
+        {
+            if(dfu->dfu.block_num == 0 && BO_DFU_T_IS_APP(dfu))
+            {
+                // A sparse image isn't necessarily an app, so its header can't be checked here and the destination is always the next OTA slot.
+                memset(&dfu->ota, 0, sizeof(dfu->ota));
+                if(ESP_OK != bo_dfu_ota_init(&dfu->ota))
+                {
+                    BO_DFU_LOGE("[%s] invalid OTA configuration", __func__);
+                    return BO_DFU_STATUS_errADDRESS;
+                }
+            }
+            const esp_partition_pos_t *partition = bo_dfu_target(dfu);
+            BO_DFU_LOGI("[%s] sparse block %u at 0x%08X", __func__, dfu->dfu.block_num_counter, partition->offset + dfu->sparse.out_offset);
+            return bo_dfu_sparse_process(&dfu->sparse, partition, dfu->dfu.buffer, dfu->sparse.block_len, NULL);
+        }
+    #endif
+
+    if(!BO_DFU_T_IS_APP(dfu))
+    {
+        // Data partitions are written as-is.
+        return bo_dfu_write_block(dfu, bo_dfu_target(dfu), dfu->dfu.block_num_counter);
+    }
+
+    #ifdef CONFIG_BO_DFU_BUNDLE
+        if(dfu->bundle.active)
+        {
+            return bo_dfu_process_bundle_block(dfu);
+        }
+    #endif
+
     if(dfu->dfu.block_num == 0)
     {
         // Perform some rudimentary file verification checks on the first block.
@@ -116,44 +334,387 @@ static IRAM_ATTR usb_dfu_status_t bo_dfu_process_block(bo_dfu_t *dfu)
         {
             return BO_DFU_STATUS_errTARGET;
         }
+
+        #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+            if(ESP_OK == bo_dfu_ota_find_installed(&dfu->ota, &image->app_desc))
+            {
+                BO_DFU_LOGI("[%s] already installed at 0x%x", __func__, dfu->ota.partition.offset);
+                return BO_DFU_STATUS_OK;
+            }
+            if(dfu->ota.installed)
+            {
+                // A previous download attempt changed the destination.
+                dfu->ota.installed = false;
+                if(ESP_OK != bo_dfu_ota_init(&dfu->ota))
+                {
+                    memset(&dfu->ota, 0, sizeof(dfu->ota));
+                    BO_DFU_LOGE("[%s] invalid OTA configuration", __func__);
+                    return BO_DFU_STATUS_errADDRESS;
+                }
+            }
+        #endif
+
+        #if defined(CONFIG_BO_DFU_MINIMISE_FLASH_WORK)
+            // Now that the incoming app is known, choose the destination requiring the least flash work.
+            if(ESP_OK != bo_dfu_ota_select(&dfu->ota, &image->app_desc))
+            {
+                memset(&dfu->ota, 0, sizeof(dfu->ota));
+                BO_DFU_LOGE("[%s] invalid OTA configuration", __func__);
+                return BO_DFU_STATUS_errADDRESS;
+            }
+        #elif defined(CONFIG_BO_DFU_LAZY_OTA_INIT)
+            // Resolve the OTA target now that it's needed, and keep it for any subsequent download attempts.
+            if(dfu->ota.partition.size == 0)
+            {
+                const uint32_t ota_init_start = bo_dfu_ccount();
+                if(ESP_OK != bo_dfu_ota_init(&dfu->ota))
+                {
+                    memset(&dfu->ota, 0, sizeof(dfu->ota));
+                    BO_DFU_LOGE("[%s] invalid OTA configuration", __func__);
+                    return BO_DFU_STATUS_errADDRESS;
+                }
+                BO_DFU_LOGI("[%s] destination: 0x%x (size: 0x%X), resolved in %u cycles", __func__, dfu->ota.partition.offset, dfu->ota.partition.size, bo_dfu_ccount() - ota_init_start);
+            }
+        #endif
     }
 
-    const size_t write_sector = dfu->dfu.block_num_counter;
-    const size_t write_offset = write_sector * 0x1000;
-    const size_t write_size = sizeof(dfu->dfu.buffer);
-    if(
-        write_offset > dfu->ota.partition.size ||
-        (write_offset + write_size) > dfu->ota.partition.size
-    )
+    #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+        if(dfu->ota.installed)
+        {
+            // Accept and discard the remainder of the download.
+            return BO_DFU_STATUS_OK;
+        }
+    #endif
+
+    return bo_dfu_write_block(dfu, &dfu->ota.partition, dfu->dfu.block_num_counter);
+}
+
+#ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+static IRAM_ATTR usb_dfu_status_t bo_dfu_process_hash(bo_dfu_t *dfu)
+{
+    esp_partition_pos_t partition;
+    if(dfu->dfu.op.slot == BO_DFU_VENDOR_SLOT_ACTIVE)
     {
-        ESP_LOGE(BO_DFU_TAG, "[%s] address out of range (0x%X, 0x%x, 0x%X)", __func__, write_offset, write_size, dfu->ota.partition.size);
-        return BO_DFU_STATUS_errADDRESS;
+        if(ESP_OK != bo_dfu_ota_get_active(&partition))
+        {
+            return BO_DFU_STATUS_errADDRESS;
+        }
+    }
+    else
+    {
+        #ifdef CONFIG_BO_DFU_LAZY_OTA_INIT
+            if(BO_DFU_T_IS_APP(dfu) && dfu->ota.partition.size == 0 && ESP_OK != bo_dfu_ota_init(&dfu->ota))
+            {
+                memset(&dfu->ota, 0, sizeof(dfu->ota));
+                return BO_DFU_STATUS_errADDRESS;
+            }
+        #endif
+        partition = *bo_dfu_target(dfu);
     }
 
-    const size_t write_destination = dfu->ota.partition.offset + write_offset;
-    ESP_LOGI(BO_DFU_TAG, "[%s] writing to 0x%08X", __func__, write_destination);
-    if(ESP_OK != bootloader_flash_erase_range(write_destination, write_size))
+    // Sectors beyond the end of the partition are reported as 0.
+    uint32_t *hashes = dfu->dfu.buffer_aligned;
+    memset(hashes, 0, BO_DFU_FINGERPRINT_SECTORS * sizeof(uint32_t));
+    const uint32_t partition_sectors = partition.size / SPI_SEC_SIZE;
+    if(dfu->dfu.op.sector >= partition_sectors)
     {
-        ESP_LOGE(BO_DFU_TAG, "[%s] erase error", __func__);
-        return BO_DFU_STATUS_errERASE;
+        return BO_DFU_STATUS_OK;
     }
-    if(ESP_OK != bootloader_flash_write(write_destination, dfu->dfu.buffer, write_size, false))
+    const uint32_t sectors = MIN(BO_DFU_FINGERPRINT_SECTORS, partition_sectors - dfu->dfu.op.sector);
+    const uint8_t *data = bootloader_mmap(partition.offset + dfu->dfu.op.sector * SPI_SEC_SIZE, sectors * SPI_SEC_SIZE);
+    if(!data)
     {
-        ESP_LOGE(BO_DFU_TAG, "[%s] write error", __func__);
-        return BO_DFU_STATUS_errPROG;
+        return BO_DFU_STATUS_errADDRESS;
+    }
+    for(uint32_t i = 0; i < sectors; ++i)
+    {
+        // Equivalent to zlib's crc32()
+        hashes[i] = esp_rom_crc32_le(0, data + i * SPI_SEC_SIZE, SPI_SEC_SIZE);
     }
+    bootloader_munmap(data);
+    BO_DFU_LOGI("[%s] 0x%08X: %u sectors", __func__, partition.offset + dfu->dfu.op.sector * SPI_SEC_SIZE, sectors);
     return BO_DFU_STATUS_OK;
 }
+#endif
+
+#ifdef CONFIG_BO_DFU_RESUME
+// Undoes the last block after it failed, so that the host may send it again.
+static IRAM_ATTR void bo_dfu_resume_rewind(bo_dfu_t *dfu)
+{
+    #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+        if(dfu->dfu.op.type == BO_DFU_OP_HASH)
+        {
+            // Not a block.
+            return;
+        }
+    #endif
+    #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+        dfu->dfu.fill -= dfu->dfu.last_len;
+        --dfu->dfu.host_block;
+    #else
+        dfu->dfu.block_num_final = 0;
+    #endif
+}
+#endif
+
+#ifdef CONFIG_BO_DFU_BLOCK_CRC
+// CRC-16/X-25 (aka. CRC-16/IBM-SDLC): reflected polynomial 0x1021, initial value and final XOR 0xFFFF.
+static IRAM_ATTR uint16_t bo_dfu_block_crc(const uint8_t *data, size_t len)
+{
+    // The ROM function inverts the CRC before and after.
+    return esp_rom_crc16_le(0, data, len);
+}
+#endif
+
+#ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+// A page is only begun if, at its slowest, it would still finish within half of the poll timeout.
+#define BO_DFU_FLASH_STEP_CYCLES (BO_DFU_MS_TO_CCOUNT(CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS) / 2 - BO_DFU_FLASH_PAGE_PROGRAM_MAX_US * BO_DFU_CPU_FREQ_MHZ)
+_Static_assert(CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS * 1000 / 2 >= BO_DFU_FLASH_PAGE_PROGRAM_MAX_US, "Busy Poll Timeout is too short for a page program");
+
+/**
+ * Continues the background write for no more than half of the poll timeout, so that it's done before the host polls again.
+ * Programs pages once the erase has completed, and clears flash.pending when all are done.
+*/
+static IRAM_ATTR usb_dfu_status_t bo_dfu_flash_step(bo_dfu_t *dfu)
+{
+    const uint32_t start = bo_dfu_ccount();
+    while(dfu->dfu.flash.written < sizeof(dfu->dfu.buffer))
+    {
+        // bootloader_flash_write waits for the page to be programmed, so the last may take up to BO_DFU_FLASH_PAGE_PROGRAM_MAX_US.
+        if(bo_dfu_flash_is_busy() || bo_dfu_ccount() - start > BO_DFU_FLASH_STEP_CYCLES)
+        {
+            return BO_DFU_STATUS_OK;
+        }
+        if(ESP_OK != bootloader_flash_write(dfu->dfu.flash.address + dfu->dfu.flash.written, &dfu->dfu.buffer[dfu->dfu.flash.written], BO_DFU_FLASH_PAGE_SIZE, false))
+        {
+            BO_DFU_LOGE("[%s] write error", __func__);
+            return BO_DFU_STATUS_errPROG;
+        }
+        dfu->dfu.flash.written += BO_DFU_FLASH_PAGE_SIZE;
+    }
+    dfu->dfu.flash.pending = 0;
+    return BO_DFU_STATUS_OK;
+}
+#endif
+
+// Performs the work for DNLOAD_SYNC_READY: usually writing the received block.
+static IRAM_ATTR usb_dfu_status_t bo_dfu_process_op(bo_dfu_t *dfu)
+{
+    #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+        // A background write abandoned by an error must finish before the flash is accessed again.
+        bo_dfu_flash_wait_idle();
+        dfu->dfu.flash.pending = 0;
+    #endif
+    #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+        switch(dfu->dfu.op.type)
+        {
+            case BO_DFU_OP_HASH:
+                return bo_dfu_process_hash(dfu);
+            case BO_DFU_OP_KEEP:
+                #ifdef CONFIG_BO_DFU_SPARSE
+                    if(dfu->sparse.active)
+                    {
+                        // Blocks of a sparse image don't correspond to sectors.
+                        return BO_DFU_STATUS_errFILE;
+                    }
+                #endif
+                #ifdef CONFIG_BO_DFU_BUNDLE
+                    if(dfu->bundle.active)
+                    {
+                        // Nor do those of a bundle.
+                        return BO_DFU_STATUS_errFILE;
+                    }
+                #endif
+                if(dfu->dfu.block_num_counter >= (bo_dfu_target(dfu)->size / sizeof(dfu->dfu.buffer)))
+                {
+                    return BO_DFU_STATUS_errADDRESS;
+                }
+                BO_DFU_LOGI("[%s] keeping block %u", __func__, dfu->dfu.block_num_counter);
+                return BO_DFU_STATUS_OK;
+            case BO_DFU_OP_COPY:
+            {
+                #ifdef CONFIG_BO_DFU_SPARSE
+                    if(dfu->sparse.active)
+                    {
+                        return BO_DFU_STATUS_errFILE;
+                    }
+                #endif
+                #ifdef CONFIG_BO_DFU_BUNDLE
+                    if(dfu->bundle.active)
+                    {
+                        return BO_DFU_STATUS_errFILE;
+                    }
+                #endif
+                if(!BO_DFU_T_IS_APP(dfu))
+                {
+                    // The active slot only holds an app.
+                    return BO_DFU_STATUS_errTARGET;
+                }
+                esp_partition_pos_t active;
+                if(ESP_OK != bo_dfu_ota_get_active(&active) || dfu->dfu.block_num_counter >= (active.size / sizeof(dfu->dfu.buffer)))
+                {
+                    return BO_DFU_STATUS_errADDRESS;
+                }
+                const void *data = bootloader_mmap(active.offset + dfu->dfu.block_num_counter * sizeof(dfu->dfu.buffer), sizeof(dfu->dfu.buffer));
+                if(!data)
+                {
+                    return BO_DFU_STATUS_errADDRESS;
+                }
+                memcpy(dfu->dfu.buffer, data, sizeof(dfu->dfu.buffer));
+                bootloader_munmap(data);
+                // Then write as though it were downloaded.
+                break;
+            }
+            default:
+                break;
+        }
+    #endif
+    return bo_dfu_process_block(dfu);
+}
+
+// Processes the op for DNLOAD_SYNC_READY, moving to DNLOAD_SYNC_DONE (reporting dfuDNLOAD-IDLE) or ERROR.
+static IRAM_ATTR void bo_dfu_sync_op(bo_dfu_t *dfu, uint8_t current_dfu_fsm)
+{
+    usb_dfu_status_t err = bo_dfu_process_op(dfu);
+    BO_DFU_TRACE(BLOCK, err, dfu->dfu.block_num_counter);
+    if(err != BO_DFU_STATUS_OK)
+    {
+        #ifdef CONFIG_BO_DFU_RESUME
+            if(dfu->dfu.resumable)
+            {
+                bo_dfu_resume_rewind(dfu);
+            }
+        #endif
+        bo_dfu_update_state_known(current_dfu_fsm, dfu, ERROR, err);
+        return;
+    }
+    #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+        if(dfu->dfu.flash.pending)
+        {
+            bo_dfu_update_state(dfu, DNLOAD_BUSY, BO_DFU_STATUS_OK);
+            return;
+        }
+    #endif
+    #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+        if(dfu->dfu.op.type == BO_DFU_OP_HASH && dfu->dfu.op.from_idle)
+        {
+            // Already reported as dfuIDLE, so return there directly rather than by way of dfuDNLOAD-SYNC.
+            dfu->dfu.op.type = BO_DFU_OP_BLOCK;
+            bo_dfu_update_state(dfu, IDLE, BO_DFU_STATUS_OK);
+            return;
+        }
+    #endif
+    bo_dfu_update_state(dfu, DNLOAD_SYNC_DONE, BO_DFU_STATUS_OK);
+}
+
+/**
+ * Whether the op is already committed, needing no flash work, so that it may be processed immediately. The first GETSTATUS
+ * then reports dfuDNLOAD-IDLE with no poll timeout, rather than dfuDNBUSY followed by another GETSTATUS.
+*/
+static IRAM_ATTR bool bo_dfu_op_is_committed(const bo_dfu_t *dfu)
+{
+    #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+        if(dfu->dfu.op.type == BO_DFU_OP_KEEP)
+        {
+            // Only validated.
+            return true;
+        }
+        if(dfu->dfu.op.type != BO_DFU_OP_BLOCK)
+        {
+            return false;
+        }
+    #endif
+    #ifdef CONFIG_BO_DFU_SPARSE
+        if(dfu->sparse.active)
+        {
+            return false;
+        }
+    #endif
+    if(!BO_DFU_T_IS_APP(dfu) || dfu->dfu.block_num == 0)
+    {
+        return false;
+    }
+    #ifdef CONFIG_BO_DFU_BUNDLE
+        if(dfu->bundle.active)
+        {
+            // Padding is discarded.
+            uint32_t sector;
+            return bo_dfu_bundle_route(&dfu->bundle, dfu->dfu.block_num_counter, &sector) < 0;
+        }
+    #endif
+    #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+        if(dfu->ota.installed)
+        {
+            // Discarded.
+            return true;
+        }
+    #endif
+    return false;
+}
 
 static IRAM_ATTR usb_dfu_status_t bo_dfu_process_firmware(bo_dfu_t *dfu)
 {
+    bo_dfu_flash_wait_idle();
+
+    #ifdef CONFIG_BO_DFU_SPARSE
+        if(dfu->sparse.active && !bo_dfu_sparse_is_done(&dfu->sparse))
+        {
+            BO_DFU_LOGE("[%s] sparse image incomplete", __func__);
+            return BO_DFU_STATUS_errNOTDONE;
+        }
+    #endif
+
+    if(!BO_DFU_T_IS_APP(dfu))
+    {
+        // Data partitions have no format to verify, and nothing to activate.
+        return BO_DFU_STATUS_OK;
+    }
+
+    #ifdef CONFIG_BO_DFU_BUNDLE
+        if(dfu->bundle.active)
+        {
+            // Everything is checked before the OTA data is written, so the new app is only activated alongside valid data.
+            usb_dfu_status_t err = bo_dfu_bundle_verify(&dfu->bundle, dfu->dfu.block_num_counter);
+            if(err != BO_DFU_STATUS_OK)
+            {
+                return err;
+            }
+            if(dfu->bundle.app_entry < 0)
+            {
+                return BO_DFU_STATUS_OK;
+            }
+        }
+    #endif
+
     esp_image_metadata_t metadata;
     if(ESP_OK != esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &dfu->ota.partition, &metadata))
     {
-        ESP_LOGE(BO_DFU_TAG, "[%s] image invalid", __func__);
+        BO_DFU_LOGE("[%s] image invalid", __func__);
+        #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+            if(dfu->ota.installed)
+            {
+                // The matched app changed since it was found. It's left as it is, and the destination returns to the next slot,
+                // so that a retry is checked again from the first block and otherwise written in full.
+                dfu->ota.installed = false;
+                if(ESP_OK != bo_dfu_ota_init(&dfu->ota))
+                {
+                    memset(&dfu->ota, 0, sizeof(dfu->ota));
+                }
+            }
+        #endif
         return BO_DFU_STATUS_errVERIFY;
     }
 
+    #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+        if(dfu->ota.installed && dfu->ota.is_active)
+        {
+            // Nothing to do.
+            bo_dfu_boot_set_verified(&dfu->ota.partition, &metadata);
+            return BO_DFU_STATUS_OK;
+        }
+        // Otherwise, a match in another slot is activated below like a written image.
+    #endif
+
     if(ESP_OK != bootloader_flash_erase_sector(dfu->ota.entry_addr / 0x1000))
     {
         return BO_DFU_STATUS_errERASE;
@@ -164,6 +725,8 @@ static IRAM_ATTR usb_dfu_status_t bo_dfu_process_firmware(bo_dfu_t *dfu)
         return BO_DFU_STATUS_errWRITE;
     }
 
+    // The download is complete, so the image won't change before it's booted.
+    bo_dfu_boot_set_verified(&dfu->ota.partition, &metadata);
     return BO_DFU_STATUS_OK;
 }
 
@@ -173,11 +736,14 @@ static void IRAM_ATTR bo_dfu_usb_transaction_complete(bo_dfu_t *dfu)
     switch(dfu->transfer.bmRequestType_and_bRequest)
     {
         case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_USB_BREQUEST_SET_ADDRESS, 0b00000000):
-            ESP_LOGI(BO_DFU_TAG, "[%s] address assigned: 0x%02X", __func__, dfu->transfer.wValue);
+            BO_DFU_LOGI("[%s] address assigned: 0x%02X", __func__, dfu->transfer.wValue);
             bo_dfu_usb_set_address(dfu, dfu->transfer.wValue);
             break;
         case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_BREQUEST_GETSTATUS, 0b10100001):
         {
+            // The host now waits for the poll timeout it was just given.
+            BO_DFU_SCHED_OPEN(dfu, dfu->dfu.status_and_poll_timeout >> 8);
+            bo_dfu_trace_window(dfu->dfu.status_and_poll_timeout >> 8);
             const uint8_t current_dfu_fsm = BO_DFU_T_GET_STATE(dfu);
             switch(current_dfu_fsm)
             {
@@ -191,38 +757,118 @@ static void IRAM_ATTR bo_dfu_usb_transaction_complete(bo_dfu_t *dfu)
                         asm("alignment_error");
                     }
 
-                    usb_dfu_status_t err = bo_dfu_process_block(dfu);
+                    bo_dfu_sync_op(dfu, current_dfu_fsm);
+                    break;
+                }
+                #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+                case BO_DFU_FSM(DNLOAD_BUSY):
+                {
+                    usb_dfu_status_t err = bo_dfu_flash_step(dfu);
                     if(err != BO_DFU_STATUS_OK)
                     {
+                        #ifdef CONFIG_BO_DFU_RESUME
+                            if(dfu->dfu.resumable)
+                            {
+                                bo_dfu_resume_rewind(dfu);
+                            }
+                        #endif
                         bo_dfu_update_state_known(current_dfu_fsm, dfu, ERROR, err);
                         break;
                     }
-                    bo_dfu_update_state(dfu, DNLOAD_SYNC_DONE, BO_DFU_STATUS_OK);
+                    if(!dfu->dfu.flash.pending)
+                    {
+                        bo_dfu_update_state(dfu, DNLOAD_SYNC_DONE, BO_DFU_STATUS_OK);
+                    }
+                    // Else remain in DNLOAD_BUSY, reporting dfuDNBUSY again.
                     break;
                 }
+                #endif
                 case BO_DFU_FSM(DNLOAD_SYNC_DONE):
                 {
+                    #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+                        if(dfu->dfu.op.type == BO_DFU_OP_HASH)
+                        {
+                            // Not a block, so return to the previous state.
+                            dfu->dfu.op.type = BO_DFU_OP_BLOCK;
+                            bo_dfu_update_state(dfu, DNLOAD_IDLE, BO_DFU_STATUS_OK);
+                            break;
+                        }
+                        dfu->dfu.op.type = BO_DFU_OP_BLOCK;
+                    #endif
+                    #ifdef CONFIG_BO_DFU_RESUME
+                        #ifdef CONFIG_BO_DFU_SPARSE
+                            // Decoding can't be rewound.
+                            dfu->dfu.resumable = !dfu->sparse.active;
+                        #else
+                            dfu->dfu.resumable = 1;
+                        #endif
+                    #endif
                     bo_dfu_update_state(dfu, DNLOAD_IDLE, BO_DFU_STATUS_OK);
+                    #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                        if(dfu->dfu.fill < sizeof(dfu->dfu.buffer))
+                        {
+                            // Still filling the sector.
+                            break;
+                        }
+                        dfu->dfu.fill = 0;
+                    #endif
+                    BO_DFU_HOOK(block_committed, dfu->dfu.block_num_counter, dfu->dfu.block_num_counter * sizeof(dfu->dfu.buffer) + dfu->dfu.sector_len);
                     ++dfu->dfu.block_num;
                     break;
                 }
                 case BO_DFU_FSM(MANIFEST_SYNC_READY):
                 {
                     // -> MANIFEST
-                    ESP_LOGI(BO_DFU_TAG, "[%s] verifying firmware", __func__);
+                    BO_DFU_HOOK(manifest_begin);
+                    #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                        if(dfu->dfu.fill > 0)
+                        {
+                            // Write the final sector, which is only partially filled. The entire sector is still erased and written, so unused bytes are set to 0xFF.
+                            memset(dfu->dfu.buffer + dfu->dfu.fill, 0xFF, sizeof(dfu->dfu.buffer) - dfu->dfu.fill);
+                            usb_dfu_status_t err = bo_dfu_process_op(dfu);
+                            #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+                                // Only the erase has begun. Manifestation follows immediately, so finish the write here.
+                                while(err == BO_DFU_STATUS_OK && dfu->dfu.flash.pending)
+                                {
+                                    err = bo_dfu_flash_step(dfu);
+                                }
+                            #endif
+                            BO_DFU_TRACE(BLOCK, err, dfu->dfu.block_num_counter);
+                            if(err != BO_DFU_STATUS_OK)
+                            {
+                                BO_DFU_HOOK(manifest_end, err);
+                                bo_dfu_update_state_known(current_dfu_fsm, dfu, ERROR, err);
+                                break;
+                            }
+                            BO_DFU_HOOK(block_committed, dfu->dfu.block_num_counter, dfu->dfu.block_num_counter * sizeof(dfu->dfu.buffer) + dfu->dfu.sector_len);
+                            dfu->dfu.fill = 0;
+                            ++dfu->dfu.block_num;
+                        }
+                    #endif
+                    BO_DFU_LOGI("[%s] verifying firmware", __func__);
                     usb_dfu_status_t err = bo_dfu_process_firmware(dfu);
+                    BO_DFU_HOOK(manifest_end, err);
                     if(err != BO_DFU_STATUS_OK)
                     {
                         bo_dfu_update_state_known(current_dfu_fsm, dfu, ERROR, err);
                         break;
                     }
-                    ESP_LOGI(BO_DFU_TAG, "[%s] firmware verified", __func__);
+                    #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+                        if(!BO_DFU_T_IS_APP(dfu))
+                        {
+                            // Manifestation tolerant: return to dfuIDLE so that the app or another partition may follow.
+                            BO_DFU_LOGI("[%s] alt %u written", __func__, dfu->dfu.alt);
+                            bo_dfu_update_state(dfu, IDLE, BO_DFU_STATUS_OK);
+                            break;
+                        }
+                    #endif
+                    BO_DFU_LOGI("[%s] firmware verified", __func__);
                     bo_dfu_update_state(dfu, MANIFEST_SYNC_DONE, BO_DFU_STATUS_OK);
                     break;
                 }
                 case BO_DFU_FSM(MANIFEST_SYNC_DONE):
                 {
-                    ESP_LOGI(BO_DFU_TAG, "[%s] update complete", __func__);
+                    BO_DFU_LOGI("[%s] update complete", __func__);
                     bo_dfu_update_state(dfu, COMPLETE, BO_DFU_STATUS_OK);
                     break;
                 }
@@ -233,36 +879,204 @@ static void IRAM_ATTR bo_dfu_usb_transaction_complete(bo_dfu_t *dfu)
         }
         case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_BREQUEST_DNLOAD, 0b00100001):
         {
-            if(BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE))
+            if(BO_DFU_T_IS_NEW_DOWNLOAD(dfu, dfu->transfer.wValue))
             {
                 // First block, reset state.
                 dfu->dfu.block_num = 0;
+                #ifdef CONFIG_BO_DFU_RESUME
+                    dfu->dfu.resumable = 0;
+                #endif
+                #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                    dfu->dfu.fill = 0;
+                    dfu->dfu.host_block = 0;
+                #endif
+                #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+                    dfu->dfu.alt = dfu->alt_setting;
+                #endif
             }
-            if(dfu->transfer.len < sizeof(dfu->dfu.buffer))
+            #ifdef CONFIG_BO_DFU_RESUME
+            else if(BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE))
             {
-                dfu->dfu.block_num_final = 1;
-                if(dfu->transfer.len > 0)
+                BO_DFU_LOGI("[%s] resuming at block %u", __func__, dfu->transfer.wValue);
+            }
+            #endif
+            #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+                dfu->dfu.op.type = BO_DFU_OP_BLOCK;
+            #endif
+            #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                // The block was received into the sector buffer after any before it.
+                dfu->dfu.fill += dfu->transfer.len;
+                ++dfu->dfu.host_block;
+                #ifdef CONFIG_BO_DFU_RESUME
+                    dfu->dfu.last_len = dfu->transfer.len;
+                #endif
+                const size_t block_len = dfu->dfu.fill;
+            #else
+                const size_t block_len = dfu->transfer.len;
+            #endif
+            #ifdef CONFIG_BO_DFU_HOOKS
+                dfu->dfu.sector_len = block_len;
+            #endif
+            #ifdef CONFIG_BO_DFU_BLOCK_CRC
+                if(dfu->transfer.len > 0 && bo_dfu_block_crc(dfu->dfu.buffer + block_len - dfu->transfer.len, dfu->transfer.len) != dfu->transfer.wIndex)
                 {
-                    // Receiving a partial block. The entire sector will still be erased and written. Ensure unused bytes are cleared to 0xFF.
-                    memset(dfu->dfu.buffer + dfu->transfer.len, 0xFF, sizeof(dfu->dfu.buffer) - dfu->transfer.len);
+                    // Corrupted in transfer. Discard it so that it may be sent again.
+                    BO_DFU_LOGW("[%s] block %u CRC mismatch", __func__, dfu->transfer.wValue);
+                    #ifdef CONFIG_BO_DFU_RESUME
+                        if(dfu->dfu.resumable)
+                        {
+                            bo_dfu_resume_rewind(dfu);
+                        }
+                    #endif
+                    bo_dfu_update_state(dfu, ERROR, BO_DFU_STATUS_errVERIFY);
+                    break;
                 }
-            }
+            #endif
+            #ifdef CONFIG_BO_DFU_BUNDLE
+                if(dfu->dfu.block_num == 0)
+                {
+                    // Only the app (alternate setting 0) may be a bundle.
+                    bo_dfu_bundle_init(&dfu->bundle, dfu->dfu.buffer, BO_DFU_T_IS_APP(dfu) ? block_len : 0);
+                }
+            #endif
+            #ifdef CONFIG_BO_DFU_SPARSE
+                if(dfu->dfu.block_num == 0 && block_len > 0)
+                {
+                    bo_dfu_sparse_init(&dfu->sparse, dfu->dfu.buffer, block_len);
+                }
+                dfu->sparse.block_len = block_len;
+            #endif
+            #ifndef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                if(dfu->transfer.len < sizeof(dfu->dfu.buffer))
+                {
+                    dfu->dfu.block_num_final = 1;
+                    if(dfu->transfer.len > 0)
+                    {
+                        // Receiving a partial block. The entire sector will still be erased and written. Ensure unused bytes are cleared to 0xFF.
+                        memset(dfu->dfu.buffer + dfu->transfer.len, 0xFF, sizeof(dfu->dfu.buffer) - dfu->transfer.len);
+                    }
+                }
+            #endif
             if(dfu->transfer.len == 0)
             {
+                #ifdef CONFIG_BO_DFU_RESUME
+                    // The download is over, whatever the outcome of manifestation.
+                    dfu->dfu.resumable = 0;
+                #endif
                 bo_dfu_update_state(dfu, MANIFEST_SYNC_READY, BO_DFU_STATUS_OK);
             }
+            #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+            else if(block_len < sizeof(dfu->dfu.buffer))
+            {
+                // Nothing to write until the sector is full (or the image ends), so the block is done already.
+                bo_dfu_update_state(dfu, DNLOAD_SYNC_DONE, BO_DFU_STATUS_OK);
+            }
+            #endif
+            else if(bo_dfu_op_is_committed(dfu))
+            {
+                bo_dfu_sync_op(dfu, BO_DFU_T_GET_STATE(dfu));
+            }
             else
             {
                 bo_dfu_update_state(dfu, DNLOAD_SYNC_READY, BO_DFU_STATUS_OK);
+                #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+                    if(dfu->dfu.block_num != 0)
+                    {
+                        // The first poll only covers preparing the write. (The first block may need the OTA configuration resolved.)
+                        dfu->dfu.status_and_poll_timeout = BO_DFU_STATUS_AND_POLL_TIMEOUT32(BO_DFU_STATUS_OK, CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS);
+                    }
+                #endif
+                #ifdef CONFIG_BO_DFU_SPARSE
+                    if(dfu->sparse.active)
+                    {
+                        // A sparse block may expand to any number of sectors. Decode a copy without writing to find out how many.
+                        uint32_t sectors = 0;
+                        bo_dfu_sparse_t dry_run = dfu->sparse;
+                        bo_dfu_sparse_process(&dry_run, NULL, dfu->dfu.buffer, dfu->sparse.block_len, &sectors);
+                        const uint32_t poll_timeout = CONFIG_BO_DFU_DNLOAD_SYNC_POLL_TIMEOUT_MS + sectors * CONFIG_BO_DFU_SPARSE_SECTOR_POLL_TIMEOUT_MS;
+                        dfu->dfu.status_and_poll_timeout = BO_DFU_STATUS_AND_POLL_TIMEOUT32(BO_DFU_STATUS_OK, MIN(poll_timeout, 0xFFFFFF));
+                    }
+                #endif
             }
             break;
         }
         case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_USB_BREQUEST_SET_CONFIGURATION, 0b00000000):
-            ESP_LOGI(BO_DFU_TAG, "[%s] configuration set: 0x%02X", __func__, dfu->transfer.wValue);
+            BO_DFU_LOGI("[%s] configuration set: 0x%02X", __func__, dfu->transfer.wValue);
             bo_dfu_usb_set_configuration(dfu, dfu->transfer.wValue);
+            #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+                dfu->alt_setting = 0;
+            #endif
             break;
-        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_BREQUEST_CLRSTATUS, 0b00100001):
+        #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_USB_BREQUEST_SET_INTERFACE, 0b00000001):
+            BO_DFU_LOGI("[%s] alt setting: %u", __func__, dfu->transfer.wValue);
+            dfu->alt_setting = dfu->transfer.wValue;
+            break;
+        #endif
+        #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_VENDOR_BREQUEST_HASH, 0b01000000):
+            // Processed in the next GETSTATUS, as with a block.
+            dfu->dfu.op.type = BO_DFU_OP_HASH;
+            dfu->dfu.op.from_idle = (BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE));
+            #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+                if(dfu->dfu.op.from_idle)
+                {
+                    // The target is that of the download to follow.
+                    dfu->dfu.alt = dfu->alt_setting;
+                }
+            #endif
+            #ifdef CONFIG_BO_DFU_RESUME
+                if(dfu->dfu.op.from_idle)
+                {
+                    // The result overwrites the buffer, and may precede a new download, so the last can no longer be resumed.
+                    dfu->dfu.resumable = 0;
+                }
+            #endif
+            dfu->dfu.op.sector = dfu->transfer.wValue;
+            dfu->dfu.op.slot = dfu->transfer.wIndex;
+            bo_dfu_update_state(dfu, DNLOAD_SYNC_READY, BO_DFU_STATUS_OK);
+            dfu->dfu.status_and_poll_timeout = BO_DFU_STATUS_AND_POLL_TIMEOUT32(BO_DFU_STATUS_OK,
+                CONFIG_BO_DFU_DNLOAD_SYNC_POLL_TIMEOUT_MS + BO_DFU_FINGERPRINT_SECTORS * CONFIG_BO_DFU_FINGERPRINT_SECTOR_POLL_TIMEOUT_MS);
+            if(dfu->dfu.op.from_idle)
+            {
+                // Not part of a download, so the host continues to see dfuIDLE (with the poll timeout) until it's done.
+                dfu->dfu.next_state = BO_DFU_STATE_PROTOCOL_dfuIDLE;
+                dfu->dfu.get_state_response = BO_DFU_STATE_PROTOCOL_dfuIDLE;
+            }
+            break;
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_VENDOR_BREQUEST_COPY_SECTOR, 0b01000000):
+            dfu->dfu.op.type = (dfu->transfer.wIndex == BO_DFU_VENDOR_SLOT_ACTIVE) ? BO_DFU_OP_COPY : BO_DFU_OP_KEEP;
+            #ifdef CONFIG_BO_DFU_HOOKS
+                dfu->dfu.sector_len = sizeof(dfu->dfu.buffer);
+            #endif
+            #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                // Stands in for a whole sector.
+                dfu->dfu.fill = sizeof(dfu->dfu.buffer);
+                ++dfu->dfu.host_block;
+                #ifdef CONFIG_BO_DFU_RESUME
+                    dfu->dfu.last_len = sizeof(dfu->dfu.buffer);
+                #endif
+            #endif
+            if(bo_dfu_op_is_committed(dfu))
+            {
+                bo_dfu_sync_op(dfu, BO_DFU_T_GET_STATE(dfu));
+                break;
+            }
+            bo_dfu_update_state(dfu, DNLOAD_SYNC_READY, BO_DFU_STATUS_OK);
+            #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+                if(dfu->dfu.block_num != 0)
+                {
+                    dfu->dfu.status_and_poll_timeout = BO_DFU_STATUS_AND_POLL_TIMEOUT32(BO_DFU_STATUS_OK, CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS);
+                }
+            #endif
+            break;
+        #endif
         case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_BREQUEST_ABORT, 0b00100001):
+            #ifdef CONFIG_BO_DFU_RESUME
+                dfu->dfu.resumable = 0;
+            #endif
+            /* falls through */
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_BREQUEST_CLRSTATUS, 0b00100001):
             bo_dfu_update_state(dfu, IDLE, BO_DFU_STATUS_OK);
             break;
         default:
@@ -6,6 +6,12 @@
 
 #include "bo_dfu_usb.h"
 #include "bo_dfu_ota.h"
+#include "bo_dfu_stats.h"
+#include "bo_dfu_sparse.h"
+#include "bo_dfu_bundle.h"
+#include "bo_dfu_sched.h"
+
+#include "sdkconfig.h"
 
 typedef enum {
     BO_DFU_BUS_INIT = -4,       // Initial state. Waiting for bus reset.
@@ -22,6 +28,7 @@ typedef enum {
     BO_DFU_FSM_DNLOAD_SYNC_READY,
     BO_DFU_FSM_MANIFEST_SYNC_READY,
     BO_DFU_FSM_DNLOAD_SYNC_DONE,
+    BO_DFU_FSM_DNLOAD_BUSY,
     BO_DFU_FSM_ERROR,
     BO_DFU_FSM_MANIFEST_SYNC_DONE,
     BO_DFU_FSM_COMPLETE,
@@ -41,7 +48,10 @@ typedef enum {
     #define BO_DFU_SET_FSM_ENUM_VAL(protocol, next, fsm) ((((protocol) & 0xFF) << 16) | (((next) & 0xFF) << 0) | (((fsm) & 0xFF) << 24))
         BO_DFU_SET_FSM_IDLE                   = BO_DFU_SET_FSM_ENUM_VAL(BO_DFU_STATE_PROTOCOL_dfuIDLE,                 BO_DFU_STATE_PROTOCOL_dfuIDLE,                 BO_DFU_FSM_IDLE),
         BO_DFU_SET_FSM_DNLOAD_SYNC_READY      = BO_DFU_SET_FSM_ENUM_VAL(BO_DFU_STATE_PROTOCOL_dfuDNLOAD_SYNC,          BO_DFU_STATE_PROTOCOL_dfuDNBUSY,               BO_DFU_FSM_DNLOAD_SYNC_READY),
+        // Also entered directly from a DNLOAD needing no flash work, so that its first GETSTATUS reports dfuDNLOAD-IDLE.
         BO_DFU_SET_FSM_DNLOAD_SYNC_DONE       = BO_DFU_SET_FSM_ENUM_VAL(BO_DFU_STATE_PROTOCOL_dfuDNLOAD_SYNC,          BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE,          BO_DFU_FSM_DNLOAD_SYNC_DONE),
+        // Repeats, with a short poll timeout, until a background write completes.
+        BO_DFU_SET_FSM_DNLOAD_BUSY            = BO_DFU_SET_FSM_ENUM_VAL(BO_DFU_STATE_PROTOCOL_dfuDNBUSY,               BO_DFU_STATE_PROTOCOL_dfuDNBUSY,               BO_DFU_FSM_DNLOAD_BUSY),
         BO_DFU_SET_FSM_DNLOAD_IDLE            = BO_DFU_SET_FSM_ENUM_VAL(BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE,          BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE,          BO_DFU_FSM_DNLOAD_IDLE),
         BO_DFU_SET_FSM_MANIFEST_SYNC_READY    = BO_DFU_SET_FSM_ENUM_VAL(BO_DFU_STATE_PROTOCOL_dfuMANIFEST_SYNC,        BO_DFU_STATE_PROTOCOL_dfuMANIFEST,             BO_DFU_FSM_MANIFEST_SYNC_READY),
         BO_DFU_SET_FSM_MANIFEST_SYNC_DONE     = BO_DFU_SET_FSM_ENUM_VAL(BO_DFU_STATE_PROTOCOL_dfuMANIFEST_SYNC,        BO_DFU_STATE_PROTOCOL_appIDLE,                 BO_DFU_FSM_MANIFEST_SYNC_DONE),
@@ -51,12 +61,20 @@ typedef enum {
 } bo_dfu_set_fsm_t;
 #define BO_DFU_SET_FSM(state) BO_DFU_SET_FSM_ ## state
 
+typedef enum {
+    BO_DFU_OP_BLOCK = 0,    // Write the received block
+    BO_DFU_OP_HASH,         // Fingerprint sectors of a slot
+    BO_DFU_OP_COPY,         // Write a block copied from the active slot
+    BO_DFU_OP_KEEP,         // The target slot already holds this block
+} bo_dfu_op_t;
+
 typedef struct {
     union {
         uint32_t bmRequestType_and_bRequest;
         uint32_t request_is_active;
     };
-    uint32_t wValue;
+    uint16_t wValue;
+    uint16_t wIndex;
     union {
         const void *direction_is_device_to_host;
         const uint8_t *data;
@@ -68,6 +86,21 @@ typedef struct {
 typedef struct {
     esp_bl_usb_ota_partition_t ota;
     bo_dfu_bus_state_t state;
+    #ifdef CONFIG_BO_DFU_STATS
+    bo_dfu_stats_t stats;
+    #endif
+    #ifdef CONFIG_BO_DFU_SPARSE
+    bo_dfu_sparse_t sparse;
+    #endif
+    #ifdef CONFIG_BO_DFU_BUNDLE
+    bo_dfu_bundle_t bundle;
+    #endif
+    #ifdef CONFIG_BO_DFU_SCHEDULER
+    bo_dfu_sched_t sched;
+    #endif
+    #ifdef CONFIG_BO_DFU_HOOKS
+    uint8_t hook_state;     // State last reported to bo_dfu_on_state_change
+    #endif
     struct {
         union {
             bo_dfu_get_status_response_t status_response;
@@ -102,6 +135,40 @@ typedef struct {
                 uint32_t block_num_final : 1;
             };
         };
+        #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+        uint16_t fill;          // Bytes of the current sector received so far. block_num counts sectors rather than blocks.
+        uint16_t host_block;    // wValue expected of the next DNLOAD
+        #endif
+        #ifdef CONFIG_BO_DFU_RESUME
+        uint8_t resumable;      // A block of the current download has been accepted, so it may be resumed after an error
+        #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+        uint16_t last_len;      // Length of the last block, to be rewound if its sector fails
+        #endif
+        #endif
+        #ifdef CONFIG_BO_DFU_HOOKS
+        uint16_t sector_len;    // Bytes of the download in the sector being processed, for bo_dfu_on_block_committed
+        #endif
+        #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+        // Alternate setting of the current download, latched from alt_setting when it begins. 0 is the app, otherwise a data partition.
+        uint32_t alt;
+        #endif
+        #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+        // Write of the buffer continuing in DNLOAD_BUSY, after its erase has begun.
+        struct {
+            uint32_t address;   // Flash address of the sector
+            uint16_t written;   // Bytes programmed so far
+            uint8_t pending;
+        } flash;
+        #endif
+        #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+        // Operation to be performed in place of the usual block processing when in DNLOAD_SYNC_READY.
+        struct {
+            uint8_t type;       // bo_dfu_op_t
+            uint8_t from_idle;  // BO_DFU_OP_HASH: return to dfuIDLE rather than dfuDNLOAD_IDLE when done
+            uint16_t sector;    // BO_DFU_OP_HASH: first sector
+            uint8_t slot;       // BO_DFU_OP_HASH: bo_dfu_vendor_slot_t
+        } op;
+        #endif
         union {
             uint8_t buffer[0x1000];
             uint32_t buffer_aligned[0x1000 / sizeof(uint32_t)]; // this must be 32b aligned for flash_write purposes
@@ -124,10 +191,35 @@ typedef struct {
         #define BO_DFU_IS_ADDRESSED(x) (((x)->address_and_configuration) > 0)
         #define BO_DFU_IS_CONFIGURED(x) (((x)->configuration_value) > 0)
     };
+    #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+    uint8_t alt_setting;
+    #endif
     bo_dfu_usb_transfer_t transfer;
 } bo_dfu_t;
 #define BO_DFU_T_GET_STATE(x) ((x)->dfu.state_get)
 #define BO_DFU_T_IS_INIT(x) ((x)->state == BO_DFU_BUS_INIT)
 #define BO_DFU_T_IS_COMPLETE(x) BO_DFU_FSM_IS_COMPLETE(BO_DFU_T_GET_STATE(x))
+#ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+    #define BO_DFU_T_NEXT_BLOCK(x) ((x)->dfu.host_block)
+#else
+    #define BO_DFU_T_NEXT_BLOCK(x) ((x)->dfu.block_num_counter)
+#endif
+#ifdef CONFIG_BO_DFU_RESUME
+    // After an error and CLRSTATUS, dfuIDLE continues the interrupted download as well as accepting a new one.
+    #define BO_DFU_T_CAN_CONTINUE(x) (BO_DFU_T_GET_STATE(x) == BO_DFU_FSM(DNLOAD_IDLE) || (BO_DFU_T_GET_STATE(x) == BO_DFU_FSM(IDLE) && (x)->dfu.resumable))
+#else
+    #define BO_DFU_T_CAN_CONTINUE(x) (BO_DFU_T_GET_STATE(x) == BO_DFU_FSM(DNLOAD_IDLE))
+#endif
+// A DNLOAD with this wValue begins a new download, rather than continuing the current one.
+#ifdef CONFIG_BO_DFU_RESUME
+    #define BO_DFU_T_IS_NEW_DOWNLOAD(x, wValue) (BO_DFU_T_GET_STATE(x) == BO_DFU_FSM(IDLE) && !((x)->dfu.resumable && (wValue) == BO_DFU_T_NEXT_BLOCK(x)))
+#else
+    #define BO_DFU_T_IS_NEW_DOWNLOAD(x, wValue) (BO_DFU_T_GET_STATE(x) == BO_DFU_FSM(IDLE))
+#endif
+#ifdef CONFIG_BO_DFU_ALT_SETTINGS
+    #define BO_DFU_T_IS_APP(x) ((x)->dfu.alt == 0)
+#else
+    #define BO_DFU_T_IS_APP(x) (true)
+#endif
 
 #endif /* BO_DFU_INTERNAL_TYPES_H */
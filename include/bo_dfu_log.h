@@ -1,8 +1,100 @@
 #ifndef BO_DFU_LOG_H
 #define BO_DFU_LOG_H
 
+#include <assert.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_rom_sys.h"
+
+#include "sdkconfig.h"
 
 static const char *BO_DFU_TAG = "bo_dfu";
 
+/**
+ * BO_DFU_LOGx should be used instead of ESP_LOGx anywhere in the DFU session, where printing synchronously over UART may delay
+ * a response to the host.
+ *
+ * With CONFIG_BO_DFU_DEFERRED_LOG, each log is instead stored as a fixed-size record (format, timestamp and up to
+ * BO_DFU_LOG_MAX_ARGS 32-bit arguments) in a RAM ring, and printed later by bo_dfu_log_flush() once detached from the bus.
+ * Arguments must remain valid until then, so only use integers and pointers to constant strings (eg. __func__).
+*/
+
+#ifdef CONFIG_BO_DFU_DEFERRED_LOG
+
+    #define BO_DFU_LOG_MAX_ARGS 6
+
+    typedef struct {
+        const char *format;
+        uint32_t timestamp;
+        uintptr_t args[BO_DFU_LOG_MAX_ARGS];
+    } bo_dfu_log_record_t;
+
+    static struct {
+        uint32_t head;
+        uint32_t count;
+        bo_dfu_log_record_t records[CONFIG_BO_DFU_DEFERRED_LOG_RECORDS];
+    } s_bo_dfu_log;
+
+    static IRAM_ATTR void bo_dfu_log_defer(const char *format, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4, uintptr_t arg5)
+    {
+        bo_dfu_log_record_t *record = &s_bo_dfu_log.records[s_bo_dfu_log.head];
+        record->format = format;
+        record->timestamp = esp_log_timestamp();
+        record->args[0] = arg0;
+        record->args[1] = arg1;
+        record->args[2] = arg2;
+        record->args[3] = arg3;
+        record->args[4] = arg4;
+        record->args[5] = arg5;
+        s_bo_dfu_log.head = (s_bo_dfu_log.head + 1) % CONFIG_BO_DFU_DEFERRED_LOG_RECORDS;
+        // Keeps counting beyond capacity so that the number of lost records can be reported.
+        ++s_bo_dfu_log.count;
+    }
+
+    static IRAM_ATTR void bo_dfu_log_flush(void)
+    {
+        uint32_t count = s_bo_dfu_log.count;
+        if(count > CONFIG_BO_DFU_DEFERRED_LOG_RECORDS)
+        {
+            ESP_LOGW(BO_DFU_TAG, "[%s] %u records lost", __func__, count - CONFIG_BO_DFU_DEFERRED_LOG_RECORDS);
+            count = CONFIG_BO_DFU_DEFERRED_LOG_RECORDS;
+        }
+        for(uint32_t i = (s_bo_dfu_log.head + CONFIG_BO_DFU_DEFERRED_LOG_RECORDS - count); count > 0; ++i, --count)
+        {
+            const bo_dfu_log_record_t *record = &s_bo_dfu_log.records[i % CONFIG_BO_DFU_DEFERRED_LOG_RECORDS];
+            esp_rom_printf(record->format, record->timestamp, BO_DFU_TAG, record->args[0], record->args[1], record->args[2], record->args[3], record->args[4], record->args[5]);
+        }
+        s_bo_dfu_log.head = 0;
+        s_bo_dfu_log.count = 0;
+    }
+
+    #define BO_DFU_LOG_NARGS_IMPL(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+    #define BO_DFU_LOG_NARGS(...) BO_DFU_LOG_NARGS_IMPL(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+    #define BO_DFU_LOG_ARGS_IMPL(_, a0, a1, a2, a3, a4, a5, ...) (uintptr_t)(a0), (uintptr_t)(a1), (uintptr_t)(a2), (uintptr_t)(a3), (uintptr_t)(a4), (uintptr_t)(a5)
+
+    #define BO_DFU_LOG_IMPL(level, letter, format, ...) do { \
+        _Static_assert(BO_DFU_LOG_NARGS(__VA_ARGS__) <= BO_DFU_LOG_MAX_ARGS, "too many deferred log arguments"); \
+        if(LOG_LOCAL_LEVEL >= (level)) { \
+            bo_dfu_log_defer(LOG_FORMAT(letter, format), BO_DFU_LOG_ARGS_IMPL(_, ##__VA_ARGS__, 0, 0, 0, 0, 0, 0)); \
+        } \
+    } while(0)
+
+    #define BO_DFU_LOGE(format, ...) BO_DFU_LOG_IMPL(ESP_LOG_ERROR, E, format, ##__VA_ARGS__)
+    #define BO_DFU_LOGW(format, ...) BO_DFU_LOG_IMPL(ESP_LOG_WARN, W, format, ##__VA_ARGS__)
+    #define BO_DFU_LOGI(format, ...) BO_DFU_LOG_IMPL(ESP_LOG_INFO, I, format, ##__VA_ARGS__)
+    #define BO_DFU_LOGD(format, ...) BO_DFU_LOG_IMPL(ESP_LOG_DEBUG, D, format, ##__VA_ARGS__)
+
+#else
+
+    FORCE_INLINE_ATTR void bo_dfu_log_flush(void) {}
+
+    #define BO_DFU_LOGE(format, ...) ESP_LOGE(BO_DFU_TAG, format, ##__VA_ARGS__)
+    #define BO_DFU_LOGW(format, ...) ESP_LOGW(BO_DFU_TAG, format, ##__VA_ARGS__)
+    #define BO_DFU_LOGI(format, ...) ESP_LOGI(BO_DFU_TAG, format, ##__VA_ARGS__)
+    #define BO_DFU_LOGD(format, ...) ESP_LOGD(BO_DFU_TAG, format, ##__VA_ARGS__)
+
+#endif
+
 #endif /* BO_DFU_LOG_H */
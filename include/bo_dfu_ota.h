@@ -8,6 +8,12 @@
 #include "bootloader_common.h"
 #include "bootloader_utility.h"
 #include "bootloader_flash.h"
+#if __has_include("esp_app_desc.h")
+#   include "esp_app_desc.h"
+#endif
+#include "esp_image_format.h"
+
+#include "bo_dfu_log.h"
 
 #include "sdkconfig.h"
 
@@ -25,6 +31,10 @@ typedef struct {
     esp_partition_pos_t partition;
     esp_ota_select_entry_t entry;
     uint32_t entry_addr;
+    #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+    bool installed;     // The incoming image is already in the partition and is valid, so it needn't be written
+    bool is_active;     // The partition is the running app's, so the OTA data needn't be written either
+    #endif
 } esp_bl_usb_ota_partition_t;
 
 // ESP-IDF's read_otadata has internal linkage so is copied here
@@ -50,41 +60,288 @@ static IRAM_ATTR esp_err_t read_otadata(const esp_partition_pos_t *ota_info, esp
     return ESP_OK;
 }
 
-static esp_err_t IRAM_ATTR bo_dfu_ota_init(esp_bl_usb_ota_partition_t *ota_partition)
+// Loads the partition table and the sequence number of the active OTA data entry (0 if none)
+static esp_err_t IRAM_ATTR bo_dfu_ota_load(bootloader_state_t *bs, uint32_t *ota_seq, int *next_ota_sector_index)
 {
-    bootloader_state_t bs = {0};
     esp_ota_select_entry_t otadata[2];
     if (
-        !bootloader_utility_load_partition_table(&bs) ||
-        bs.ota_info.offset == 0 ||
-        bs.app_count == 0 ||
-        read_otadata(&bs.ota_info, otadata) != ESP_OK
+        !bootloader_utility_load_partition_table(bs) ||
+        bs->ota_info.offset == 0 ||
+        bs->app_count == 0 ||
+        read_otadata(&bs->ota_info, otadata) != ESP_OK
     )
     {
         return ESP_FAIL;
     }
 
-    int next_ota_sector_index = 0;
-    uint32_t ota_seq = 0;
+    *next_ota_sector_index = 0;
+    *ota_seq = 0;
     if(!bootloader_common_ota_select_invalid(&otadata[0]) || !bootloader_common_ota_select_invalid(&otadata[1]))
     {
         int current_ota_sector_index = bootloader_common_get_active_otadata(otadata);
         if(current_ota_sector_index != -1)
         {
-            ota_seq = otadata[current_ota_sector_index].ota_seq;
-            next_ota_sector_index = ((current_ota_sector_index + 1) % 2);
+            *ota_seq = otadata[current_ota_sector_index].ota_seq;
+            *next_ota_sector_index = ((current_ota_sector_index + 1) % 2);
         }
     }
+    return ESP_OK;
+}
 
-    // Prepare the new OTA entry so it can be written directly to flash if DFU completes
-    ++ota_seq;
-    memcpy(&ota_partition->partition, &bs.ota[(ota_seq - 1) % bs.app_count], sizeof(ota_partition->partition));
-    ota_partition->entry_addr = bs.ota_info.offset + next_ota_sector_index * 0x1000;
+// Prepare the new OTA entry so it can be written directly to flash if DFU completes
+static void IRAM_ATTR bo_dfu_ota_prepare(esp_bl_usb_ota_partition_t *ota_partition, const bootloader_state_t *bs, uint32_t ota_seq, int next_ota_sector_index)
+{
+    memcpy(&ota_partition->partition, &bs->ota[(ota_seq - 1) % bs->app_count], sizeof(ota_partition->partition));
+    ota_partition->entry_addr = bs->ota_info.offset + next_ota_sector_index * 0x1000;
     memset(&ota_partition->entry, 0xFF, sizeof(ota_partition->entry));
     ota_partition->entry.ota_seq = ota_seq;
     ota_partition->entry.ota_state = ESP_OTA_IMG_VALID;
     ota_partition->entry.crc = bootloader_common_ota_select_crc(&ota_partition->entry);
+}
+
+static esp_err_t IRAM_ATTR bo_dfu_ota_init(esp_bl_usb_ota_partition_t *ota_partition)
+{
+    bootloader_state_t bs = {0};
+    int next_ota_sector_index;
+    uint32_t ota_seq;
+    if(ESP_OK != bo_dfu_ota_load(&bs, &ota_seq, &next_ota_sector_index))
+    {
+        return ESP_FAIL;
+    }
+    bo_dfu_ota_prepare(ota_partition, &bs, ota_seq + 1, next_ota_sector_index);
+    return ESP_OK;
+}
+
+// The running app's slot, which must not be overwritten. Without valid OTA data, this is ota_0 unless there is a factory app.
+static int IRAM_ATTR bo_dfu_ota_active_slot(const bootloader_state_t *bs, uint32_t ota_seq)
+{
+    return (ota_seq > 0) ? (int)((ota_seq - 1) % bs->app_count) : ((bs->factory.offset == 0) ? 0 : -1);
+}
+
+// The lowest sequence number greater than the active one that selects the given slot.
+static uint32_t IRAM_ATTR bo_dfu_ota_seq_for_slot(const bootloader_state_t *bs, uint32_t ota_seq, int slot)
+{
+    return ota_seq + 1 + ((slot + bs->app_count - (ota_seq % bs->app_count)) % bs->app_count);
+}
+
+// The partition of the running app.
+static esp_err_t IRAM_ATTR bo_dfu_ota_get_active(esp_partition_pos_t *partition)
+{
+    bootloader_state_t bs = {0};
+    int next_ota_sector_index;
+    uint32_t ota_seq;
+    if(ESP_OK != bo_dfu_ota_load(&bs, &ota_seq, &next_ota_sector_index))
+    {
+        return ESP_FAIL;
+    }
+    const int active_slot = bo_dfu_ota_active_slot(&bs, ota_seq);
+    memcpy(partition, (active_slot < 0) ? &bs.factory : &bs.ota[active_slot], sizeof(*partition));
     return ESP_OK;
 }
 
+// A data partition that may be written directly. OTA data is managed here, and encrypted partitions are unsupported.
+static bool IRAM_ATTR bo_dfu_ota_is_writable_data(const esp_partition_info_t *info)
+{
+    return (
+        info->type == PART_TYPE_DATA &&
+        info->subtype != PART_SUBTYPE_DATA_OTA &&
+        (info->flags & PART_FLAG_ENCRYPTED) == 0 &&
+        info->pos.size >= SPI_SEC_SIZE
+    );
+}
+
+// Finds a writable data partition by its label, which is NUL-padded as in the partition table.
+static esp_err_t IRAM_ATTR bo_dfu_ota_find_data(const uint8_t label[16], esp_partition_pos_t *partition)
+{
+    const esp_partition_info_t *partitions = bootloader_mmap(ESP_PARTITION_TABLE_OFFSET, ESP_PARTITION_TABLE_MAX_LEN);
+    if(!partitions)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    for(size_t i = 0; i < ESP_PARTITION_TABLE_MAX_LEN / sizeof(esp_partition_info_t); ++i)
+    {
+        // The table ends with an MD5 entry or erased flash.
+        if(partitions[i].magic != ESP_PARTITION_MAGIC)
+        {
+            break;
+        }
+        if(
+            bo_dfu_ota_is_writable_data(&partitions[i]) &&
+            0 == strncmp((const char*)partitions[i].label, (const char*)label, sizeof(partitions[i].label))
+        )
+        {
+            *partition = partitions[i].pos;
+            err = ESP_OK;
+            break;
+        }
+    }
+    bootloader_munmap(partitions);
+    return err;
+}
+
+#ifdef CONFIG_BO_DFU_MINIMISE_FLASH_WORK
+// Scores how similar the image in an OTA slot is to the incoming one. Higher is more similar.
+static int IRAM_ATTR bo_dfu_ota_slot_similarity(const esp_partition_pos_t *slot, const esp_app_desc_t *app_desc)
+{
+    const struct {
+        esp_image_header_t image_header;
+        esp_image_segment_header_t segment_header;
+        esp_app_desc_t app_desc;
+    } *image = bootloader_mmap(slot->offset, sizeof(*image));
+    if(!image)
+    {
+        return 0;
+    }
+    int score = 0;
+    if(image->image_header.magic == ESP_IMAGE_HEADER_MAGIC && image->app_desc.magic_word == ESP_APP_DESC_MAGIC_WORD)
+    {
+        if(0 == memcmp(image->app_desc.app_elf_sha256, app_desc->app_elf_sha256, sizeof(app_desc->app_elf_sha256)))
+        {
+            // Identical
+            score = 3;
+        }
+        else if(0 == strncmp(image->app_desc.project_name, app_desc->project_name, sizeof(app_desc->project_name)))
+        {
+            score = (0 == strncmp(image->app_desc.version, app_desc->version, sizeof(app_desc->version))) ? 2 : 1;
+        }
+    }
+    bootloader_munmap(image);
+    return score;
+}
+
+/**
+ * Alternative to bo_dfu_ota_init which, rather than always targeting the next slot in sequence, targets the non-active slot
+ * holding the image most similar to the incoming one (eg. the previous version after a rollback). Unchanged sectors are then
+ * skipped rather than erased and programmed.
+ * The OTA data entry is prepared with the lowest sequence number greater than the active one that selects this slot.
+*/
+static esp_err_t IRAM_ATTR bo_dfu_ota_select(esp_bl_usb_ota_partition_t *ota_partition, const esp_app_desc_t *app_desc)
+{
+    bootloader_state_t bs = {0};
+    int next_ota_sector_index;
+    uint32_t ota_seq;
+    if(ESP_OK != bo_dfu_ota_load(&bs, &ota_seq, &next_ota_sector_index))
+    {
+        return ESP_FAIL;
+    }
+
+    const int active_slot = bo_dfu_ota_active_slot(&bs, ota_seq);
+
+    // Start from the next slot in sequence so that it's preferred in a tie.
+    int best_slot = ota_seq % bs.app_count;
+    int best_score = -1;
+    for(uint32_t i = 0; i < bs.app_count; ++i)
+    {
+        const int slot = (ota_seq + i) % bs.app_count;
+        if(slot == active_slot)
+        {
+            continue;
+        }
+        const int score = bo_dfu_ota_slot_similarity(&bs.ota[slot], app_desc);
+        if(score > best_score)
+        {
+            best_slot = slot;
+            best_score = score;
+        }
+    }
+
+    ota_seq = bo_dfu_ota_seq_for_slot(&bs, ota_seq, best_slot);
+    bo_dfu_ota_prepare(ota_partition, &bs, ota_seq, next_ota_sector_index);
+    BO_DFU_LOGI("[%s] selected ota_%d (score: %d, seq: %u)", __func__, best_slot, best_score, ota_seq);
+    return ESP_OK;
+}
+#endif
+
+#ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+// The state of the newest OTA data entry selecting the given slot, or ESP_OTA_IMG_UNDEFINED if there is none.
+static uint32_t IRAM_ATTR bo_dfu_ota_slot_state(const bootloader_state_t *bs, const esp_ota_select_entry_t otadata[2], int slot)
+{
+    uint32_t state = ESP_OTA_IMG_UNDEFINED;
+    uint32_t newest_seq = 0;
+    for(int i = 0; i < 2; ++i)
+    {
+        // Unlike bootloader_common_ota_select_valid, entries which were rejected are included.
+        const esp_ota_select_entry_t *entry = &otadata[i];
+        if(
+            entry->ota_seq != UINT32_MAX &&
+            entry->ota_seq != 0 &&
+            entry->crc == bootloader_common_ota_select_crc(entry) &&
+            (int)((entry->ota_seq - 1) % bs->app_count) == slot &&
+            entry->ota_seq > newest_seq
+        )
+        {
+            newest_seq = entry->ota_seq;
+            state = entry->ota_state;
+        }
+    }
+    return state;
+}
+
+/**
+ * Checks whether an OTA slot holds an image with the same ELF SHA-256 as the incoming one, starting with the active slot.
+ * Slots whose OTA data entry was marked invalid or aborted (eg. by rollback) aren't considered, and a match must verify.
+ * If found, the slot is prepared as the destination (with installed set) so that the download needn't be written, and is_active
+ * is set if it's the running app; otherwise, its OTA data entry is written at manifestation to activate it.
+ * Returns ESP_ERR_NOT_FOUND if there's no match, or ESP_ERR_IMAGE_INVALID if every match is corrupt; either way, the download
+ * should be written as usual. Verification reads the whole app, so this must fit within the DNLOAD-SYNC poll timeout.
+*/
+static esp_err_t IRAM_ATTR bo_dfu_ota_find_installed(esp_bl_usb_ota_partition_t *ota_partition, const esp_app_desc_t *app_desc)
+{
+    bootloader_state_t bs = {0};
+    esp_ota_select_entry_t otadata[2];
+    int next_ota_sector_index;
+    uint32_t ota_seq;
+    if(ESP_OK != bo_dfu_ota_load(&bs, &ota_seq, &next_ota_sector_index) || ESP_OK != read_otadata(&bs.ota_info, otadata))
+    {
+        return ESP_FAIL;
+    }
+    const int active_slot = bo_dfu_ota_active_slot(&bs, ota_seq);
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    for(uint32_t i = 0; i < bs.app_count; ++i)
+    {
+        // The running app is preferred, as it needn't be activated. Without one (eg. the factory app), start from ota_0.
+        const int slot = ((active_slot < 0 ? 0 : active_slot) + i) % bs.app_count;
+        const uint32_t state = bo_dfu_ota_slot_state(&bs, otadata, slot);
+        if(state == ESP_OTA_IMG_INVALID || state == ESP_OTA_IMG_ABORTED)
+        {
+            continue;
+        }
+        const struct {
+            esp_image_header_t image_header;
+            esp_image_segment_header_t segment_header;
+            esp_app_desc_t app_desc;
+        } *image = bootloader_mmap(bs.ota[slot].offset, sizeof(*image));
+        if(!image)
+        {
+            return ESP_FAIL;
+        }
+        const bool match = (
+            image->image_header.magic == ESP_IMAGE_HEADER_MAGIC &&
+            image->app_desc.magic_word == ESP_APP_DESC_MAGIC_WORD &&
+            0 == memcmp(image->app_desc.app_elf_sha256, app_desc->app_elf_sha256, sizeof(app_desc->app_elf_sha256))
+        );
+        bootloader_munmap(image);
+        if(!match)
+        {
+            continue;
+        }
+        esp_image_metadata_t metadata;
+        if(ESP_OK != esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &bs.ota[slot], &metadata))
+        {
+            BO_DFU_LOGW("[%s] ota_%d matches but is invalid", __func__, slot);
+            err = ESP_ERR_IMAGE_INVALID;
+            continue;
+        }
+        const bool is_active = (slot == active_slot);
+        bo_dfu_ota_prepare(ota_partition, &bs, bo_dfu_ota_seq_for_slot(&bs, ota_seq, slot), next_ota_sector_index);
+        ota_partition->installed = true;
+        ota_partition->is_active = is_active;
+        BO_DFU_LOGI("[%s] ota_%d matches (active: %d, state: 0x%x)", __func__, slot, is_active, state);
+        return ESP_OK;
+    }
+    return err;
+}
+#endif
+
 #endif /* BO_DFU_OTA_H */
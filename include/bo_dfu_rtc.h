@@ -0,0 +1,133 @@
+#ifndef BO_DFU_RTC_H
+#define BO_DFU_RTC_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "bootloader_common.h"
+
+#include "bo_dfu_trace_types.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Data shared between the bootloader and the app lives in the custom area of ESP-IDF's retained RTC memory
+ * (CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC). This region is excluded from the app's memory map and survives software resets.
+ * The whole of rtc_retain_mem_t is covered by a CRC which the bootloader checks (clearing everything if invalid), so it must be
+ * updated after every write that should survive a reset.
+ *
+ * This header is usable from both the bootloader and the app.
+*/
+
+#ifdef CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+
+#define BO_DFU_RTC_ENABLED 1
+
+#define BO_DFU_RTC_HANDOFF_MAGIC 0x52444F42 // "BODR"
+
+typedef struct {
+    #ifdef CONFIG_BO_DFU_RTC_HANDOFF
+    // Set by the app to request DFU mode on the next boot. Stored with its complement to guard against stray writes.
+    uint32_t handoff_magic;
+    uint32_t handoff_magic_inverted;
+    #endif
+    #ifdef CONFIG_BO_DFU_TRACE
+    bo_dfu_trace_t trace;
+    #endif
+} bo_dfu_rtc_t;
+
+_Static_assert(sizeof(bo_dfu_rtc_t) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE, "CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE is too small");
+
+static inline IRAM_ATTR bo_dfu_rtc_t *bo_dfu_rtc_get(void)
+{
+    return (bo_dfu_rtc_t*)bootloader_common_get_rtc_retain_mem()->custom;
+}
+
+// ESP-IDF's check_rtc_retain_mem has internal linkage so is copied here
+static inline IRAM_ATTR bool bo_dfu_rtc_is_valid(void)
+{
+    const rtc_retain_mem_t *rtc_retain_mem = bootloader_common_get_rtc_retain_mem();
+    return (
+        esp_rom_crc32_le(UINT32_MAX, (const uint8_t*)rtc_retain_mem, sizeof(*rtc_retain_mem) - sizeof(rtc_retain_mem->crc)) == rtc_retain_mem->crc &&
+        rtc_retain_mem->crc != UINT32_MAX
+    );
+}
+
+static inline IRAM_ATTR void bo_dfu_rtc_init(void)
+{
+    // Garbage after power on. Clear it all, as ESP-IDF would, before it's validated by a CRC update.
+    if(!bo_dfu_rtc_is_valid())
+    {
+        memset(bootloader_common_get_rtc_retain_mem(), 0, sizeof(rtc_retain_mem_t));
+    }
+}
+
+static inline IRAM_ATTR void bo_dfu_rtc_commit(void)
+{
+    bootloader_common_update_rtc_retain_mem(NULL, false);
+}
+
+#ifdef CONFIG_BO_DFU_TRACE
+/**
+ * Returns the trace of the most recent DFU session, or NULL if there isn't one.
+ * Intended for use by the app after DFU mode has ended, eg. to print or upload it after a failed update.
+*/
+static inline const bo_dfu_trace_t *bo_dfu_rtc_get_trace(void)
+{
+    if(!bo_dfu_rtc_is_valid())
+    {
+        return NULL;
+    }
+    const bo_dfu_trace_t *trace = &bo_dfu_rtc_get()->trace;
+    if(trace->magic != BO_DFU_TRACE_MAGIC || trace->head >= CONFIG_BO_DFU_TRACE_EVENTS || trace->count > CONFIG_BO_DFU_TRACE_EVENTS)
+    {
+        return NULL;
+    }
+    return trace;
+}
+#endif
+
+#ifdef CONFIG_BO_DFU_RTC_HANDOFF
+/**
+ * Called by the app to enter DFU mode immediately on the next software reset (eg. esp_restart()), bypassing the entry button
+ * and reset reason checks.
+*/
+static inline void bo_dfu_rtc_request_dfu(void)
+{
+    bo_dfu_rtc_init();
+    bo_dfu_rtc_get()->handoff_magic = BO_DFU_RTC_HANDOFF_MAGIC;
+    bo_dfu_rtc_get()->handoff_magic_inverted = ~BO_DFU_RTC_HANDOFF_MAGIC;
+    bo_dfu_rtc_commit();
+}
+
+/**
+ * Called by the bootloader to check for, and consume, a DFU request from the app. A request is only ever honoured once.
+*/
+static inline IRAM_ATTR bool bo_dfu_rtc_take_handoff(void)
+{
+    if(!bo_dfu_rtc_is_valid())
+    {
+        return false;
+    }
+    bo_dfu_rtc_t *rtc = bo_dfu_rtc_get();
+    bool requested = (rtc->handoff_magic == BO_DFU_RTC_HANDOFF_MAGIC && rtc->handoff_magic_inverted == ~BO_DFU_RTC_HANDOFF_MAGIC);
+    if(rtc->handoff_magic != 0 || rtc->handoff_magic_inverted != 0)
+    {
+        rtc->handoff_magic = 0;
+        rtc->handoff_magic_inverted = 0;
+        bo_dfu_rtc_commit();
+    }
+    return requested;
+}
+#endif
+
+#endif /* CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC */
+
+#ifndef CONFIG_BO_DFU_RTC_HANDOFF
+FORCE_INLINE_ATTR bool bo_dfu_rtc_take_handoff(void) { return false; }
+#endif
+
+#endif /* BO_DFU_RTC_H */
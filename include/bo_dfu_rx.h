@@ -9,6 +9,7 @@
 #include "bo_dfu_internal.h"
 #include "bo_dfu_gpio.h"
 #include "bo_dfu_time.h"
+#include "bo_dfu_fault.h"
 
 typedef struct {
     union {
@@ -99,6 +100,9 @@ _Static_assert(
 
 _Static_assert(sizeof(((bo_dfu_usb_rx_packet_t*)0)->buffer) == 12, "");
 
+// Receive bit period. This only differs from the transmit period when skew is injected for testing.
+#define BO_DFU_USB_RX_CYCLES_PER_BIT (BO_DFU_USB_CPU_CYCLES_PER_BIT + BO_DFU_FAULT_SKEW_CYCLES)
+
 #define BO_DFU_USB_BUS_RAW_TO_RX(bus) (((bus) >> BO_DFU_GPIO_SHIFT) & (BO_DFU_GPIO_MASK >> BO_DFU_GPIO_SHIFT))
 
 typedef enum {
@@ -113,14 +117,283 @@ static IRAM_ATTR bo_dfu_usb_rx_bus_state_t bo_dfu_usb_rx_bus_state(void)
     return BO_DFU_USB_BUS_RAW_TO_RX(REG_READ(BO_DFU_GPIO_REG_IN));
 }
 
+#ifdef CONFIG_BO_DFU_RX_MAJORITY
+
+#define BO_DFU_USB_RX_READS_PER_BIT 3
+
+// Three samples are taken this far apart, centred on the middle of the bit.
+#define BO_DFU_USB_RX_MAJORITY_CENTRE_CYCLES (BO_DFU_USB_RX_CYCLES_PER_BIT / 2)
+#define BO_DFU_USB_RX_MAJORITY_SPACING_CYCLES CONFIG_BO_DFU_RX_MAJORITY_SPACING_CYCLES
+
+// The last sample must leave time to finish waiting for the end of the bit.
+_Static_assert(BO_DFU_USB_RX_MAJORITY_CENTRE_CYCLES + BO_DFU_USB_RX_MAJORITY_SPACING_CYCLES < BO_DFU_USB_RX_CYCLES_PER_BIT - BO_DFU_USB_CPU_CYCLES_WAIT_READ, "");
+
+static IRAM_ATTR uint32_t bo_dfu_usb_rx_sample_at(uint32_t bit_time, uint32_t offset)
+{
+    while(bo_dfu_ccount() - bit_time < offset);
+    return bo_dfu_fault_glitch(bo_dfu_usb_rx_bus_state());
+}
+
+// The state of the bit beginning at bit_time, by majority vote of three samples.
+static IRAM_ATTR uint32_t bo_dfu_usb_rx_bit_state(uint32_t bit_time)
+{
+    const uint32_t a = bo_dfu_usb_rx_sample_at(bit_time, BO_DFU_USB_RX_MAJORITY_CENTRE_CYCLES - BO_DFU_USB_RX_MAJORITY_SPACING_CYCLES);
+    const uint32_t b = bo_dfu_usb_rx_sample_at(bit_time, BO_DFU_USB_RX_MAJORITY_CENTRE_CYCLES);
+    const uint32_t c = bo_dfu_usb_rx_sample_at(bit_time, BO_DFU_USB_RX_MAJORITY_CENTRE_CYCLES + BO_DFU_USB_RX_MAJORITY_SPACING_CYCLES);
+    // Each line is voted on separately, so a glitch on either line in a single sample (including a brief SE0 or SE1) is outvoted.
+    return (a & b) | (a & c) | (b & c);
+}
+
+#else
+
+#define BO_DFU_USB_RX_READS_PER_BIT 1
+
+FORCE_INLINE_ATTR uint32_t bo_dfu_usb_rx_bit_state(uint32_t bit_time)
+{
+    return bo_dfu_fault_glitch(bo_dfu_usb_rx_bus_state());
+}
+
+#endif
+
+static IRAM_ATTR bool bo_dfu_usb_rx_wait_transition(uint32_t bus, uint32_t *bit_time, uint32_t timeout)
+{
+    for(;;)
+    {
+        uint32_t now = bo_dfu_ccount();
+        if(now - *bit_time > timeout)
+        {
+            return false;
+        }
+        if(bo_dfu_usb_rx_bus_state() != bus)
+        {
+            *bit_time = now;
+            return true;
+        }
+    }
+}
+
+static IRAM_ATTR bool bo_dfu_usb_bus_rx_check_reset(uint32_t *bit_time)
+{
+    return !bo_dfu_usb_rx_wait_transition(BO_DFU_USB_RX_BUS_SE0, bit_time, BO_DFU_USB_RESET_SIGNAL_CYCLES);
+}
+
+static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_bus_rx_check_eop(uint32_t *bit_time)
+{
+    // Check EOP (note: not necessarily SE0 here so must fail successfully if not)
+    uint32_t se0_start_time = *bit_time;
+
+    if(bo_dfu_usb_bus_rx_check_reset(bit_time))
+    {
+        return BO_DFU_BUS_RESET;
+    }
+    while(bo_dfu_ccount() - *bit_time < BO_DFU_USB_CPU_CYCLES_WAIT_READ);
+    if(bo_dfu_usb_rx_bus_state() != BO_DFU_USB_RX_BUS_J)
+    {
+        return BO_DFU_BUS_DESYNCED;
+    }
+    if(*bit_time - se0_start_time < BO_DFU_USB_CPU_CYCLES_PER_BIT)
+    {
+        return BO_DFU_BUS_SYNCED;
+    }
+    // Else valid EOP
+    return BO_DFU_BUS_OK;
+}
+
+// The most bits in a packet (see bo_dfu_usb_rx_packet_t.buffer), including the most stuffing bits possible.
+#define BO_DFU_USB_RX_PACKET_MAX_BITS (sizeof(((bo_dfu_usb_rx_packet_t*)0)->buffer) * 8 * 7 / 6 + 1)
+
+// Passed as token_address when the next packet is not expected to be a token.
+#define BO_DFU_USB_RX_ANY_PACKET (-1)
+
+
+// Returned by the decoder upon PRE, which is followed by another SOP rather than EOP. This is never a bus state.
+#define BO_DFU_USB_RX_PRE (BO_DFU_BUS_INIT - 1)
+
+#ifdef CONFIG_BO_DFU_RX_EARLY_REJECT
+
+/**
+ * Whether the packet can already be rejected, having received buffer[0] to buffer[received]. When a token is expected, this is
+ * as soon as the sync, PID or address shows it isn't a token for this device.
+*/
+static IRAM_ATTR bool bo_dfu_usb_rx_reject_early(const bo_dfu_usb_rx_packet_t *packet, int received, int token_address)
+{
+    if(received == 1 && packet->pid_with_check == BO_DFU_USB_PID_CHECK_PRE)
+    {
+        return true;
+    }
+    if(token_address == BO_DFU_USB_RX_ANY_PACKET)
+    {
+        return false;
+    }
+    switch(received)
+    {
+        case 0:
+            return packet->sync != BO_DFU_USB_SYNC_BYTE;
+        case 1:
+            switch(packet->pid_with_check)
+            {
+                case BO_DFU_USB_PID_CHECK_SETUP:
+                case BO_DFU_USB_PID_CHECK_OUT:
+                case BO_DFU_USB_PID_CHECK_IN:
+                    return false;
+                default:
+                    return true;
+            }
+        case 2:
+            // The address is the low 7 bits of the first token byte.
+            return (packet->token_bytes[0] & 0x7F) != token_address;
+        default:
+            return false;
+    }
+}
+
+// Waits out the remainder of a rejected packet without decoding it, leaving the receiver ready for the next SOP.
+static IRAM_ATTR int bo_dfu_usb_rx_skip_packet(uint32_t *bit_time, const bo_dfu_usb_rx_packet_t *packet)
+{
+    if(packet->pid_with_check == BO_DFU_USB_PID_CHECK_PRE)
+    {
+        /**
+         * PRE has no EOP; the low-speed packet it enables follows immediately. Hubs shouldn't repeat PRE to low-speed ports,
+         * but if one is seen, waiting for SE0 here would swallow that packet.
+        */
+        return BO_DFU_USB_RX_PRE;
+    }
+    const uint32_t start = *bit_time;
+    for(;;)
+    {
+        const uint32_t now = bo_dfu_ccount();
+        if(bo_dfu_usb_rx_bus_state() == BO_DFU_USB_RX_BUS_SE0)
+        {
+            *bit_time = now;
+            const bo_dfu_bus_state_t eop_check = bo_dfu_usb_bus_rx_check_eop(bit_time);
+            if(eop_check != BO_DFU_BUS_SYNCED)
+            {
+                // A valid EOP means the bus is still in sync, so continue with the next packet.
+                return (eop_check == BO_DFU_BUS_OK) ? BO_DFU_BUS_SYNCED : eop_check;
+            }
+            // Else too short to be EOP; keep waiting.
+        }
+        if(now - start > BO_DFU_USB_RX_PACKET_MAX_BITS * BO_DFU_USB_RX_CYCLES_PER_BIT)
+        {
+            return BO_DFU_BUS_DESYNCED;
+        }
+    }
+}
+
+#else
+
+FORCE_INLINE_ATTR bool bo_dfu_usb_rx_reject_early(const bo_dfu_usb_rx_packet_t *packet, int received, int token_address)
+{
+    return false;
+}
+
+FORCE_INLINE_ATTR int bo_dfu_usb_rx_skip_packet(uint32_t *bit_time, const bo_dfu_usb_rx_packet_t *packet)
+{
+    return BO_DFU_BUS_SYNCED;
+}
+
+#endif
+
+#ifdef CONFIG_BO_DFU_RX_CAPTURE
+
+#define BO_DFU_USB_RX_CAPTURE_SAMPLES BO_DFU_USB_RX_PACKET_MAX_BITS
+
+// NRZI decoding and unstuffing of the samples taken so far. received is BO_DFU_BUS_DESYNCED once the packet is invalid.
+typedef struct {
+    uint32_t previous_bus;
+    int consecutive;
+    uint32_t byte;
+    int bit;
+    int received;
+} bo_dfu_usb_rx_decoder_t;
+
+/**
+ * NRZI decodes and unstuffs one sample into the packet buffer, exactly as bo_dfu_usb_rx_byte would have. This is roughly 9-13
+ * cycles, so it fits in the time left of the bit in which the sample was taken.
+*/
+static IRAM_ATTR void bo_dfu_usb_rx_decode(bo_dfu_usb_rx_decoder_t *decoder, uint32_t bus, bo_dfu_usb_rx_packet_t *packet)
+{
+    if(decoder->received < 0)
+    {
+        return;
+    }
+    if(bus != BO_DFU_USB_RX_BUS_J && bus != BO_DFU_USB_RX_BUS_K)
+    {
+        decoder->received = BO_DFU_BUS_DESYNCED;
+        return;
+    }
+    if(bus != decoder->previous_bus)
+    {
+        decoder->previous_bus = bus;
+        if(decoder->consecutive < 6)
+        {
+            decoder->byte >>= 1;
+            ++decoder->bit;
+        }
+        decoder->consecutive = 0;
+    }
+    else
+    {
+        if(++decoder->consecutive >= 7)
+        {
+            decoder->received = BO_DFU_BUS_DESYNCED;
+            return;
+        }
+        decoder->byte = (decoder->byte >> 1) | (1 << 7);
+        ++decoder->bit;
+    }
+    // A byte ending with six 1s is followed by its stuffing bit.
+    if(decoder->bit == 8 && decoder->consecutive != 6)
+    {
+        if(decoder->received == sizeof(packet->buffer))
+        {
+            decoder->received = BO_DFU_BUS_DESYNCED;
+            return;
+        }
+        packet->buffer[decoder->received++] = decoder->byte;
+        decoder->byte = 0;
+        decoder->bit = 0;
+    }
+}
+
+/**
+ * Takes one raw bus sample per bit time until SE0, at the same point in each bit as bo_dfu_usb_rx_byte, and bit_time is left at
+ * the SE0 as it would be there. Each sample is decoded in the slack before the next bit time, after which the loop only waits,
+ * so the next sample is taken as soon as its bit time is reached however long the decoding took. Nothing is left to decode at
+ * SE0, so the response is no later than with bo_dfu_usb_rx_byte.
+*/
+static IRAM_ATTR int bo_dfu_usb_rx_packet_buffer(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet, int token_address)
+{
+    bo_dfu_usb_rx_decoder_t decoder = { .previous_bus = BO_DFU_USB_RX_BUS_J };
+    for(int count = 0; count < BO_DFU_USB_RX_CAPTURE_SAMPLES; ++count)
+    {
+        const uint32_t bus = bo_dfu_usb_rx_bit_state(*bit_time);
+        if(bus != BO_DFU_USB_RX_BUS_SE0)
+        {
+            bo_dfu_usb_rx_decode(&decoder, bus, packet);
+        }
+        while(bo_dfu_ccount() - *bit_time < BO_DFU_USB_RX_CYCLES_PER_BIT);
+        if(bus == BO_DFU_USB_RX_BUS_SE0)
+        {
+            // SE0 must fall between bytes.
+            return (decoder.bit == 0) ? decoder.received : BO_DFU_BUS_DESYNCED;
+        }
+        *bit_time += BO_DFU_USB_RX_CYCLES_PER_BIT;
+    }
+    // Too long to be valid.
+    return BO_DFU_BUS_DESYNCED;
+}
+
+#else
+
 static IRAM_ATTR int bo_dfu_usb_rx_byte(uint32_t *bit_time, uint32_t *previous_bus, int *consecutive)
 {
     uint8_t byte = 0;
     for(int bit = 0; bit < 8 || *consecutive == 6 /* <-- ensures wait/check for stuffing bit before ending byte */;)
     {
-        uint32_t new_bus = bo_dfu_usb_rx_bus_state();
+        uint32_t new_bus = bo_dfu_usb_rx_bit_state(*bit_time);
         // Waits until the time of the next transition here...
-        while(bo_dfu_ccount() - *bit_time < (BO_DFU_USB_CPU_CYCLES_PER_BIT /* + BO_DFU_USB_CPU_CYCLES_WAIT_READ */));
+        while(bo_dfu_ccount() - *bit_time < (BO_DFU_USB_RX_CYCLES_PER_BIT /* + BO_DFU_USB_CPU_CYCLES_WAIT_READ */));
         // ... then processes last bus state. The following processing time doubles as a brief delay to allow the bus to settle:
         switch(new_bus)
         {
@@ -154,7 +427,7 @@ static IRAM_ATTR int bo_dfu_usb_rx_byte(uint32_t *bit_time, uint32_t *previous_b
             default:
                 return BO_DFU_BUS_DESYNCED;
         }
-        *bit_time += BO_DFU_USB_CPU_CYCLES_PER_BIT;
+        *bit_time += BO_DFU_USB_RX_CYCLES_PER_BIT;
     }
     _Static_assert(
         BO_DFU_BUS_RESET < 0 &&
@@ -164,7 +437,7 @@ static IRAM_ATTR int bo_dfu_usb_rx_byte(uint32_t *bit_time, uint32_t *previous_b
     return byte;
 }
 
-static IRAM_ATTR int bo_dfu_usb_rx_packet_buffer(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet)
+static IRAM_ATTR int bo_dfu_usb_rx_packet_buffer(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet, int token_address)
 {
     int consecutive = 0;
     uint32_t previous_bus = BO_DFU_USB_RX_BUS_J;
@@ -186,57 +459,19 @@ static IRAM_ATTR int bo_dfu_usb_rx_packet_buffer(uint32_t *bit_time, bo_dfu_usb_
             return BO_DFU_BUS_DESYNCED;
         }
         packet->buffer[received] = byte;
-    }
-    return received;
-}
-
-static IRAM_ATTR bool bo_dfu_usb_rx_wait_transition(uint32_t bus, uint32_t *bit_time, uint32_t timeout)
-{
-    for(;;)
-    {
-        uint32_t now = bo_dfu_ccount();
-        if(now - *bit_time > timeout)
-        {
-            return false;
-        }
-        if(bo_dfu_usb_rx_bus_state() != bus)
+        if(bo_dfu_usb_rx_reject_early(packet, received, token_address))
         {
-            *bit_time = now;
-            return true;
+            return bo_dfu_usb_rx_skip_packet(bit_time, packet);
         }
     }
+    return received;
 }
 
-static IRAM_ATTR bool bo_dfu_usb_bus_rx_check_reset(uint32_t *bit_time)
-{
-    return !bo_dfu_usb_rx_wait_transition(BO_DFU_USB_RX_BUS_SE0, bit_time, BO_DFU_USB_RESET_SIGNAL_CYCLES);
-}
-
-static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_bus_rx_check_eop(uint32_t *bit_time)
-{
-    // Check EOP (note: not necessarily SE0 here so must fail successfully if not)
-    uint32_t se0_start_time = *bit_time;
-
-    if(bo_dfu_usb_bus_rx_check_reset(bit_time))
-    {
-        return BO_DFU_BUS_RESET;
-    }
-    while(bo_dfu_ccount() - *bit_time < BO_DFU_USB_CPU_CYCLES_WAIT_READ);
-    if(bo_dfu_usb_rx_bus_state() != BO_DFU_USB_RX_BUS_J)
-    {
-        return BO_DFU_BUS_DESYNCED;
-    }
-    if(*bit_time - se0_start_time < BO_DFU_USB_CPU_CYCLES_PER_BIT)
-    {
-        return BO_DFU_BUS_SYNCED;
-    }
-    // Else valid EOP
-    return BO_DFU_BUS_OK;
-}
+#endif
 
-static IRAM_ATTR int bo_dfu_usb_rx_buffer_and_check_eop(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet)
+static IRAM_ATTR int bo_dfu_usb_rx_buffer_and_check_eop(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet, int token_address)
 {
-    int bytes_received = bo_dfu_usb_rx_packet_buffer(bit_time, packet);
+    int bytes_received = bo_dfu_usb_rx_packet_buffer(bit_time, packet, token_address);
     if(bytes_received < 0)
     {
         return bytes_received;
@@ -254,7 +489,7 @@ static IRAM_ATTR bool bo_dfu_usb_rx_wait_sop(uint32_t *bit_time, uint32_t timeou
     return bo_dfu_usb_rx_wait_transition(BO_DFU_USB_RX_BUS_J, bit_time, timeout);
 }
 
-static IRAM_ATTR int bo_dfu_usb_rx_next_packet(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet)
+static IRAM_ATTR int bo_dfu_usb_rx_next_packet(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet, int token_address)
 {
     /**
      * Timeout is necessary when waiting for ACK or followup data to SETUP/OUT token.
@@ -262,11 +497,22 @@ static IRAM_ATTR int bo_dfu_usb_rx_next_packet(uint32_t *bit_time, bo_dfu_usb_rx
      * This occurs quickly enough that a SOP should not be missed, even if timed unfortunately.
     */
     uint32_t timeout = (BO_DFU_USB_WAIT_DATA_TIMEOUT_BIT_TIMES * BO_DFU_USB_CPU_CYCLES_PER_BIT);
-    if(!bo_dfu_usb_rx_wait_sop(bit_time, timeout))
-    {
-        return BO_DFU_BUS_SYNCED;
-    }
-    return bo_dfu_usb_rx_buffer_and_check_eop(bit_time, packet);
+    bo_dfu_fault_draw(BO_DFU_USB_RX_PACKET_MAX_BITS * BO_DFU_USB_RX_READS_PER_BIT);
+    int bytes_received;
+    do {
+        if(!bo_dfu_usb_rx_wait_sop(bit_time, timeout))
+        {
+            return BO_DFU_BUS_SYNCED;
+        }
+        bo_dfu_fault_jitter(bit_time);
+        if(BO_DFU_FAULT(se0))
+        {
+            return BO_DFU_BUS_DESYNCED;
+        }
+        bytes_received = bo_dfu_usb_rx_buffer_and_check_eop(bit_time, packet, token_address);
+    } while(bytes_received == BO_DFU_USB_RX_PRE);
+    bo_dfu_fault_bit_flip(packet->buffer, bytes_received);
+    return bytes_received;
 }
 
 #endif /* BO_DFU_USB_RX_H */
@@ -0,0 +1,112 @@
+#ifndef BO_DFU_SCHED_H
+#define BO_DFU_SCHED_H
+
+#include <stdint.h>
+#include <sys/param.h>
+
+#include "esp_attr.h"
+#include "esp_err.h"
+
+#include "bo_dfu_clk.h"
+#include "bo_dfu_log.h"
+#include "bo_dfu_time.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Cooperative scheduling of work between bo_dfu_fsm calls, for CONFIG_BO_DFU_SCHEDULER.
+ * The bus is only known to be idle after a GETSTATUS whose response asked the host to wait (bwPollTimeout) before polling again.
+ * A window opens as that request completes and closes BO_DFU_SCHED_GUARD_MS before the host may poll. The library's own work for
+ * the request (eg. writing the block) comes first, then bo_dfu_fsm runs each registered task at most once per window, provided its
+ * worst-case cost fits in what remains. Outside of a window, the usual rule applies: never block between bo_dfu_fsm calls.
+*/
+
+#ifdef CONFIG_BO_DFU_SCHEDULER
+
+    // Margin before the host may poll again, for the time taken to return to the bus.
+    #define BO_DFU_SCHED_GUARD_MS 1
+    // Longest window, so that it can be timed with the 32 bit cycle counter.
+    #define BO_DFU_SCHED_WINDOW_MAX_MS 10000
+
+    typedef void (*bo_dfu_sched_fn_t)(void *arg);
+
+    typedef struct {
+        bo_dfu_sched_fn_t fn;
+        void *arg;
+        uint32_t cost;              // Worst-case CPU cycles (at 240MHz)
+    } bo_dfu_sched_task_t;
+
+    typedef struct {
+        bo_dfu_sched_task_t tasks[CONFIG_BO_DFU_SCHEDULER_MAX_TASKS];
+        uint8_t count;
+        uint8_t first;              // Task to be offered the window first, rotated so that none is always last
+        uint8_t pending;            // Tasks are yet to run in the current window
+        uint32_t window_start;
+        uint32_t window_cycles;     // Zero if no window is open
+    } bo_dfu_sched_t;
+
+    // Registers fn to be called with arg in idle windows. cost is the most CPU cycles it may take.
+    static IRAM_ATTR esp_err_t bo_dfu_sched_add(bo_dfu_sched_t *sched, bo_dfu_sched_fn_t fn, void *arg, uint32_t cost)
+    {
+        if(sched->count >= CONFIG_BO_DFU_SCHEDULER_MAX_TASKS)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        sched->tasks[sched->count++] = (bo_dfu_sched_task_t){ .fn = fn, .arg = arg, .cost = cost };
+        return ESP_OK;
+    }
+
+    static IRAM_ATTR uint32_t bo_dfu_sched_idle_cycles(const bo_dfu_sched_t *sched)
+    {
+        const uint32_t elapsed = bo_dfu_ccount() - sched->window_start;
+        return (elapsed < sched->window_cycles) ? (sched->window_cycles - elapsed) : 0;
+    }
+
+    // Called upon completing a request whose response reported poll_timeout_ms.
+    static IRAM_ATTR void bo_dfu_sched_open(bo_dfu_sched_t *sched, uint32_t poll_timeout_ms)
+    {
+        poll_timeout_ms = MIN(poll_timeout_ms, BO_DFU_SCHED_WINDOW_MAX_MS);
+        sched->window_start = bo_dfu_ccount();
+        sched->window_cycles = (poll_timeout_ms > BO_DFU_SCHED_GUARD_MS) ? BO_DFU_MS_TO_CCOUNT(poll_timeout_ms - BO_DFU_SCHED_GUARD_MS) : 0;
+        sched->pending = (sched->window_cycles > 0);
+    }
+
+    static IRAM_ATTR void bo_dfu_sched_run(bo_dfu_sched_t *sched)
+    {
+        if(!sched->pending)
+        {
+            return;
+        }
+        sched->pending = 0;
+        for(uint32_t n = 0; n < sched->count; ++n)
+        {
+            const uint32_t i = (sched->first + n) % sched->count;
+            const bo_dfu_sched_task_t *task = &sched->tasks[i];
+            if(task->cost > bo_dfu_sched_idle_cycles(sched))
+            {
+                continue;
+            }
+            const uint32_t start = bo_dfu_ccount();
+            task->fn(task->arg);
+            const uint32_t cycles = bo_dfu_ccount() - start;
+            if(cycles > task->cost)
+            {
+                BO_DFU_LOGW("[%s] task %u took %u cycles (cost %u)", __func__, i, cycles, task->cost);
+            }
+        }
+        if(sched->count > 0)
+        {
+            sched->first = (sched->first + 1) % sched->count;
+        }
+    }
+
+    #define BO_DFU_SCHED_OPEN(dfu, poll_timeout_ms) bo_dfu_sched_open(&(dfu)->sched, poll_timeout_ms)
+    #define BO_DFU_SCHED_RUN(dfu) bo_dfu_sched_run(&(dfu)->sched)
+    #define BO_DFU_SCHED_IDLE_CYCLES(dfu) bo_dfu_sched_idle_cycles(&(dfu)->sched)
+#else
+    #define BO_DFU_SCHED_OPEN(dfu, poll_timeout_ms) do {} while(0)
+    #define BO_DFU_SCHED_RUN(dfu) do {} while(0)
+    #define BO_DFU_SCHED_IDLE_CYCLES(dfu) ((uint32_t)0)
+#endif
+
+#endif /* BO_DFU_SCHED_H */
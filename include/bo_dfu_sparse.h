@@ -0,0 +1,249 @@
+#ifndef BO_DFU_SPARSE_H
+#define BO_DFU_SPARSE_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_attr.h"
+
+#include "bo_dfu_usb.h"
+#include "bo_dfu_ota.h"
+#include "bo_dfu_log.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Streaming decoder for sparse images in the Android sparse image format (v1.0, as produced by img2simg), which must use
+ * the flash sector size (4096) as the block size.
+ * Raw chunks are written as they arrive, regardless of how they straddle DFU blocks. Fill chunks are generated locally, and
+ * are erase-only for 0xFFFFFFFF. Don't care chunks are skipped entirely, leaving existing data in place.
+ * Every sector is erased the first time it's written; the sparse image's own chunks must not overlap.
+*/
+
+#define BO_DFU_SPARSE_MAGIC 0xED26FF3A
+#define BO_DFU_SPARSE_BLOCK_SIZE SPI_SEC_SIZE
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t major_version;
+    uint16_t minor_version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+    uint32_t total_chunks;
+    uint32_t image_checksum;
+} bo_dfu_sparse_header_t;
+_Static_assert(sizeof(bo_dfu_sparse_header_t) == 28, "");
+
+typedef enum {
+    BO_DFU_SPARSE_CHUNK_RAW         = 0xCAC1,
+    BO_DFU_SPARSE_CHUNK_FILL        = 0xCAC2,
+    BO_DFU_SPARSE_CHUNK_DONT_CARE   = 0xCAC3,
+    BO_DFU_SPARSE_CHUNK_CRC32       = 0xCAC4,
+} bo_dfu_sparse_chunk_type_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t chunk_type;
+    uint16_t reserved1;
+    uint32_t chunk_sz;  // In blocks
+    uint32_t total_sz;  // In bytes, including this header
+    uint32_t payload;   // FILL and CRC32 only
+} bo_dfu_sparse_chunk_header_t;
+_Static_assert(sizeof(bo_dfu_sparse_chunk_header_t) == 16, "");
+#define BO_DFU_SPARSE_CHUNK_HEADER_SIZE 12
+
+typedef struct {
+    uint32_t active;            // Set if the current download is a sparse image
+    uint32_t block_len;         // Length of the DFU block in the buffer
+    uint32_t out_offset;        // Output position, relative to the partition
+    uint32_t raw_remaining;     // Bytes remaining in the current raw chunk
+    uint32_t header_done;       // Set once the file header has been parsed
+    uint32_t need;              // Header bytes required before parsing
+    uint32_t carry_len;         // Header bytes collected so far, possibly from a previous block
+    union {
+        uint8_t carry[sizeof(bo_dfu_sparse_header_t)];
+        bo_dfu_sparse_header_t header;
+        bo_dfu_sparse_chunk_header_t chunk;
+    };
+} bo_dfu_sparse_t;
+
+static IRAM_ATTR void bo_dfu_sparse_init(bo_dfu_sparse_t *sparse, const uint8_t *block, size_t len)
+{
+    memset(sparse, 0, sizeof(*sparse));
+    uint32_t magic;
+    if(len >= sizeof(magic))
+    {
+        memcpy(&magic, block, sizeof(magic));
+        sparse->active = (magic == BO_DFU_SPARSE_MAGIC);
+    }
+    sparse->need = sizeof(bo_dfu_sparse_header_t);
+}
+
+static IRAM_ATTR bool bo_dfu_sparse_is_done(const bo_dfu_sparse_t *sparse)
+{
+    return sparse->header_done && sparse->raw_remaining == 0 && sparse->carry_len == 0;
+}
+
+/**
+ * Decodes a DFU block, writing to partition. If partition is NULL, this is a dry run without flash operations, which may be
+ * used to estimate how long the block will take.
+ * sectors_erased (optional) is incremented by the number of sectors erased.
+*/
+static IRAM_ATTR usb_dfu_status_t bo_dfu_sparse_process(bo_dfu_sparse_t *sparse, const esp_partition_pos_t *partition, const uint8_t *data, size_t len, uint32_t *sectors_erased)
+{
+    uint32_t erased = 0;
+    usb_dfu_status_t err = BO_DFU_STATUS_OK;
+    while(len > 0 && err == BO_DFU_STATUS_OK)
+    {
+        if(sparse->raw_remaining > 0)
+        {
+            const size_t n = MIN(len, sparse->raw_remaining);
+            // Erase any sectors that this write begins.
+            const uint32_t erase_start = (sparse->out_offset + (BO_DFU_SPARSE_BLOCK_SIZE - 1)) & ~(BO_DFU_SPARSE_BLOCK_SIZE - 1);
+            const uint32_t erase_end = (sparse->out_offset + n + (BO_DFU_SPARSE_BLOCK_SIZE - 1)) & ~(BO_DFU_SPARSE_BLOCK_SIZE - 1);
+            if(partition)
+            {
+                if(erase_end > erase_start && ESP_OK != bootloader_flash_erase_range(partition->offset + erase_start, erase_end - erase_start))
+                {
+                    err = BO_DFU_STATUS_errERASE;
+                    break;
+                }
+                // Chunks are all multiples of 4 bytes, so this is always aligned.
+                if(ESP_OK != bootloader_flash_write(partition->offset + sparse->out_offset, (void*)data, n, false))
+                {
+                    err = BO_DFU_STATUS_errPROG;
+                    break;
+                }
+            }
+            erased += (erase_end - erase_start) / BO_DFU_SPARSE_BLOCK_SIZE;
+            sparse->out_offset += n;
+            sparse->raw_remaining -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        // Collect a header, which may straddle blocks.
+        const size_t n = MIN(len, sparse->need - sparse->carry_len);
+        memcpy(&sparse->carry[sparse->carry_len], data, n);
+        sparse->carry_len += n;
+        data += n;
+        len -= n;
+        if(sparse->carry_len < sparse->need)
+        {
+            break;
+        }
+
+        if(!sparse->header_done)
+        {
+            if(
+                sparse->header.magic != BO_DFU_SPARSE_MAGIC ||
+                sparse->header.major_version != 1 ||
+                sparse->header.file_hdr_sz != sizeof(bo_dfu_sparse_header_t) ||
+                sparse->header.chunk_hdr_sz != BO_DFU_SPARSE_CHUNK_HEADER_SIZE ||
+                sparse->header.blk_sz != BO_DFU_SPARSE_BLOCK_SIZE
+            )
+            {
+                err = BO_DFU_STATUS_errFILE;
+                break;
+            }
+            sparse->header_done = 1;
+            sparse->carry_len = 0;
+            sparse->need = BO_DFU_SPARSE_CHUNK_HEADER_SIZE;
+            continue;
+        }
+
+        const uint32_t chunk_bytes = sparse->chunk.chunk_sz * BO_DFU_SPARSE_BLOCK_SIZE;
+        if(
+            (chunk_bytes / BO_DFU_SPARSE_BLOCK_SIZE) != sparse->chunk.chunk_sz ||
+            (partition && (sparse->out_offset + chunk_bytes < sparse->out_offset || sparse->out_offset + chunk_bytes > partition->size))
+        )
+        {
+            err = BO_DFU_STATUS_errADDRESS;
+            break;
+        }
+        switch(sparse->chunk.chunk_type)
+        {
+            case BO_DFU_SPARSE_CHUNK_RAW:
+                if(sparse->chunk.total_sz != BO_DFU_SPARSE_CHUNK_HEADER_SIZE + chunk_bytes)
+                {
+                    err = BO_DFU_STATUS_errFILE;
+                    break;
+                }
+                sparse->raw_remaining = chunk_bytes;
+                break;
+            case BO_DFU_SPARSE_CHUNK_FILL:
+            case BO_DFU_SPARSE_CHUNK_CRC32:
+                if(sparse->chunk.total_sz != sizeof(bo_dfu_sparse_chunk_header_t))
+                {
+                    err = BO_DFU_STATUS_errFILE;
+                    break;
+                }
+                if(sparse->need < sizeof(bo_dfu_sparse_chunk_header_t))
+                {
+                    // The 32-bit payload is yet to be collected.
+                    sparse->need = sizeof(bo_dfu_sparse_chunk_header_t);
+                    continue;
+                }
+                if(sparse->chunk.chunk_type == BO_DFU_SPARSE_CHUNK_CRC32)
+                {
+                    // Not checked. The image is verified on manifestation.
+                    break;
+                }
+                if(partition && chunk_bytes > 0)
+                {
+                    if(ESP_OK != bootloader_flash_erase_range(partition->offset + sparse->out_offset, chunk_bytes))
+                    {
+                        err = BO_DFU_STATUS_errERASE;
+                        break;
+                    }
+                    if(sparse->chunk.payload != UINT32_MAX)
+                    {
+                        uint32_t fill[64];
+                        for(size_t i = 0; i < sizeof(fill) / sizeof(fill[0]); ++i)
+                        {
+                            fill[i] = sparse->chunk.payload;
+                        }
+                        for(uint32_t offset = 0; offset < chunk_bytes; offset += sizeof(fill))
+                        {
+                            if(ESP_OK != bootloader_flash_write(partition->offset + sparse->out_offset + offset, fill, sizeof(fill), false))
+                            {
+                                err = BO_DFU_STATUS_errPROG;
+                                break;
+                            }
+                        }
+                    }
+                }
+                erased += sparse->chunk.chunk_sz;
+                sparse->out_offset += chunk_bytes;
+                break;
+            case BO_DFU_SPARSE_CHUNK_DONT_CARE:
+                if(sparse->chunk.total_sz != BO_DFU_SPARSE_CHUNK_HEADER_SIZE)
+                {
+                    err = BO_DFU_STATUS_errFILE;
+                    break;
+                }
+                sparse->out_offset += chunk_bytes;
+                break;
+            default:
+                err = BO_DFU_STATUS_errFILE;
+                break;
+        }
+        sparse->carry_len = 0;
+        sparse->need = BO_DFU_SPARSE_CHUNK_HEADER_SIZE;
+    }
+    if(sectors_erased)
+    {
+        *sectors_erased += erased;
+    }
+    if(err != BO_DFU_STATUS_OK && partition)
+    {
+        BO_DFU_LOGE("[%s] error %u at 0x%X", __func__, err, sparse->out_offset);
+    }
+    return err;
+}
+
+#endif /* BO_DFU_SPARSE_H */
@@ -0,0 +1,60 @@
+#ifndef BO_DFU_STATS_H
+#define BO_DFU_STATS_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <sys/param.h>
+
+#include "esp_attr.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Link and flash statistics, returned to the host as-is by the BO_DFU_VENDOR_BREQUEST_GET_STATS request.
+ * Counters are only ever incremented; nothing here is logged, so keeping them costs a few cycles at most on the bus path.
+*/
+typedef struct __attribute__((packed)) {
+    uint32_t tokens;            // Valid tokens addressed to this device
+    uint32_t crc5_errors;       // Tokens addressed to this device with a bad CRC5
+    uint32_t crc16_errors;      // Data packets with a bad CRC16
+    uint32_t desyncs;           // Receiver lost bit synchronisation and waited for EOP
+    uint32_t bus_resets;
+    uint32_t stalls;            // STALL handshakes sent
+    uint32_t ack_timeouts;      // Sent data answered by anything other than an ACK, or by nothing in time, to be retried
+    uint32_t toggle_resyncs;    // OUT data with an unexpected toggle (ie. a repeat after a lost ACK), ACKed and discarded
+    uint32_t blocks;            // Blocks erased and programmed
+    uint32_t erase_cycles_min;
+    uint32_t erase_cycles_max;
+    uint64_t erase_cycles_total;
+    uint32_t program_cycles_min;
+    uint32_t program_cycles_max;
+    uint64_t program_cycles_total;
+} bo_dfu_stats_t;
+_Static_assert(sizeof(bo_dfu_stats_t) == 68, "");
+
+#ifdef CONFIG_BO_DFU_STATS
+    #define BO_DFU_STATS_INC(dfu, counter) (++(dfu)->stats.counter)
+
+    static IRAM_ATTR void bo_dfu_stats_block(bo_dfu_stats_t *stats, uint32_t erase_cycles, uint32_t program_cycles)
+    {
+        if(stats->blocks == 0 || erase_cycles < stats->erase_cycles_min)
+        {
+            stats->erase_cycles_min = erase_cycles;
+        }
+        if(stats->blocks == 0 || program_cycles < stats->program_cycles_min)
+        {
+            stats->program_cycles_min = program_cycles;
+        }
+        stats->erase_cycles_max = MAX(stats->erase_cycles_max, erase_cycles);
+        stats->program_cycles_max = MAX(stats->program_cycles_max, program_cycles);
+        stats->erase_cycles_total += erase_cycles;
+        stats->program_cycles_total += program_cycles;
+        ++stats->blocks;
+    }
+    #define BO_DFU_STATS_BLOCK(dfu, erase_cycles, program_cycles) bo_dfu_stats_block(&(dfu)->stats, erase_cycles, program_cycles)
+#else
+    #define BO_DFU_STATS_INC(dfu, counter) do {} while(0)
+    #define BO_DFU_STATS_BLOCK(dfu, erase_cycles, program_cycles) do {} while(0)
+#endif
+
+#endif /* BO_DFU_STATS_H */
@@ -28,4 +28,27 @@ static inline IRAM_ATTR uint32_t bo_dfu_ccount(void)
 #endif
 }
 
+#define BO_DFU_MS_TO_CCOUNT64(ms) ((uint64_t)(ms) * BO_DFU_CPU_FREQ_MHZ * 1000)
+#define BO_DFU_US_TO_CCOUNT64(us) ((uint64_t)(us) * BO_DFU_CPU_FREQ_MHZ)
+
+static struct {
+    uint32_t last;
+    uint32_t high;
+} s_bo_dfu_ccount64;
+
+/**
+ * The cycle count extended to 64 bits, so that it won't overflow (the 32 bit count wraps every ~18s at 240MHz).
+ * The wrap is only noticed here, so this must be called at least once per wrap period; once per loop is plenty.
+*/
+static IRAM_ATTR uint64_t bo_dfu_ccount64(void)
+{
+    const uint32_t now = bo_dfu_ccount();
+    if(now < s_bo_dfu_ccount64.last)
+    {
+        ++s_bo_dfu_ccount64.high;
+    }
+    s_bo_dfu_ccount64.last = now;
+    return ((uint64_t)s_bo_dfu_ccount64.high << 32) | now;
+}
+
 #endif /* BO_DFU_TIME_H */
@@ -0,0 +1,100 @@
+#ifndef BO_DFU_TIMER_H
+#define BO_DFU_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_attr.h"
+
+#include "bo_dfu_time.h"
+
+/**
+ * One-shot and periodic deadlines on the 64 bit cycle count, for the work between bo_dfu_fsm calls (LED, timeouts, WDT, etc).
+ * Each timer is identified by an index chosen by the caller. bo_dfu_timers_poll returns the timers which have expired as a
+ * bitmask; while none are due, this is a single comparison against the earliest deadline, however many timers are running.
+*/
+
+#define BO_DFU_TIMERS_MAX 8
+
+typedef struct {
+    uint64_t next;                          // Earliest deadline of any running timer
+    uint64_t deadline[BO_DFU_TIMERS_MAX];
+    uint64_t period[BO_DFU_TIMERS_MAX];     // Zero if one-shot
+    uint32_t running;                       // Bitmask
+} bo_dfu_timers_t;
+
+static IRAM_ATTR void bo_dfu_timers_init(bo_dfu_timers_t *timers)
+{
+    memset(timers, 0, sizeof(*timers));
+    timers->next = UINT64_MAX;
+}
+
+static IRAM_ATTR void bo_dfu_timer_start(bo_dfu_timers_t *timers, uint32_t id, uint64_t cycles, bool periodic)
+{
+    timers->deadline[id] = bo_dfu_ccount64() + cycles;
+    timers->period[id] = periodic ? cycles : 0;
+    timers->running |= (1 << id);
+    timers->next = MIN(timers->next, timers->deadline[id]);
+}
+
+static IRAM_ATTR void bo_dfu_timer_start_ms(bo_dfu_timers_t *timers, uint32_t id, uint32_t ms, bool periodic)
+{
+    bo_dfu_timer_start(timers, id, BO_DFU_MS_TO_CCOUNT64(ms), periodic);
+}
+
+static IRAM_ATTR void bo_dfu_timer_start_us(bo_dfu_timers_t *timers, uint32_t id, uint32_t us, bool periodic)
+{
+    bo_dfu_timer_start(timers, id, BO_DFU_US_TO_CCOUNT64(us), periodic);
+}
+
+static IRAM_ATTR void bo_dfu_timer_stop(bo_dfu_timers_t *timers, uint32_t id)
+{
+    // next is left as is; an early poll just finds nothing due.
+    timers->running &= ~(1 << id);
+}
+
+static IRAM_ATTR bool bo_dfu_timer_is_running(const bo_dfu_timers_t *timers, uint32_t id)
+{
+    return (timers->running & (1 << id)) != 0;
+}
+
+// Returns a bitmask of the timers which have expired since the last poll. Periodic timers are restarted, others stopped.
+static IRAM_ATTR uint32_t bo_dfu_timers_poll(bo_dfu_timers_t *timers)
+{
+    const uint64_t now = bo_dfu_ccount64();
+    if(now < timers->next)
+    {
+        return 0;
+    }
+    uint32_t expired = 0;
+    uint64_t next = UINT64_MAX;
+    for(uint32_t id = 0; id < BO_DFU_TIMERS_MAX; ++id)
+    {
+        if(!bo_dfu_timer_is_running(timers, id))
+        {
+            continue;
+        }
+        if(timers->deadline[id] <= now)
+        {
+            expired |= (1 << id);
+            if(timers->period[id] == 0)
+            {
+                timers->running &= ~(1 << id);
+                continue;
+            }
+            // Keeps the phase, unless so late that a whole period has been missed.
+            timers->deadline[id] += timers->period[id];
+            if(timers->deadline[id] <= now)
+            {
+                timers->deadline[id] = now + timers->period[id];
+            }
+        }
+        next = MIN(next, timers->deadline[id]);
+    }
+    timers->next = next;
+    return expired;
+}
+
+#endif /* BO_DFU_TIMER_H */
@@ -0,0 +1,129 @@
+#ifndef BO_DFU_TRACE_H
+#define BO_DFU_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "bo_dfu_clk.h"
+#include "bo_dfu_rtc.h"
+#include "bo_dfu_trace_types.h"
+#include "bo_dfu_time.h"
+
+#include "sdkconfig.h"
+
+/**
+ * Post-mortem event trace. Events are written to a ring buffer in RAM, which is copied to retained RTC memory when committed, so that
+ * the last CONFIG_BO_DFU_TRACE_EVENTS events of the session survive the reset into the app, where they can be read with bo_dfu_rtc_get_trace().
+ * Each event is two 32-bit stores and an index update, so this is cheap enough to record every received packet.
+ * The trace is committed after any event other than a packet, so that it also survives a reset before bo_dfu_trace_end (eg. by the WDT).
+ * The retained memory's CRC covers all of it, far longer than may be spent between transactions, so it's only committed while the host
+ * has been told to wait: at the end of a bo_dfu_fsm call in which a GETSTATUS completed with a poll timeout leaving room for it
+ * (see bo_dfu_trace_window). Otherwise, it waits for the next such GETSTATUS. Recording to RAM keeps the retained copy, and its CRC,
+ * valid in between.
+*/
+
+#ifdef CONFIG_BO_DFU_TRACE
+
+    #ifndef CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+        #error "CONFIG_BO_DFU_TRACE requires CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC"
+    #endif
+
+    // Cycles per byte for the copy to RTC memory and for the CRC32 over the retained memory, with margin.
+    #define BO_DFU_TRACE_COPY_CYCLES_PER_BYTE 8
+    #define BO_DFU_TRACE_CRC_CYCLES_PER_BYTE 16
+    #define BO_DFU_TRACE_COMMIT_CYCLES \
+        (sizeof(bo_dfu_trace_t) * BO_DFU_TRACE_COPY_CYCLES_PER_BYTE + sizeof(rtc_retain_mem_t) * BO_DFU_TRACE_CRC_CYCLES_PER_BYTE)
+    // Margin before the host may poll again, for the time taken to return to the bus.
+    #define BO_DFU_TRACE_GUARD_MS 1
+    // Longest window, so that it can be timed with the 32 bit cycle counter.
+    #define BO_DFU_TRACE_WINDOW_MAX_MS 10000
+    // So that a commit fits in any window of a poll timeout of a few ms.
+    _Static_assert(BO_DFU_TRACE_COMMIT_CYCLES <= BO_DFU_MS_TO_CCOUNT(1), "retained memory too large to commit within a poll timeout");
+
+    static bo_dfu_trace_t s_bo_dfu_trace;
+    // Set by any event but a packet until the next commit.
+    static bool s_bo_dfu_trace_pending;
+    static uint32_t s_bo_dfu_trace_window_start;
+    // Zero if the host hasn't been told to wait since the last bo_dfu_trace_flush.
+    static uint32_t s_bo_dfu_trace_window_cycles;
+
+    static IRAM_ATTR void bo_dfu_trace(bo_dfu_trace_event_type_t type, uint8_t arg8, uint16_t arg16)
+    {
+        bo_dfu_trace_t *trace = &s_bo_dfu_trace;
+        uint32_t head = trace->head;
+        uint32_t *event = (uint32_t*)&trace->events[head];
+        event[0] = bo_dfu_ccount();
+        event[1] = ((uint32_t)type << 0) | ((uint32_t)arg8 << 8) | ((uint32_t)arg16 << 16);
+        trace->head = (head + 1 < CONFIG_BO_DFU_TRACE_EVENTS) ? (head + 1) : 0;
+        if(trace->count < CONFIG_BO_DFU_TRACE_EVENTS)
+        {
+            ++trace->count;
+        }
+        s_bo_dfu_trace_pending |= (type != BO_DFU_TRACE_EVENT_PACKET);
+    }
+
+    static IRAM_ATTR void bo_dfu_trace_start(void)
+    {
+        bo_dfu_rtc_init();
+        s_bo_dfu_trace.magic = BO_DFU_TRACE_MAGIC;
+        s_bo_dfu_trace.head = 0;
+        s_bo_dfu_trace.count = 0;
+        bo_dfu_trace(BO_DFU_TRACE_EVENT_START, 0, 0);
+    }
+
+    static IRAM_ATTR void bo_dfu_trace_commit(void)
+    {
+        s_bo_dfu_trace_pending = false;
+        memcpy(&bo_dfu_rtc_get()->trace, &s_bo_dfu_trace, sizeof(s_bo_dfu_trace));
+        // Without a valid CRC, the retained memory would be cleared on the next boot.
+        bo_dfu_rtc_commit();
+    }
+
+    // Called upon completing a GETSTATUS whose response reported poll_timeout_ms.
+    static IRAM_ATTR void bo_dfu_trace_window(uint32_t poll_timeout_ms)
+    {
+        poll_timeout_ms = MIN(poll_timeout_ms, BO_DFU_TRACE_WINDOW_MAX_MS);
+        s_bo_dfu_trace_window_start = bo_dfu_ccount();
+        s_bo_dfu_trace_window_cycles = (poll_timeout_ms > BO_DFU_TRACE_GUARD_MS) ? BO_DFU_MS_TO_CCOUNT(poll_timeout_ms - BO_DFU_TRACE_GUARD_MS) : 0;
+    }
+
+    // Called at the end of every bo_dfu_fsm. Commits only if a window opened in this call has room left for it.
+    static IRAM_ATTR void bo_dfu_trace_flush(void)
+    {
+        if(s_bo_dfu_trace_window_cycles == 0)
+        {
+            return;
+        }
+        const uint32_t elapsed = bo_dfu_ccount() - s_bo_dfu_trace_window_start;
+        const bool fits = (elapsed < s_bo_dfu_trace_window_cycles) && (s_bo_dfu_trace_window_cycles - elapsed >= BO_DFU_TRACE_COMMIT_CYCLES);
+        s_bo_dfu_trace_window_cycles = 0;
+        if(s_bo_dfu_trace_pending && fits)
+        {
+            bo_dfu_trace_commit();
+        }
+    }
+
+    // Called from bo_dfu_deinit, once detached from the bus, so the trace is committed regardless of any window.
+    static IRAM_ATTR void bo_dfu_trace_end(bool complete)
+    {
+        bo_dfu_trace(BO_DFU_TRACE_EVENT_END, complete, 0);
+        s_bo_dfu_trace_window_cycles = 0;
+        bo_dfu_trace_commit();
+    }
+
+    #define BO_DFU_TRACE(type, arg8, arg16) bo_dfu_trace(BO_DFU_TRACE_EVENT_ ## type, (arg8), (arg16))
+
+#else
+
+    FORCE_INLINE_ATTR void bo_dfu_trace_start(void) {}
+    FORCE_INLINE_ATTR void bo_dfu_trace_window(uint32_t poll_timeout_ms) {}
+    FORCE_INLINE_ATTR void bo_dfu_trace_flush(void) {}
+    FORCE_INLINE_ATTR void bo_dfu_trace_end(bool complete) {}
+    #define BO_DFU_TRACE(type, arg8, arg16) do {} while(0)
+
+#endif
+
+#endif /* BO_DFU_TRACE_H */
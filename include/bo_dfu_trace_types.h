@@ -0,0 +1,46 @@
+#ifndef BO_DFU_TRACE_TYPES_H
+#define BO_DFU_TRACE_TYPES_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#define BO_DFU_TRACE_MAGIC 0x54444F42 // "BODT"
+
+typedef enum {
+    BO_DFU_TRACE_EVENT_START = 0,   // DFU mode started.
+    BO_DFU_TRACE_EVENT_PACKET,      // Packet received. arg8: PID, arg16: length (including sync and PID)
+    BO_DFU_TRACE_EVENT_BUS,         // Bus error. arg8: bo_dfu_bus_state_t
+    BO_DFU_TRACE_EVENT_STATE,       // DFU state set. arg8: bo_dfu_fsm_t, arg16: usb_dfu_status_t
+    BO_DFU_TRACE_EVENT_BLOCK,       // Block processed. arg8: usb_dfu_status_t, arg16: block number
+    BO_DFU_TRACE_EVENT_END,         // DFU mode ended. arg8: completed
+} bo_dfu_trace_event_type_t;
+
+typedef struct {
+    uint32_t ccount;    // CPU cycle count at 240MHz. Wraps every ~18s.
+    uint8_t type;       // bo_dfu_trace_event_type_t
+    uint8_t arg8;
+    uint16_t arg16;
+} bo_dfu_trace_event_t;
+_Static_assert(sizeof(bo_dfu_trace_event_t) == 8, "");
+
+typedef struct {
+    uint32_t magic;
+    uint16_t head;      // Index of the next event to be written
+    uint16_t count;     // Number of valid events, up to CONFIG_BO_DFU_TRACE_EVENTS
+    #ifdef CONFIG_BO_DFU_TRACE
+    bo_dfu_trace_event_t events[CONFIG_BO_DFU_TRACE_EVENTS];
+    #endif
+} bo_dfu_trace_t;
+
+#ifdef CONFIG_BO_DFU_TRACE
+// Returns the i'th oldest event, where i < trace->count.
+static inline const bo_dfu_trace_event_t *bo_dfu_trace_event_get(const bo_dfu_trace_t *trace, uint32_t i)
+{
+    uint32_t oldest = (trace->head + CONFIG_BO_DFU_TRACE_EVENTS - trace->count) % CONFIG_BO_DFU_TRACE_EVENTS;
+    return &trace->events[(oldest + i) % CONFIG_BO_DFU_TRACE_EVENTS];
+}
+#endif
+
+#endif /* BO_DFU_TRACE_TYPES_H */
@@ -13,9 +13,16 @@
 #include "bo_dfu_usb.h"
 #include "bo_dfu_util.h"
 #include "bo_dfu_descriptor.h"
+#include "bo_dfu_alt.h"
 #include "bo_dfu_time.h"
 
-static IRAM_ATTR bool bo_dfu_usb_transaction_check_token(uint16_t address, const bo_dfu_usb_rx_packet_t *packet, size_t len)
+static IRAM_ATTR void bo_dfu_usb_transaction_stall(bo_dfu_t *dfu)
+{
+    BO_DFU_STATS_INC(dfu, stalls);
+    bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+}
+
+static IRAM_ATTR bool bo_dfu_usb_transaction_check_token(bo_dfu_t *dfu, const bo_dfu_usb_rx_packet_t *packet, size_t len)
 {
     if(len != (sizeof(packet->sync_and_pid_with_check) + sizeof(packet->token)))
     {
@@ -25,7 +32,7 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_check_token(uint16_t address, const
     {
         return false;
     }
-    if(packet->address != address)
+    if(packet->address != dfu->address)
     {
         return false;
     }
@@ -37,6 +44,7 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_check_token(uint16_t address, const
         {
             if(bo_dfu_crc_token(packet->token) != packet->crc)
             {
+                BO_DFU_STATS_INC(dfu, crc5_errors);
                 return false;
             }
             break;
@@ -46,19 +54,21 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_check_token(uint16_t address, const
             return false;
         }
     }
+    BO_DFU_STATS_INC(dfu, tokens);
     return true;
 }
 
 static IRAM_ATTR bool bo_dfu_usb_transaction_check_ack(const bo_dfu_usb_rx_packet_t *packet, size_t len)
 {
     return (
+        !BO_DFU_FAULT(lost_ack) &&
         len == sizeof(packet->sync_and_pid_with_check) &&
         packet->sync == BO_DFU_USB_SYNC_BYTE &&
         packet->pid_with_check == BO_DFU_USB_PID_CHECK_ACK
     );
 }
 
-static IRAM_ATTR bool bo_dfu_usb_transaction_check_data(const bo_dfu_usb_rx_packet_t *packet, size_t len)
+static IRAM_ATTR bool bo_dfu_usb_transaction_check_data(bo_dfu_t *dfu, const bo_dfu_usb_rx_packet_t *packet, size_t len)
 {
     if(len < (sizeof(uint8_t) + sizeof(uint8_t) /* + data */ + sizeof(uint16_t)))
     {
@@ -73,11 +83,19 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_check_data(const bo_dfu_usb_rx_pack
         case BO_DFU_USB_PID_CHECK_DATA0:
         case BO_DFU_USB_PID_CHECK_DATA1:
         {
-            return (
-                len >= ((sizeof(uint8_t) + sizeof(uint8_t) /* no data */ + 0 + sizeof(uint16_t))) &&
-                len <=((sizeof(uint8_t) + sizeof(uint8_t) /* max data */ + BO_DFU_USB_LOW_SPEED_PACKET_SIZE + sizeof(uint16_t))) &&
-                bo_dfu_crc_data(packet->data, (len - ((sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint16_t))))) == *(uint16_t*)(&packet->data[(len - ((sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint16_t))))])
-            );
+            if(len > (sizeof(uint8_t) + sizeof(uint8_t) /* max data */ + BO_DFU_USB_LOW_SPEED_PACKET_SIZE + sizeof(uint16_t)))
+            {
+                return false;
+            }
+            const size_t data_len = len - (sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint16_t));
+            // The CRC follows the data so is only halfword-aligned if data_len is even. Assemble it bytewise to avoid an unaligned load.
+            const uint32_t crc = packet->data[data_len] | (packet->data[data_len + 1] << 8);
+            if(bo_dfu_crc_data(packet->data, data_len) != crc)
+            {
+                BO_DFU_STATS_INC(dfu, crc16_errors);
+                return false;
+            }
+            return true;
         }
         default:
             break;
@@ -103,7 +121,7 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup_check(bo_dfu_t *dfu, const bo
             else if(packet->setup_data.get_descriptor.type == BO_DFU_USB_DESCRIPTOR_TYPE_CONFIGURATION && packet->setup_data.wIndex == 0 && packet->setup_data.get_descriptor.index == 0)
             {
                 *data_to_send = &g_usb_descriptor_configuration;
-                *data_len = sizeof(g_usb_descriptor_configuration);
+                *data_len = g_usb_descriptor_configuration.configuration.wTotalLength;
                 return true;
             }
             else if(packet->setup_data.get_descriptor.type == BO_DFU_USB_DESCRIPTOR_TYPE_STRING)
@@ -138,6 +156,26 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup_check(bo_dfu_t *dfu, const bo
                     *data_len = sizeof(g_usb_descriptor_string_interface);
                     return true;
                 }
+                #ifdef CONFIG_BO_DFU_SKIP_INSTALLED
+                else if(packet->setup_data.get_descriptor.index == BO_DFU_DESCRIPTOR_STRING_INDEX_INSTALLED)
+                {
+                    *data_to_send = &g_usb_descriptor_string_installed;
+                    *data_len = sizeof(g_usb_descriptor_string_installed);
+                    return true;
+                }
+                #endif
+                #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+                else if(
+                    packet->setup_data.get_descriptor.index >= BO_DFU_DESCRIPTOR_STRING_INDEX_ALT_FIRST &&
+                    packet->setup_data.get_descriptor.index < BO_DFU_DESCRIPTOR_STRING_INDEX_ALT_FIRST + s_bo_dfu_alt.count
+                )
+                {
+                    const bo_dfu_alt_string_descriptor_t *string = &s_bo_dfu_alt.strings[packet->setup_data.get_descriptor.index - BO_DFU_DESCRIPTOR_STRING_INDEX_ALT_FIRST];
+                    *data_to_send = string;
+                    *data_len = string->bLength;
+                    return true;
+                }
+                #endif
             }
             break;
         }
@@ -202,8 +240,13 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup_check(bo_dfu_t *dfu, const bo
                 WINDEX_AND_WLENGTH_CHECK(==, 0, sizeof(uint8_t))
             )
             {
+                #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+                *data_to_send = &dfu->alt_setting;
+                *data_len = sizeof(dfu->alt_setting);
+                #else
                 *data_to_send = &dfu->get_interface_response_buffer;
                 *data_len = sizeof(dfu->get_interface_response_buffer);
+                #endif
                 return true;
             }
             break;
@@ -212,7 +255,12 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup_check(bo_dfu_t *dfu, const bo
         {
             if(
                 BO_DFU_IS_CONFIGURED(dfu) &&
+                #ifdef CONFIG_BO_DFU_ALT_SETTINGS
+                // Takes effect from the next download; one in progress continues to its original target.
+                packet->setup_data.wValue <= s_bo_dfu_alt.count &&
+                #else
                 packet->setup_data.wIndex == 0 &&
+                #endif
                 WINDEX_AND_WLENGTH_CHECK(==, 0, 0)
             )
             {
@@ -251,7 +299,36 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup_check(bo_dfu_t *dfu, const bo
                      * The exception is the final data block (in all cases where the firmware size is not a perfect multiple of 0x1000).
                      * This, too, is processed by erasing and writing a full sector; the buffer is cleared (with 0xFF) to set unused bytes
                      * beforehand.
+                     *
+                     * With CONFIG_BO_DFU_ANY_BLOCK_SIZE, smaller blocks are instead accumulated in the buffer until it holds a full sector,
+                     * so any block size that divides 0x1000 is accepted. A block which would straddle sectors is rejected.
                     */
+                    #ifdef CONFIG_BO_DFU_BLOCK_CRC
+                        // wIndex carries the block's CRC, checked once received.
+                        #define DNLOAD_WLENGTH_CHECK(comparison, len) (packet->setup_data.wLength comparison (len))
+                    #else
+                        #define DNLOAD_WLENGTH_CHECK(comparison, len) WINDEX_AND_WLENGTH_CHECK(comparison, 0, len)
+                    #endif
+                    #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                    if(
+                        BO_DFU_IS_CONFIGURED(dfu) &&
+                        (
+                            (
+                                // If IDLE and this is the first block (wValue == 0)
+                                BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE) &&
+                                packet->setup_data.wValue == 0 &&
+                                packet->setup_data.wLength > 0 &&
+                                DNLOAD_WLENGTH_CHECK(<=, sizeof(dfu->dfu.buffer))
+                            ) ||
+                            (
+                                // Or if DNLOAD_IDLE and this is the next block, fitting in the remainder of the sector, or null
+                                BO_DFU_T_CAN_CONTINUE(dfu) &&
+                                packet->setup_data.wValue == dfu->dfu.host_block &&
+                                DNLOAD_WLENGTH_CHECK(<=, sizeof(dfu->dfu.buffer) - dfu->dfu.fill)
+                            )
+                        )
+                    )
+                    #else
                     if(
                         BO_DFU_IS_CONFIGURED(dfu) &&
                         (
@@ -259,32 +336,34 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup_check(bo_dfu_t *dfu, const bo
                                 // If IDLE and this is the first packet (wValue == 0)
                                 BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE) &&
                                 packet->setup_data.wValue == 0 &&
-                                WINDEX_AND_WLENGTH_CHECK(==, 0, sizeof(dfu->dfu.buffer))
+                                DNLOAD_WLENGTH_CHECK(==, sizeof(dfu->dfu.buffer))
                             ) ||
                             (
                                 // Or if DNLOAD_IDLE and...
-                                BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(DNLOAD_IDLE) && (
+                                BO_DFU_T_CAN_CONTINUE(dfu) && (
                                     (
                                         // This is the next packet (wValue == block_num), more data or null
                                         dfu->dfu.block_num_final == 0 &&
                                         packet->setup_data.wValue == dfu->dfu.block_num &&
-                                        WINDEX_AND_WLENGTH_CHECK(<=, 0, sizeof(dfu->dfu.buffer))
+                                        DNLOAD_WLENGTH_CHECK(<=, sizeof(dfu->dfu.buffer))
                                     ) ||
                                     (
                                         // Or previous packet was < MaxPacketSize (ie. last data packet) and this is the null packet
                                         dfu->dfu.block_num_final == 1 &&
                                         packet->setup_data.wValue == dfu->dfu.block_num_counter &&
-                                        WINDEX_AND_WLENGTH_CHECK(==, 0, 0)
+                                        DNLOAD_WLENGTH_CHECK(==, 0)
                                     )
                                 )
                              )
                         )
                     )
+                    #endif
                     {
                         *data_len = packet->setup_data.wLength;
                         return true;
                     }
-                    ESP_LOGW(BO_DFU_TAG, "[%s] invalid dnload (%u %u %u %u %u)", __func__, BO_DFU_T_GET_STATE(dfu), packet->setup_data.wValue, dfu->dfu.block_num, packet->setup_data.wIndex, packet->setup_data.wLength);
+                    #undef DNLOAD_WLENGTH_CHECK
+                    BO_DFU_LOGW("[%s] invalid dnload (%u %u %u %u %u)", __func__, BO_DFU_T_GET_STATE(dfu), packet->setup_data.wValue, dfu->dfu.block_num, packet->setup_data.wIndex, packet->setup_data.wLength);
                     break;
                 }
                 default:
@@ -352,6 +431,76 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup_check(bo_dfu_t *dfu, const bo
             }
             break;
         }
+        #ifdef CONFIG_BO_DFU_STATS
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_VENDOR_BREQUEST_GET_STATS, 0b11000001):
+        {
+            if(
+                BO_DFU_IS_CONFIGURED(dfu) &&
+                packet->setup_data.wValue == 0 &&
+                packet->setup_data.wIndex == 0
+            )
+            {
+                *data_to_send = &dfu->stats;
+                *data_len = sizeof(dfu->stats);
+                return true;
+            }
+            break;
+        }
+        #endif
+        #ifdef CONFIG_BO_DFU_SECTOR_FINGERPRINTS
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_VENDOR_BREQUEST_HASH, 0b01000000):
+        {
+            // The result overwrites the block buffer, which is only free between blocks.
+            if(
+                BO_DFU_IS_CONFIGURED(dfu) &&
+                (BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE) || BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(DNLOAD_IDLE)) &&
+                #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                // Nor while the buffer holds part of a sector.
+                (BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE) || dfu->dfu.fill == 0) &&
+                #endif
+                WINDEX_AND_WLENGTH_CHECK(<=, BO_DFU_VENDOR_SLOT_ACTIVE, 0)
+            )
+            {
+                return true;
+            }
+            break;
+        }
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_VENDOR_BREQUEST_GET_HASHES, 0b11000000):
+        {
+            if(
+                BO_DFU_IS_CONFIGURED(dfu) &&
+                (BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(IDLE) || BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(DNLOAD_IDLE)) &&
+                packet->setup_data.wValue == 0 &&
+                packet->setup_data.wIndex == 0
+            )
+            {
+                *data_to_send = dfu->dfu.buffer;
+                *data_len = BO_DFU_FINGERPRINT_SECTORS * sizeof(uint32_t);
+                return true;
+            }
+            break;
+        }
+        case BREQUEST_AND_BMREQUESTTYPE(BO_DFU_VENDOR_BREQUEST_COPY_SECTOR, 0b01000000):
+        {
+            // As with DNLOAD, but the first block must always be downloaded for its header.
+            if(
+                BO_DFU_IS_CONFIGURED(dfu) &&
+                BO_DFU_T_GET_STATE(dfu) == BO_DFU_FSM(DNLOAD_IDLE) &&
+                #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                dfu->dfu.fill == 0 &&
+                packet->setup_data.wValue == dfu->dfu.host_block &&
+                #else
+                dfu->dfu.block_num_final == 0 &&
+                packet->setup_data.wValue == dfu->dfu.block_num &&
+                #endif
+                WINDEX_AND_WLENGTH_CHECK(<=, BO_DFU_VENDOR_SLOT_ACTIVE, 0)
+            )
+            {
+                return true;
+            }
+            break;
+        }
+        #endif
     }
     #undef WINDEX_AND_WLENGTH
     #undef WINDEX_AND_WLENGTH_CHECK
@@ -369,13 +518,14 @@ static IRAM_ATTR bool bo_dfu_usb_transaction_setup(bo_dfu_t *dfu, const bo_dfu_u
     }
     transfer->bmRequestType_and_bRequest = packet->setup_data.bmRequestType_and_bRequest;
     transfer->wValue = packet->setup_data.wValue;
+    transfer->wIndex = packet->setup_data.wIndex;
     transfer->data = data_ptr;
     transfer->len = MIN(data_len, packet->setup_data.wLength);
     transfer->counter = 0;
     _Static_assert(
         sizeof(*transfer) == (
             sizeof(transfer->bmRequestType_and_bRequest) +
-            sizeof(transfer->wValue) + sizeof(transfer->data) +
+            sizeof(transfer->wValue) + sizeof(transfer->wIndex) + sizeof(transfer->data) +
             sizeof(transfer->len) +
             sizeof(transfer->counter)
         ), ""
@@ -396,23 +546,30 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
     uint32_t bit_time = bo_dfu_ccount();
     do {
         bo_dfu_usb_rx_packet_t packet;
-        int bytes_received = bo_dfu_usb_rx_next_packet(&bit_time, &packet);
+        // Only a token for this device is of interest outside of a transaction, so anything else can be rejected early.
+        int bytes_received = bo_dfu_usb_rx_next_packet(&bit_time, &packet, (transaction_state == TRANSACTION_STATE_NONE) ? dfu->address : BO_DFU_USB_RX_ANY_PACKET);
         if(bytes_received < 0)
         {
+            if(transaction_state == TRANSACTION_STATE_WAITING_ACK)
+            {
+                // No handshake in time (or nothing recognisable), so the host will retry.
+                BO_DFU_STATS_INC(dfu, ack_timeouts);
+            }
             return bytes_received;
         }
+        BO_DFU_TRACE(PACKET, packet.pid_with_check, bytes_received);
 
         switch(transaction_state)
         {
             case TRANSACTION_STATE_NONE:
             {
-                if(!bo_dfu_usb_transaction_check_token(dfu->address, &packet, bytes_received))
+                if(!bo_dfu_usb_transaction_check_token(dfu, &packet, bytes_received))
                 {
                     return BO_DFU_BUS_SYNCED;
                 }
                 if(packet.endpoint != 0)
                 {
-                    bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+                    bo_dfu_usb_transaction_stall(dfu);
                     return BO_DFU_BUS_SYNCED;
                 }
                 // PID is confirmed to be IN/OUT/SETUP in bo_dfu_usb_transaction_check_token.
@@ -428,18 +585,20 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
                 {
                     // Transaction is inactive (waiting for SETUP)
                     bo_dfu_update_state(dfu, ERROR, BO_DFU_STATUS_errSTALLEDPKT);
-                    bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+                    bo_dfu_usb_transaction_stall(dfu);
                     return BO_DFU_BUS_SYNCED;
                 }
                 if(dfu->transfer.direction_is_device_to_host)
                 {
-                    size_t to_send = dfu->transfer.len - (dfu->transfer.counter * BO_DFU_USB_LOW_SPEED_PACKET_SIZE);
-                    if(to_send > BO_DFU_USB_LOW_SPEED_PACKET_SIZE)
+                    // The host may keep issuing IN tokens after all data has been sent. Answer these with a null data packet rather than reading past the end.
+                    const size_t already_sent = dfu->transfer.counter * BO_DFU_USB_LOW_SPEED_PACKET_SIZE;
+                    size_t to_send = 0;
+                    if(already_sent < dfu->transfer.len)
                     {
-                        to_send = BO_DFU_USB_LOW_SPEED_PACKET_SIZE;
+                        to_send = MIN(dfu->transfer.len - already_sent, BO_DFU_USB_LOW_SPEED_PACKET_SIZE);
                     }
                     const typeof(packet.pid_with_check) next_pid = ((dfu->transfer.counter % 2 == 0) ? BO_DFU_USB_PID_CHECK_DATA1 : BO_DFU_USB_PID_CHECK_DATA0);
-                    bit_time = bo_dfu_usb_tx_data(next_pid, &dfu->transfer.data[dfu->transfer.counter * BO_DFU_USB_LOW_SPEED_PACKET_SIZE], to_send);
+                    bit_time = bo_dfu_usb_tx_data(next_pid, &dfu->transfer.data[MIN(already_sent, dfu->transfer.len)], to_send);
                     transaction_state = TRANSACTION_STATE_WAITING_ACK;
                     continue;
                 }
@@ -452,13 +611,14 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
                 }
                 memset(&dfu->transfer, 0, sizeof(dfu->transfer));
                 bo_dfu_update_state(dfu, ERROR, BO_DFU_STATUS_errSTALLEDPKT);
-                bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+                bo_dfu_usb_transaction_stall(dfu);
                 return BO_DFU_BUS_SYNCED;
             }
             case TRANSACTION_STATE_WAITING_ACK:
             {
                 if(!bo_dfu_usb_transaction_check_ack(&packet, bytes_received))
                 {
+                    BO_DFU_STATS_INC(dfu, ack_timeouts);
                     return BO_DFU_BUS_SYNCED;
                 }
                 if(!dfu->transfer.direction_is_device_to_host)
@@ -472,7 +632,12 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
             }
             case TRANSACTION_STATE_SETUP_WAITING_DATA:
             {
-                if(!bo_dfu_usb_transaction_check_data(&packet, bytes_received))
+                // SETUP data is always DATA0 with exactly 8 bytes; anything shorter would leave stale bytes in setup_data.
+                if(
+                    bytes_received != (sizeof(packet.sync_and_pid_with_check) + sizeof(packet.setup_data) + sizeof(uint16_t)) ||
+                    packet.pid_with_check != BO_DFU_USB_PID_CHECK_DATA0 ||
+                    !bo_dfu_usb_transaction_check_data(dfu, &packet, bytes_received)
+                )
                 {
                     return BO_DFU_BUS_SYNCED;
                 }
@@ -485,14 +650,14 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
                 {
                     memset(&dfu->transfer, 0, sizeof(dfu->transfer));
                     bo_dfu_update_state(dfu, ERROR, BO_DFU_STATUS_errSTALLEDPKT);
-                    bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+                    bo_dfu_usb_transaction_stall(dfu);
                     return BO_DFU_BUS_SYNCED;
                 }
                 break;
             }
             case TRANSACTION_STATE_OUT_WAITING_DATA:
             {
-                if(!bo_dfu_usb_transaction_check_data(&packet, bytes_received))
+                if(!bo_dfu_usb_transaction_check_data(dfu, &packet, bytes_received))
                 {
                     return BO_DFU_BUS_SYNCED;
                 }
@@ -501,7 +666,7 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
                 {
                     // Transaction is inactive (waiting for SETUP)
                     bo_dfu_update_state(dfu, ERROR, BO_DFU_STATUS_errSTALLEDPKT);
-                    bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+                    bo_dfu_usb_transaction_stall(dfu);
                     return BO_DFU_BUS_SYNCED;
                 }
                 if(dfu->transfer.direction_is_device_to_host) // IN transaction. Check this is status stage.
@@ -531,7 +696,7 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
                         // STALL - expecting to have to send more data / invalid PID
                         memset(&dfu->transfer, 0, sizeof(dfu->transfer));
                         bo_dfu_update_state(dfu, ERROR, BO_DFU_STATUS_errSTALLEDPKT);
-                        bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+                        bo_dfu_usb_transaction_stall(dfu);
                         return BO_DFU_BUS_SYNCED;
                     }
                     break;
@@ -548,21 +713,37 @@ static IRAM_ATTR bo_dfu_bus_state_t bo_dfu_usb_transaction_next(bo_dfu_t *dfu)
                              * The only accepted OUT data stage in this application is for DFU DNLOAD requests.
                              * ESP32 binaries are always padded to 16 byte boundaries, so each data packet must always have either
                              * the USB Low Speed maximum (8) or 0 (for the last packet to indicate the end of the block) bytes.
+                             * With CONFIG_BO_DFU_ANY_BLOCK_SIZE, the last packet of a block may also be short.
                             */
                             !(
                                 data_in_this_packet == 8 ||
                                 (dfu->transfer.len == 0 && data_in_this_packet == 0)
+                                #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                                || (data_in_this_packet > 0 && data_already_received + data_in_this_packet == dfu->transfer.len)
+                                #endif
                             ) ||
                             data_already_received + data_in_this_packet > dfu->transfer.len
                         )
                         {
+                            // The request must also be dropped, else a following status stage would complete it from the error state.
+                            memset(&dfu->transfer, 0, sizeof(dfu->transfer));
                             bo_dfu_update_state(dfu, ERROR, BO_DFU_STATUS_errSTALLEDPKT);
-                            bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_STALL);
+                            bo_dfu_usb_transaction_stall(dfu);
                             return BO_DFU_BUS_SYNCED;
                         }
-                        memcpy(&dfu->dfu.buffer[data_already_received], packet.data, data_in_this_packet);
+                        #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+                            // Following any blocks already received for this sector, unless this is the first block of a new download.
+                            const size_t fill = BO_DFU_T_IS_NEW_DOWNLOAD(dfu, dfu->transfer.wValue) ? 0 : dfu->dfu.fill;
+                            memcpy(&dfu->dfu.buffer[fill + data_already_received], packet.data, data_in_this_packet);
+                        #else
+                            memcpy(&dfu->dfu.buffer[data_already_received], packet.data, data_in_this_packet);
+                        #endif
                         ++dfu->transfer.counter;
                     }
+                    else
+                    {
+                        BO_DFU_STATS_INC(dfu, toggle_resyncs);
+                    }
                     // ACK (note: ack is sent even if PID is incorrect in order to resynchronise Data stage)
                     bo_dfu_usb_tx_handshake(BO_DFU_USB_PID_CHECK_ACK);
                     return BO_DFU_BUS_SYNCED;
@@ -8,6 +8,7 @@
 
 #include "bo_dfu_gpio.h"
 #include "bo_dfu_time.h"
+#include "bo_dfu_fault.h"
 
 #define BO_DFU_USB_RAW_TO_TX(bus) ((bus) >> BO_DFU_GPIO_SHIFT)
 #define BO_DFU_USB_TX_TO_RAW(bus) ((bus) << BO_DFU_GPIO_SHIFT)
@@ -171,6 +172,10 @@ FORCE_INLINE_ATTR IRAM_ATTR bool bo_dfu_usb_tx_data_with_checks(const uint8_t pi
 
 FORCE_INLINE_ATTR IRAM_ATTR void bo_dfu_usb_tx_handshake(uint8_t pid_with_check)
 {
+    if(pid_with_check == BO_DFU_USB_PID_CHECK_ACK && BO_DFU_FAULT(drop_ack))
+    {
+        return;
+    }
     bo_dfu_usb_tx_data_with_checks(pid_with_check, NULL, 0);
 }
 
@@ -31,6 +31,22 @@ typedef enum {
     BO_DFU_BREQUEST_ABORT = 6,
 } bo_dfu_brequest_t;
 
+// Vendor-specific requests. GET_STATS is addressed to the DFU interface; the others to the device, with wIndex as a parameter.
+typedef enum {
+    BO_DFU_VENDOR_BREQUEST_GET_STATS = 1,
+    BO_DFU_VENDOR_BREQUEST_HASH = 2,            // OUT. Hash BO_DFU_FINGERPRINT_SECTORS sectors from wValue of slot wIndex (bo_dfu_vendor_slot_t)
+    BO_DFU_VENDOR_BREQUEST_GET_HASHES = 3,      // IN. Read the result of BO_DFU_VENDOR_BREQUEST_HASH
+    BO_DFU_VENDOR_BREQUEST_COPY_SECTOR = 4,     // OUT. Instead of DNLOAD block wValue, take the sector from slot wIndex (bo_dfu_vendor_slot_t)
+} bo_dfu_vendor_brequest_t;
+
+// Number of sectors hashed by each BO_DFU_VENDOR_BREQUEST_HASH, and so the number of CRC32s returned by BO_DFU_VENDOR_BREQUEST_GET_HASHES.
+#define BO_DFU_FINGERPRINT_SECTORS 64
+
+typedef enum {
+    BO_DFU_VENDOR_SLOT_TARGET = 0,
+    BO_DFU_VENDOR_SLOT_ACTIVE = 1,
+} bo_dfu_vendor_slot_t;
+
 typedef struct __attribute__((packed)) {
     uint8_t bLength;
     uint8_t bDescriptorType;
@@ -107,6 +123,7 @@ typedef enum {
     BO_DFU_USB_PID_CHECK_DATA1 = 0b01001011,
     BO_DFU_USB_PID_CHECK_ACK =   0b11010010,
     BO_DFU_USB_PID_CHECK_STALL = 0b00011110,
+    BO_DFU_USB_PID_CHECK_PRE =   0b00111100,
 } bo_dfu_usb_pid_check_t;
 
 typedef struct {
@@ -13,6 +13,8 @@ static IRAM_ATTR void bo_dfu_default(void)
      * It features a heartbeat LED, inactivity timeout, entry and exit buttons, etc which can be modified via Kconfig.
      * If you would like to customise the DFU process further (eg. by adding LED progress indicators), you can disable CONFIG_BO_DFU_DEFAULT
      * and use this as a starting point or template.
+     * With CONFIG_BO_DFU_HOOKS, block commits, state changes, errors and manifestation are reported to functions you define (see
+     * bo_dfu_hooks.h), rather than having to be polled from the loop.
      *
      * Once initialised, the USB bus is maintained with a single function - bo_dfu_fsm - which must be called repeatedly as quickly as possible.
      * It should look something like this:
@@ -25,18 +27,27 @@ static IRAM_ATTR void bo_dfu_default(void)
      *
      * A *very* small amount of time is available between bo_dfu_fsm() calls for other miscellaneous tasks, such as feeding the WDT or checking
      * timeout conditions. It's important to never block in this interval; even small delays may cause requests to be missed on the bus.
+     * With CONFIG_BO_DFU_SCHEDULER, longer work (eg. progress indication) can instead be registered with bo_dfu_sched_add to run while
+     * the host is known to be waiting, and BO_DFU_SCHED_IDLE_CYCLES gives the time remaining. See bo_dfu_sched.h.
      *
      * The CPU is always configured to 240MHz for DFU mode, so the CPU cycle count can be used as an efficient timekeeping source.
-     * However, this cycle counter is 32 bits, which means it will overflow every ~18s, which could limit its usefulness.
-     * You might want to use another timer source if this is unsuitable, or take note of the inactivity timeout tracking here to see how
-     * this can be used in conjunction with a "seconds" counter.
+     * This cycle counter is 32 bits, so it overflows every ~18s. bo_dfu_ccount64 extends it to 64 bits, and the timers here (see
+     * bo_dfu_timer.h) are built on that: all of them are checked with a single comparison per loop until one is due.
     */
 
+    // For the latency breakdown. Until bo_dfu_init raises it, the cycle count runs at the bootloader's CPU frequency.
+    const uint32_t entry_ms = esp_log_early_timestamp();
+    const uint32_t entry_time = bo_dfu_ccount();
+    const uint32_t entry_mhz = esp_rom_get_cpu_ticks_per_us();
+
     // Initialise USB GPIOs unconditionally to ensure they are in correct "detached" state even if DFU mode doesn't begin.
     bo_dfu_gpio_init();
 
+    // A request from the app (see bo_dfu_rtc_request_dfu) enters DFU mode unconditionally.
+    const bool handoff = bo_dfu_rtc_take_handoff();
+
     // A clean RTC reset is required. Entering DFU mode in other cases is untested.
-    if(!bo_dfu_is_compatible_reset_type())
+    if(!handoff && !bo_dfu_is_compatible_reset_type())
     {
         return;
     }
@@ -50,7 +61,7 @@ static IRAM_ATTR void bo_dfu_default(void)
         gpio_pad_pullup(CONFIG_BO_DFU_GPIO_ENTRY_BUTTON);
         #endif
         PIN_INPUT_ENABLE(GPIO_PIN_MUX_REG[CONFIG_BO_DFU_GPIO_ENTRY_BUTTON]);
-        if(gpio_ll_get_level(&GPIO, CONFIG_BO_DFU_GPIO_ENTRY_BUTTON) == CONFIG_BO_DFU_ENTRY_BUTTON_IDLE_LEVEL)
+        if(!handoff && gpio_ll_get_level(&GPIO, CONFIG_BO_DFU_GPIO_ENTRY_BUTTON) == CONFIG_BO_DFU_ENTRY_BUTTON_IDLE_LEVEL)
         {
             ESP_LOGI(BO_DFU_TAG, "DFU entry button released, skipping");
             return;
@@ -65,8 +76,11 @@ static IRAM_ATTR void bo_dfu_default(void)
         ESP_LOGE(BO_DFU_TAG, "DFU init error");
         return;
     }
+    const uint32_t init_end_time = bo_dfu_ccount();
 
-    ESP_LOGI(BO_DFU_TAG, "DFU Destination: 0x%x (size: 0x%X)", dfu.ota.partition.offset, dfu.ota.partition.size);
+    #ifndef CONFIG_BO_DFU_LAZY_OTA_INIT
+        ESP_LOGI(BO_DFU_TAG, "DFU Destination: 0x%x (size: 0x%X)", dfu.ota.partition.offset, dfu.ota.partition.size);
+    #endif
 
     #ifdef CONFIG_BO_DFU_DEFAULT_USE_HEARTBEAT_LED
         // Initialise heartbeat LED
@@ -77,7 +91,6 @@ static IRAM_ATTR void bo_dfu_default(void)
         gpio_pad_pullup(CONFIG_BO_DFU_GPIO_HEARTBEAT_LED);
         #endif
         gpio_ll_output_enable(&GPIO, CONFIG_BO_DFU_GPIO_HEARTBEAT_LED);
-        uint32_t led_previous_time = bo_dfu_ccount();
     #endif
 
     #ifdef CONFIG_BO_DFU_DEFAULT_USE_EXIT_BUTTON
@@ -96,40 +109,67 @@ static IRAM_ATTR void bo_dfu_default(void)
             BUTTON_IDLE     = CONFIG_BO_DFU_EXIT_BUTTON_IDLE_LEVEL,
             BUTTON_PRESSED  = !CONFIG_BO_DFU_EXIT_BUTTON_IDLE_LEVEL,
         } button_state = BUTTON_IDLE;
-        uint32_t button_time;
     #endif
 
     #ifdef CONFIG_BO_DFU_DEFAULT_USE_INACTIVITY_TIMEOUT
-        // Initialise inactivity timeout
         uint8_t inactivity_timeout_state = BO_DFU_T_GET_STATE(&dfu);
-        uint32_t inactivity_timeout_count = 0;
-        uint32_t inactivity_timeout_previous = bo_dfu_ccount();
     #endif
 
-    #ifdef CONFIG_BO_DFU_DEFAULT_USE_CONNECT_TIMEOUT
-        // Initialise connection timeout
-        uint32_t attach_time = bo_dfu_ccount();
-    #endif
-
-    // Initialise completion timeout
     bool complete = false;
-    uint32_t complete_time;
+
+    enum {
+        TIMER_WDT,
+        TIMER_HEARTBEAT_LED,
+        TIMER_CONNECT,
+        TIMER_COMPLETE,
+        TIMER_EXIT_BUTTON,
+        TIMER_INACTIVITY,
+        TIMER_COUNT,
+    };
+    _Static_assert(TIMER_COUNT <= BO_DFU_TIMERS_MAX, "");
+    bo_dfu_timers_t timers;
+    bo_dfu_timers_init(&timers);
 
     #ifdef CONFIG_BOOTLOADER_WDT_ENABLE
         // Unlocking+Feeding+Locking the RTC WDT can be surprisingly slow, so it's left unlocked for the duration of the DFU loop for faster feeds.
         bo_dfu_wdt_unlock();
     #endif
 
+    // Note: bo_dfu_init has increased the CPU frequency, so cycle counts from here are at 240MHz.
+    // Used for the connection timeout and to measure enumeration latency.
+    const uint32_t attach_time = bo_dfu_ccount();
+    bool configured = false;
+    uint32_t configured_time = 0;
+
+    #ifdef CONFIG_BOOTLOADER_WDT_ENABLE
+        bo_dfu_wdt_feed();
+        bo_dfu_timer_start_ms(&timers, TIMER_WDT, 100, true);
+    #endif
+    #ifdef CONFIG_BO_DFU_DEFAULT_USE_HEARTBEAT_LED
+        bo_dfu_timer_start_ms(&timers, TIMER_HEARTBEAT_LED, 250, true);
+    #endif
+    #ifdef CONFIG_BO_DFU_DEFAULT_USE_CONNECT_TIMEOUT
+        bo_dfu_timer_start_ms(&timers, TIMER_CONNECT, CONFIG_BO_DFU_DEFAULT_CONNECT_TIMEOUT_MS, false);
+    #endif
+    #ifdef CONFIG_BO_DFU_DEFAULT_USE_INACTIVITY_TIMEOUT
+        bo_dfu_timer_start_ms(&timers, TIMER_INACTIVITY, CONFIG_BO_DFU_INACTIVITY_TIMEOUT_S * 1000, false);
+    #endif
+
     bo_dfu_usb_attach();
     for(;;)
     {
+        const uint32_t expired = bo_dfu_timers_poll(&timers);
+
         #ifdef CONFIG_BOOTLOADER_WDT_ENABLE
-            bo_dfu_wdt_feed();
+            if(expired & (1 << TIMER_WDT))
+            {
+                bo_dfu_wdt_feed();
+            }
         #endif
 
         #ifdef CONFIG_BO_DFU_DEFAULT_USE_HEARTBEAT_LED
             // Toggle LED every 250ms
-            if(bo_dfu_ccount() - led_previous_time >= BO_DFU_MS_TO_CCOUNT(250))
+            if(expired & (1 << TIMER_HEARTBEAT_LED))
             {
                 #if CONFIG_BO_DFU_GPIO_HEARTBEAT_LED < 32
                     REG_WRITE(
@@ -142,19 +182,25 @@ static IRAM_ATTR void bo_dfu_default(void)
                         (1 << (CONFIG_BO_DFU_GPIO_HEARTBEAT_LED - 32))
                     );
                 #endif
-                led_previous_time += BO_DFU_MS_TO_CCOUNT(250);
             }
         #endif
 
         #ifdef CONFIG_BO_DFU_DEFAULT_USE_CONNECT_TIMEOUT
             // Check initial connection
-            if(BO_DFU_T_IS_INIT(&dfu) && bo_dfu_ccount() - attach_time >= BO_DFU_MS_TO_CCOUNT(CONFIG_BO_DFU_DEFAULT_CONNECT_TIMEOUT_MS))
+            if((expired & (1 << TIMER_CONNECT)) && BO_DFU_T_IS_INIT(&dfu))
             {
                 ESP_LOGI(BO_DFU_TAG, "Connection timed out, exiting");
                 break;
             }
         #endif
 
+        if(!configured && BO_DFU_IS_CONFIGURED(&dfu))
+        {
+            // Logged after detaching, as nothing may block while attached.
+            configured = true;
+            configured_time = bo_dfu_ccount();
+        }
+
         // Check complete
         if(!complete)
         {
@@ -162,15 +208,12 @@ static IRAM_ATTR void bo_dfu_default(void)
             {
                 ESP_LOGI(BO_DFU_TAG, "DFU download complete! Exiting in %u ms...", CONFIG_BO_DFU_COMPLETE_TIMEOUT_MS);
                 complete = true;
-                complete_time = bo_dfu_ccount();
+                bo_dfu_timer_start_ms(&timers, TIMER_COMPLETE, CONFIG_BO_DFU_COMPLETE_TIMEOUT_MS, false);
             }
         }
-        else
+        else if(expired & (1 << TIMER_COMPLETE))
         {
-            if(bo_dfu_ccount() - complete_time >= BO_DFU_MS_TO_CCOUNT(CONFIG_BO_DFU_COMPLETE_TIMEOUT_MS))
-            {
-                break;
-            }
+            break;
         }
 
         #ifdef CONFIG_BO_DFU_DEFAULT_USE_EXIT_BUTTON
@@ -178,12 +221,16 @@ static IRAM_ATTR void bo_dfu_default(void)
             if(gpio_ll_get_level(&GPIO, CONFIG_BO_DFU_GPIO_EXIT_BUTTON) != button_state)
             {
                 button_state = !button_state;
-                button_time = bo_dfu_ccount();
+                if(button_state == BUTTON_PRESSED)
+                {
+                    bo_dfu_timer_start_ms(&timers, TIMER_EXIT_BUTTON, CONFIG_BO_DFU_EXIT_BUTTON_HOLD_DURATION_MS, false);
+                }
+                else
+                {
+                    bo_dfu_timer_stop(&timers, TIMER_EXIT_BUTTON);
+                }
             }
-            else if(
-                button_state == BUTTON_PRESSED &&
-                bo_dfu_ccount() - button_time >= BO_DFU_MS_TO_CCOUNT(CONFIG_BO_DFU_EXIT_BUTTON_HOLD_DURATION_MS)
-            )
+            else if(expired & (1 << TIMER_EXIT_BUTTON))
             {
                 ESP_LOGI(BO_DFU_TAG, "Button held for %ums, exiting...", CONFIG_BO_DFU_EXIT_BUTTON_HOLD_DURATION_MS);
                 break;
@@ -195,17 +242,12 @@ static IRAM_ATTR void bo_dfu_default(void)
             if(BO_DFU_T_GET_STATE(&dfu) != inactivity_timeout_state)
             {
                 inactivity_timeout_state = BO_DFU_T_GET_STATE(&dfu);
-                inactivity_timeout_count = 0;
-                inactivity_timeout_previous = bo_dfu_ccount();
+                bo_dfu_timer_start_ms(&timers, TIMER_INACTIVITY, CONFIG_BO_DFU_INACTIVITY_TIMEOUT_S * 1000, false);
             }
-            else if(bo_dfu_ccount() - inactivity_timeout_previous >= BO_DFU_MS_TO_CCOUNT(1000))
+            else if(expired & (1 << TIMER_INACTIVITY))
             {
-                if(++inactivity_timeout_count >= CONFIG_BO_DFU_INACTIVITY_TIMEOUT_S)
-                {
-                    ESP_LOGI(BO_DFU_TAG, "DFU inactive, exiting");
-                    break;
-                }
-                inactivity_timeout_previous += BO_DFU_MS_TO_CCOUNT(1000);
+                ESP_LOGI(BO_DFU_TAG, "DFU inactive, exiting");
+                break;
             }
         #endif
 
@@ -213,6 +255,18 @@ static IRAM_ATTR void bo_dfu_default(void)
     }
     bo_dfu_usb_detach();
 
+    // Latency breakdown. bo_dfu_init raises the CPU frequency only at its end, so it's counted at the bootloader's.
+    const uint32_t entry_to_init_cycles = init_end_time - entry_time;
+    const uint32_t init_to_attach_cycles = attach_time - init_end_time;
+    ESP_LOGD(BO_DFU_TAG, "Reset to DFU entry: %u ms", entry_ms);
+    ESP_LOGD(BO_DFU_TAG, "DFU entry to init done: %u cycles at %u MHz", entry_to_init_cycles, entry_mhz);
+    ESP_LOGD(BO_DFU_TAG, "Init done to attach: %u cycles at %u MHz", init_to_attach_cycles, BO_DFU_CPU_FREQ_MHZ);
+    ESP_LOGI(BO_DFU_TAG, "Reset to attach: %u us", entry_ms * 1000 + entry_to_init_cycles / entry_mhz + init_to_attach_cycles / BO_DFU_CPU_FREQ_MHZ);
+    if(configured)
+    {
+        ESP_LOGI(BO_DFU_TAG, "Attach to configured: %u cycles", configured_time - attach_time);
+    }
+
     #ifdef CONFIG_BOOTLOADER_WDT_ENABLE
         bo_dfu_wdt_lock();
     #endif
@@ -221,7 +275,7 @@ static IRAM_ATTR void bo_dfu_default(void)
         gpio_ll_output_disable(&GPIO, CONFIG_BO_DFU_GPIO_HEARTBEAT_LED);
     #endif
 
-    bo_dfu_deinit();
+    bo_dfu_deinit(&dfu);
 
     ESP_LOGI(BO_DFU_TAG, "DFU Ended. Updated: %d", BO_DFU_T_IS_COMPLETE(&dfu));
 }
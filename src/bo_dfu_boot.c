@@ -0,0 +1,39 @@
+#include <stdint.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "bo_dfu_boot.h"
+
+#include "sdkconfig.h"
+
+static const char *TAG = "bo_dfu_boot";
+
+bo_dfu_boot_verified_t g_bo_dfu_boot_verified;
+
+esp_err_t __real_bootloader_load_image(const esp_partition_pos_t *part, esp_image_metadata_t *data);
+
+esp_err_t IRAM_ATTR __wrap_bootloader_load_image(const esp_partition_pos_t *part, esp_image_metadata_t *data)
+{
+    const bo_dfu_boot_verified_t *verified = &g_bo_dfu_boot_verified;
+    if(
+        verified->partition.size != 0 &&
+        part->offset == verified->partition.offset &&
+        part->size == verified->partition.size
+    )
+    {
+        // Only used once, so that a failure here falls back to the usual path.
+        g_bo_dfu_boot_verified.partition.size = 0;
+        if(
+            ESP_OK == bootloader_load_image_no_verify(part, data) &&
+            data->image_len == verified->metadata.image_len &&
+            data->image.entry_addr == verified->metadata.image.entry_addr
+        )
+        {
+            ESP_LOGI(TAG, "Loaded 0x%x, verified on download", part->offset);
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "Image at 0x%x differs from download, verifying", part->offset);
+    }
+    return __real_bootloader_load_image(part, data);
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_BACKGROUND_FLASH: sectors are erased and programmed while the host polls.
+#define CONFIG_BO_DFU_BACKGROUND_FLASH 1
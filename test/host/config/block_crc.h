@@ -0,0 +1,5 @@
+#pragma once
+
+// CONFIG_BO_DFU_BLOCK_CRC: each DNLOAD's wIndex carries the block's CRC. Selects CONFIG_BO_DFU_RESUME.
+#define CONFIG_BO_DFU_BLOCK_CRC 1
+#define CONFIG_BO_DFU_RESUME 1
@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_BUNDLE: the app and data partitions in one download.
+#define CONFIG_BO_DFU_BUNDLE 1
@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_RX_CAPTURE: each bus sample is decoded in the slack before the next bit time.
+#define CONFIG_BO_DFU_RX_CAPTURE 1
@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_RX_EARLY_REJECT: foreign tokens are skipped without decoding, and PRE is recognised.
+#define CONFIG_BO_DFU_RX_EARLY_REJECT 1
@@ -0,0 +1,11 @@
+#pragma once
+
+// CONFIG_BO_DFU_FAULT_INJECTION, at rates which are easy to check.
+#define CONFIG_BO_DFU_FAULT_INJECTION 1
+#define CONFIG_BO_DFU_FAULT_BIT_FLIP_PER_MILLE 100
+#define CONFIG_BO_DFU_FAULT_SE0_PER_MILLE 0
+#define CONFIG_BO_DFU_FAULT_DROP_ACK_PER_MILLE 1000
+#define CONFIG_BO_DFU_FAULT_LOST_ACK_PER_MILLE 250
+#define CONFIG_BO_DFU_FAULT_RX_GLITCH_PER_MILLE 500
+#define CONFIG_BO_DFU_FAULT_RX_JITTER_CYCLES 10
+#define CONFIG_BO_DFU_FAULT_RX_SKEW_CYCLES 0
@@ -0,0 +1,7 @@
+#pragma once
+
+// The options which change how blocks are accepted and written.
+#define CONFIG_BO_DFU_RESUME 1
+#define CONFIG_BO_DFU_BLOCK_CRC 1
+#define CONFIG_BO_DFU_BACKGROUND_FLASH 1
+#define CONFIG_BO_DFU_LAZY_OTA_INIT 1
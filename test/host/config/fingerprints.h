@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_SECTOR_FINGERPRINTS: HASH, GET_HASHES and COPY_SECTOR vendor requests.
+#define CONFIG_BO_DFU_SECTOR_FINGERPRINTS 1
@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_LAZY_OTA_INIT: the destination is resolved on the first block rather than in bo_dfu_init.
+#define CONFIG_BO_DFU_LAZY_OTA_INIT 1
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// CONFIG_BO_DFU_FAULT_INJECTION, with every rate read from host_link_rates so that test_link.c can sweep them.
+#define CONFIG_BO_DFU_FAULT_INJECTION 1
+#define CONFIG_BO_DFU_FAULT_BIT_FLIP_PER_MILLE (host_link_rates.bit_flip)
+#define CONFIG_BO_DFU_FAULT_SE0_PER_MILLE (host_link_rates.se0)
+#define CONFIG_BO_DFU_FAULT_DROP_ACK_PER_MILLE (host_link_rates.drop_ack)
+#define CONFIG_BO_DFU_FAULT_LOST_ACK_PER_MILLE (host_link_rates.lost_ack)
+#define CONFIG_BO_DFU_FAULT_RX_GLITCH_PER_MILLE (host_link_rates.rx_glitch)
+#define CONFIG_BO_DFU_FAULT_RX_JITTER_CYCLES (host_link_rates.rx_jitter)
+#define CONFIG_BO_DFU_FAULT_RX_SKEW_CYCLES (host_link_rates.rx_skew)
+
+typedef struct {
+    uint32_t bit_flip;
+    uint32_t se0;
+    uint32_t drop_ack;
+    uint32_t lost_ack;
+    uint32_t rx_glitch;
+    int32_t rx_jitter;
+    int32_t rx_skew;
+} host_link_rates_t;
+
+extern host_link_rates_t host_link_rates;
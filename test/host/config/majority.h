@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_RX_MAJORITY: each bit is decided by majority of three reads.
+#define CONFIG_BO_DFU_RX_MAJORITY 1
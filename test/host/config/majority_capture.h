@@ -0,0 +1,5 @@
+#pragma once
+
+// CONFIG_BO_DFU_RX_MAJORITY with CONFIG_BO_DFU_RX_CAPTURE.
+#define CONFIG_BO_DFU_RX_MAJORITY 1
+#define CONFIG_BO_DFU_RX_CAPTURE 1
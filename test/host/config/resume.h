@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_RESUME: an interrupted download may be continued after CLRSTATUS.
+#define CONFIG_BO_DFU_RESUME 1
@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_SKIP_INSTALLED: a download of the active app isn't written.
+#define CONFIG_BO_DFU_SKIP_INSTALLED 1
@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_SPARSE: sparse images are decoded as they're received.
+#define CONFIG_BO_DFU_SPARSE 1
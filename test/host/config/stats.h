@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_STATS: link and flash statistics.
+#define CONFIG_BO_DFU_STATS 1
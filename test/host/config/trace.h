@@ -0,0 +1,4 @@
+#pragma once
+
+// CONFIG_BO_DFU_TRACE: events are recorded in retained RTC memory.
+#define CONFIG_BO_DFU_TRACE 1
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Fuzzing of the transaction layer and DFU requests with arbitrary sequences of packets and control transfers.
+ *
+ * The input is a stream of operations, each a selector byte and its arguments (see fuzz_op), so that most inputs reach past the
+ * CRC checks and into request handling. Missing argument bytes read as zero. Invariants checked throughout:
+ *  - Nothing is written outside dfu.buffer when writing into it. ASan covers the end of bo_dfu_t, and the copies into the buffer
+ *    are checked here so that an overrun into the following fields is caught too.
+ *  - Once complete, the DFU state never returns to an incomplete one.
+ *  - Flash is only written or erased within the OTA partition being downloaded to, and OTA data (see host_flash_guard).
+ *
+ * Built with clang and HOST_LIBFUZZER, this is a libFuzzer target (make fuzz). Otherwise, main runs each file given, or a number
+ * of pseudorandom inputs (make check).
+*/
+
+static void *fuzz_memcpy(void *dest, const void *src, size_t n);
+static void *fuzz_memset(void *dest, int c, size_t n);
+#define memcpy(dest, src, n) fuzz_memcpy(dest, src, n)
+#define memset(dest, c, n) fuzz_memset(dest, c, n)
+
+#include "host_usb.h"
+
+#define FUZZ_IMAGE_LEN (2 * 0x1000 + 0x300)
+
+static bo_dfu_t s_dfu;
+static uint8_t s_image[FUZZ_IMAGE_LEN];
+
+static void fuzz_check_buffer_write(const void *dest, size_t n)
+{
+    const uint8_t *start = s_dfu.dfu.buffer;
+    const uint8_t *end = start + sizeof(s_dfu.dfu.buffer);
+    const uint8_t *d = dest;
+    if(d >= start && d < end && n > (size_t)(end - d))
+    {
+        host_fail("write of %zu bytes at dfu.buffer[%zu] overruns it", n, (size_t)(d - start));
+    }
+}
+
+#undef memcpy
+#undef memset
+
+static void *fuzz_memcpy(void *dest, const void *src, size_t n)
+{
+    fuzz_check_buffer_write(dest, n);
+    return memcpy(dest, src, n);
+}
+
+static void *fuzz_memset(void *dest, int c, size_t n)
+{
+    fuzz_check_buffer_write(dest, n);
+    return memset(dest, c, n);
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+} fuzz_input_t;
+
+static uint8_t fuzz_u8(fuzz_input_t *in)
+{
+    if(in->len == 0)
+    {
+        return 0;
+    }
+    --in->len;
+    return *in->data++;
+}
+
+static uint16_t fuzz_u16(fuzz_input_t *in)
+{
+    const uint16_t lo = fuzz_u8(in);
+    return lo | (fuzz_u8(in) << 8);
+}
+
+static void fuzz_bytes(fuzz_input_t *in, uint8_t *dest, size_t len)
+{
+    for(size_t i = 0; i < len; ++i)
+    {
+        dest[i] = fuzz_u8(in);
+    }
+}
+
+static uint8_t fuzz_pid(fuzz_input_t *in)
+{
+    static const uint8_t pids[] = {
+        BO_DFU_USB_PID_CHECK_SETUP, BO_DFU_USB_PID_CHECK_OUT, BO_DFU_USB_PID_CHECK_IN,
+        BO_DFU_USB_PID_CHECK_DATA0, BO_DFU_USB_PID_CHECK_DATA1,
+        BO_DFU_USB_PID_CHECK_ACK, BO_DFU_USB_PID_CHECK_STALL, BO_DFU_USB_PID_CHECK_PRE,
+    };
+    const uint8_t b = fuzz_u8(in);
+    return (b < 0xF0) ? pids[b % sizeof(pids)] : fuzz_u8(in);
+}
+
+// Runs the device for up to n calls, then discards anything it didn't consume.
+static void fuzz_run(uint32_t n)
+{
+    s_host_usb.tx_count = 0;
+    for(uint32_t i = 0; i < n && s_host_usb.count > 0; ++i)
+    {
+        bo_dfu_fsm(&s_dfu);
+    }
+    s_host_usb.count = 0;
+}
+
+static uint16_t fuzz_block_len(fuzz_input_t *in)
+{
+    static const uint16_t lens[] = { 0, 8, 64, 512, 1024, 2048, 3072, 4096 };
+    const uint8_t b = fuzz_u8(in);
+    return (b < 0xF0) ? lens[b % 8] : (fuzz_u16(in) % 0x1001);
+}
+
+static void fuzz_op(fuzz_input_t *in)
+{
+    // Weighted towards DFU requests, which carry most of the state.
+    const uint8_t op = fuzz_u8(in);
+    switch(op % 16)
+    {
+        case 0:
+        {
+            // Raw packet, CRC and all
+            uint8_t payload[10];
+            const uint8_t pid = fuzz_u8(in);
+            const size_t len = fuzz_u8(in) % (sizeof(payload) + 1);
+            fuzz_bytes(in, payload, len);
+            host_usb_queue_raw(pid, payload, len);
+            break;
+        }
+        case 1:
+        {
+            // Token with any address and endpoint
+            const uint8_t pid = fuzz_pid(in);
+            const uint16_t token = (fuzz_u8(in) & 1) ? (fuzz_u16(in) & 0x7FF) : s_host_usb.address;
+            const uint16_t token_with_crc = token | (bo_dfu_crc_token(token) << 11);
+            const uint8_t bytes[2] = { token_with_crc & 0xFF, token_with_crc >> 8 };
+            host_usb_queue_raw(pid, bytes, sizeof(bytes));
+            break;
+        }
+        case 2:
+        {
+            // Data packet of any PID and length
+            uint8_t data[BO_DFU_USB_LOW_SPEED_PACKET_SIZE];
+            const uint8_t pid = fuzz_pid(in);
+            const size_t len = fuzz_u8(in) % (sizeof(data) + 1);
+            fuzz_bytes(in, data, len);
+            host_usb_queue_data(pid, data, len);
+            break;
+        }
+        case 3:
+            host_usb_queue_handshake(fuzz_pid(in));
+            break;
+        case 4:
+            fuzz_run(1 + fuzz_u8(in) % 16);
+            break;
+        case 5:
+        {
+            // Control transfer with arbitrary fields, and data from the input
+            static const uint8_t types[] = { 0x21, 0xA1, 0x00, 0x80, 0x01, 0x81 };
+            const uint8_t b = fuzz_u8(in);
+            const uint8_t bmRequestType = (b < 0xF0) ? types[b % sizeof(types)] : fuzz_u8(in);
+            const uint8_t bRequest = fuzz_u8(in) % 12;
+            const uint16_t wValue = fuzz_u16(in);
+            const uint16_t wIndex = fuzz_u16(in);
+            const uint16_t wLength = fuzz_u16(in) % 0x1100;
+            static uint8_t data[0x1100];
+            if(!(bmRequestType & 0x80))
+            {
+                fuzz_bytes(in, data, MIN(wLength, 64));
+                memset(&data[MIN(wLength, 64)], fuzz_u8(in), wLength - MIN(wLength, 64));
+            }
+            host_usb_control(&s_dfu, bmRequestType, bRequest, wValue, wIndex, wLength, data);
+            break;
+        }
+        case 6:
+            host_usb_bus_reset(&s_dfu);
+            break;
+        case 7:
+        case 8:
+        case 9:
+        {
+            // DNLOAD of part of the image
+            const uint16_t block = fuzz_u8(in) % 4;
+            const uint16_t len = fuzz_block_len(in);
+            const size_t offset = MIN((size_t)block * len, FUZZ_IMAGE_LEN);
+            host_dfu_dnload(&s_dfu, block, &s_image[offset], MIN(len, FUZZ_IMAGE_LEN - offset));
+            break;
+        }
+        case 10:
+        case 11:
+        {
+            host_dfu_status_t status;
+            host_dfu_getstatus(&s_dfu, &status);
+            break;
+        }
+        case 12:
+            host_dfu_abort(&s_dfu);
+            break;
+        case 13:
+            host_dfu_clrstatus(&s_dfu);
+            break;
+        case 14:
+            host_dfu_getstate(&s_dfu);
+            break;
+        case 15:
+        {
+            // The whole image, as a host would send it
+            static const uint16_t block_sizes[] = { 0x1000, 0x800, 0x400, 64, 8 };
+            host_dfu_download(&s_dfu, s_image, FUZZ_IMAGE_LEN, block_sizes[fuzz_u8(in) % 5]);
+            break;
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    host_reset();
+    host_usb_reset();
+    // ota_0 is running, so ota_1 is the only app partition which may be written.
+    host_otadata_set(1);
+    host_flash_guard(HOST_OTA1_OFFSET, HOST_OTA_SIZE);
+    host_flash_guard(HOST_OTADATA_OFFSET, HOST_OTADATA_SIZE);
+    if(s_image[0] == 0)
+    {
+        host_image_build(s_image, FUZZ_IMAGE_LEN, 1);
+    }
+
+    if(bo_dfu_init(&s_dfu) != ESP_OK)
+    {
+        host_fail("init");
+    }
+    fuzz_input_t in = { .data = data, .len = size };
+    // Usually from enumeration, else from the bus reset alone.
+    if(fuzz_u8(&in) & 1)
+    {
+        host_usb_enumerate(&s_dfu);
+    }
+    else
+    {
+        host_usb_bus_reset(&s_dfu);
+    }
+
+    bool complete = false;
+    while(in.len > 0)
+    {
+        fuzz_op(&in);
+        if(s_host_usb.count >= HOST_USB_QUEUE_MAX - 2)
+        {
+            fuzz_run(HOST_USB_QUEUE_MAX * 2);
+        }
+        if(complete && !BO_DFU_T_IS_COMPLETE(&s_dfu))
+        {
+            host_fail("returned from a complete state to %u", BO_DFU_T_GET_STATE(&s_dfu));
+        }
+        complete = BO_DFU_T_IS_COMPLETE(&s_dfu);
+        #ifdef CONFIG_BO_DFU_ANY_BLOCK_SIZE
+            if(s_dfu.dfu.fill > sizeof(s_dfu.dfu.buffer))
+            {
+                host_fail("fill %u", s_dfu.dfu.fill);
+            }
+        #endif
+    }
+    fuzz_run(HOST_USB_QUEUE_MAX * 2);
+    bo_dfu_deinit(&s_dfu);
+    return 0;
+}
+
+#ifndef HOST_LIBFUZZER
+
+static uint32_t fuzz_xorshift(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/**
+ * Without libFuzzer: each file given is run as an input (eg. to reproduce a crash), or else FUZZ_ITERATIONS (default 2000)
+ * pseudorandom inputs from FUZZ_SEED.
+*/
+int main(int argc, char **argv)
+{
+    static uint8_t input[4096];
+    if(argc > 1)
+    {
+        for(int i = 1; i < argc; ++i)
+        {
+            FILE *f = fopen(argv[i], "rb");
+            if(!f)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            const size_t len = fread(input, 1, sizeof(input), f);
+            fclose(f);
+            LLVMFuzzerTestOneInput(input, len);
+        }
+        return 0;
+    }
+    const char *iterations_env = getenv("FUZZ_ITERATIONS");
+    const char *seed_env = getenv("FUZZ_SEED");
+    const uint32_t iterations = iterations_env ? strtoul(iterations_env, NULL, 0) : 2000;
+    uint32_t state = seed_env ? strtoul(seed_env, NULL, 0) : 1;
+    for(uint32_t i = 0; i < iterations; ++i)
+    {
+        const size_t len = fuzz_xorshift(&state) % 128;
+        for(size_t j = 0; j < len; ++j)
+        {
+            input[j] = fuzz_xorshift(&state);
+        }
+        LLVMFuzzerTestOneInput(input, len);
+    }
+    printf("%s: ok (%u inputs)\n", HOST_TEST_NAME, iterations);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,675 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_idf.h"
+#include "host.h"
+
+uint8_t host_flash[HOST_FLASH_SIZE];
+uint32_t host_ccount;
+uint32_t host_ccount_step = 8;
+uint32_t host_flash_erase_polls = 4;
+uint32_t host_flash_write_cycles;
+uint32_t host_flash_erases;
+uint32_t host_flash_writes;
+bool host_verbose;
+
+uint32_t host_efuse_blk0[8] = { 0, 0x12345678, 0x9abc };
+const uint32_t GPIO_PIN_MUX_REG[40];
+gpio_dev_t GPIO;
+rtc_cntl_dev_t RTCCNTL;
+
+void host_fail(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "host: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    abort();
+}
+
+void host_asm_fail(const char *what)
+{
+    host_fail("reached asm(\"%s\")", what);
+}
+
+// ---- Cycle counter and registers ----
+
+static uint32_t host_regs[128];
+
+uint32_t host_gpio_in_idle(void)
+{
+    // J: D- high, D+ low
+    return 1u << CONFIG_BO_DFU_GPIO_DN;
+}
+
+uint32_t (*host_gpio_in)(void) = host_gpio_in_idle;
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    host_ccount += host_ccount_step;
+    return host_ccount;
+}
+
+// SPI1, as driven by bo_dfu_flash.h: write enable, sector erase and status reads, with the erase taking a few reads to finish.
+static struct {
+    uint32_t status;
+    uint32_t busy_reads;
+} host_spi1;
+
+#define HOST_FLASH_STATUS_WIP (1 << 0)
+#define HOST_FLASH_STATUS_WEL (1 << 1)
+
+static void host_flash_check_access(void);
+static void host_flash_check_range(uint32_t offset, uint32_t size, const char *op);
+
+static void host_spi1_command(uint32_t command)
+{
+    if(command & SPI_FLASH_RDSR)
+    {
+        if(host_spi1.busy_reads > 0 && --host_spi1.busy_reads == 0)
+        {
+            host_spi1.status &= ~HOST_FLASH_STATUS_WIP;
+        }
+        host_regs[SPI_RD_STATUS_REG(1)] = host_spi1.status;
+    }
+    if(command & SPI_FLASH_WREN)
+    {
+        host_flash_check_access();
+        host_spi1.status |= HOST_FLASH_STATUS_WEL;
+    }
+    if(command & SPI_FLASH_SE)
+    {
+        host_flash_check_access();
+        if(!(host_spi1.status & HOST_FLASH_STATUS_WEL))
+        {
+            return;
+        }
+        const uint32_t offset = host_regs[SPI_ADDR_REG(1)] & ~(HOST_SECTOR_SIZE - 1);
+        host_flash_check_range(offset, HOST_SECTOR_SIZE, "erase");
+        memset(&host_flash[offset], 0xFF, HOST_SECTOR_SIZE);
+        ++host_flash_erases;
+        host_spi1.status = HOST_FLASH_STATUS_WIP;
+        host_spi1.busy_reads = host_flash_erase_polls;
+    }
+}
+
+uint32_t host_reg_read(uint32_t reg)
+{
+    if(reg == GPIO_IN_REG || reg == GPIO_IN1_REG)
+    {
+        return host_gpio_in();
+    }
+    if(reg >= sizeof(host_regs) / sizeof(host_regs[0]))
+    {
+        host_fail("read of unknown register 0x%x", reg);
+    }
+    return host_regs[reg];
+}
+
+void host_reg_write(uint32_t reg, uint32_t value)
+{
+    if(reg >= sizeof(host_regs) / sizeof(host_regs[0]))
+    {
+        host_fail("write of unknown register 0x%x", reg);
+    }
+    if(reg == SPI_CMD_REG(1))
+    {
+        // Commands complete immediately; only the flash itself stays busy.
+        host_spi1_command(value);
+        host_regs[reg] = 0;
+        return;
+    }
+    host_regs[reg] = value;
+}
+
+// ---- Flash ----
+
+#define HOST_GUARDS_MAX 8
+static struct {
+    uint32_t offset;
+    uint32_t size;
+} host_guards[HOST_GUARDS_MAX];
+static uint32_t host_guard_count;
+
+void host_flash_guard(uint32_t offset, uint32_t size)
+{
+    if(host_guard_count >= HOST_GUARDS_MAX)
+    {
+        host_fail("too many flash guards");
+    }
+    host_guards[host_guard_count].offset = offset;
+    host_guards[host_guard_count].size = size;
+    ++host_guard_count;
+}
+
+void host_flash_unguard(void)
+{
+    host_guard_count = 0;
+}
+
+static void host_flash_check_access(void)
+{
+    if(host_spi1.status & HOST_FLASH_STATUS_WIP)
+    {
+        host_fail("flash accessed while an erase is in progress");
+    }
+}
+
+static void host_flash_check_range(uint32_t offset, uint32_t size, const char *op)
+{
+    if(offset > HOST_FLASH_SIZE || size > HOST_FLASH_SIZE - offset)
+    {
+        host_fail("%s of 0x%x bytes at 0x%x is beyond the end of flash", op, size, offset);
+    }
+    if(host_guard_count == 0)
+    {
+        return;
+    }
+    for(uint32_t i = 0; i < host_guard_count; ++i)
+    {
+        if(offset >= host_guards[i].offset && offset + size <= host_guards[i].offset + host_guards[i].size)
+        {
+            return;
+        }
+    }
+    host_fail("%s of 0x%x bytes at 0x%x is outside the permitted regions", op, size, offset);
+}
+
+esp_err_t bootloader_flash_read(size_t src_addr, void *dest, size_t size, bool allow_decrypt)
+{
+    host_flash_check_access();
+    if(src_addr > HOST_FLASH_SIZE || size > HOST_FLASH_SIZE - src_addr)
+    {
+        return ESP_FAIL;
+    }
+    memcpy(dest, &host_flash[src_addr], size);
+    return ESP_OK;
+}
+
+esp_err_t bootloader_flash_write(size_t dest_addr, void *src, size_t size, bool write_encrypted)
+{
+    host_flash_check_access();
+    host_flash_check_range(dest_addr, size, "write");
+    // NOR flash only clears bits.
+    const uint8_t *data = src;
+    for(size_t i = 0; i < size; ++i)
+    {
+        host_flash[dest_addr + i] &= data[i];
+    }
+    ++host_flash_writes;
+    host_ccount += host_flash_write_cycles;
+    return ESP_OK;
+}
+
+esp_err_t bootloader_flash_erase_range(uint32_t start_addr, uint32_t size)
+{
+    host_flash_check_access();
+    if((start_addr % HOST_SECTOR_SIZE) != 0 || (size % HOST_SECTOR_SIZE) != 0)
+    {
+        return ESP_FAIL;
+    }
+    host_flash_check_range(start_addr, size, "erase");
+    memset(&host_flash[start_addr], 0xFF, size);
+    ++host_flash_erases;
+    return ESP_OK;
+}
+
+esp_err_t bootloader_flash_erase_sector(size_t sector)
+{
+    return bootloader_flash_erase_range(sector * HOST_SECTOR_SIZE, HOST_SECTOR_SIZE);
+}
+
+const void *bootloader_mmap(uint32_t src_addr, uint32_t size)
+{
+    host_flash_check_access();
+    if(src_addr > HOST_FLASH_SIZE || size > HOST_FLASH_SIZE - src_addr)
+    {
+        return NULL;
+    }
+    return &host_flash[src_addr];
+}
+
+void bootloader_munmap(const void *mapping)
+{
+}
+
+// ---- Partition table and OTA data ----
+
+static void host_partition_add(esp_partition_info_t *entry, uint8_t type, uint8_t subtype, uint32_t offset, uint32_t size, const char *label)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->magic = ESP_PARTITION_MAGIC;
+    entry->type = type;
+    entry->subtype = subtype;
+    entry->pos.offset = offset;
+    entry->pos.size = size;
+    strncpy((char*)entry->label, label, sizeof(entry->label));
+}
+
+bool bootloader_utility_load_partition_table(bootloader_state_t *bs)
+{
+    const esp_partition_info_t *partitions = (const esp_partition_info_t*)&host_flash[ESP_PARTITION_TABLE_OFFSET];
+    memset(bs, 0, sizeof(*bs));
+    for(size_t i = 0; i < ESP_PARTITION_TABLE_MAX_LEN / sizeof(esp_partition_info_t) && partitions[i].magic == ESP_PARTITION_MAGIC; ++i)
+    {
+        const esp_partition_info_t *partition = &partitions[i];
+        if(partition->type == PART_TYPE_APP)
+        {
+            if(partition->subtype == PART_SUBTYPE_FACTORY)
+            {
+                bs->factory = partition->pos;
+            }
+            else if(partition->subtype == PART_SUBTYPE_TEST)
+            {
+                bs->test = partition->pos;
+            }
+            else if((partition->subtype & ~PART_SUBTYPE_OTA_MASK) == PART_SUBTYPE_OTA_FLAG)
+            {
+                bs->ota[partition->subtype & PART_SUBTYPE_OTA_MASK] = partition->pos;
+                ++bs->app_count;
+            }
+        }
+        else if(partition->type == PART_TYPE_DATA && partition->subtype == PART_SUBTYPE_DATA_OTA)
+        {
+            bs->ota_info = partition->pos;
+        }
+    }
+    return true;
+}
+
+uint32_t bootloader_common_ota_select_crc(const esp_ota_select_entry_t *s)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t*)&s->ota_seq, sizeof(s->ota_seq));
+}
+
+bool bootloader_common_ota_select_invalid(const esp_ota_select_entry_t *s)
+{
+    return s->ota_seq == UINT32_MAX || s->ota_state == ESP_OTA_IMG_INVALID || s->ota_state == ESP_OTA_IMG_ABORTED;
+}
+
+bool bootloader_common_ota_select_valid(const esp_ota_select_entry_t *s)
+{
+    return !bootloader_common_ota_select_invalid(s) && s->crc == bootloader_common_ota_select_crc(s);
+}
+
+int bootloader_common_get_active_otadata(esp_ota_select_entry_t *two_otadata)
+{
+    const bool valid[2] = {
+        bootloader_common_ota_select_valid(&two_otadata[0]),
+        bootloader_common_ota_select_valid(&two_otadata[1]),
+    };
+    if(valid[0] && valid[1])
+    {
+        return (two_otadata[0].ota_seq >= two_otadata[1].ota_seq) ? 0 : 1;
+    }
+    return valid[0] ? 0 : (valid[1] ? 1 : -1);
+}
+
+void host_otadata_set(uint32_t seq)
+{
+    memset(&host_flash[HOST_OTADATA_OFFSET], 0xFF, HOST_OTADATA_SIZE);
+    if(seq == 0)
+    {
+        return;
+    }
+    host_otadata_add(seq, ESP_OTA_IMG_VALID);
+}
+
+void host_otadata_add(uint32_t seq, uint32_t state)
+{
+    esp_ota_select_entry_t entry;
+    memset(&entry, 0xFF, sizeof(entry));
+    entry.ota_seq = seq;
+    entry.ota_state = state;
+    entry.crc = bootloader_common_ota_select_crc(&entry);
+    memset(&host_flash[HOST_OTADATA_OFFSET + ((seq - 1) % 2) * HOST_SECTOR_SIZE], 0xFF, HOST_SECTOR_SIZE);
+    memcpy(&host_flash[HOST_OTADATA_OFFSET + ((seq - 1) % 2) * HOST_SECTOR_SIZE], &entry, sizeof(entry));
+}
+
+uint32_t host_otadata_seq(void)
+{
+    esp_ota_select_entry_t entries[2];
+    memcpy(&entries[0], &host_flash[HOST_OTADATA_OFFSET], sizeof(entries[0]));
+    memcpy(&entries[1], &host_flash[HOST_OTADATA_OFFSET + HOST_SECTOR_SIZE], sizeof(entries[1]));
+    const int active = bootloader_common_get_active_otadata(entries);
+    return (active < 0) ? 0 : entries[active].ota_seq;
+}
+
+// ---- Images ----
+
+typedef struct __attribute__((packed)) {
+    esp_image_header_t image_header;
+    esp_image_segment_header_t segment_header;
+    esp_app_desc_t app_desc;
+} host_image_t;
+
+static uint32_t host_xorshift(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+void host_image_build(uint8_t *image, size_t image_len, uint32_t seed)
+{
+    if(image_len < sizeof(host_image_t) + sizeof(uint32_t))
+    {
+        host_fail("image too small");
+    }
+    uint32_t prng = seed | 1;
+    for(size_t i = 0; i < image_len; ++i)
+    {
+        image[i] = host_xorshift(&prng);
+    }
+    host_image_t *header = (host_image_t*)image;
+    memset(&header->image_header, 0, sizeof(header->image_header));
+    header->image_header.magic = ESP_IMAGE_HEADER_MAGIC;
+    header->image_header.segment_count = 1;
+    header->image_header.entry_addr = 0x40080000 + (seed & 0xFFFF);
+    header->segment_header.load_addr = 0x3F400020;
+    header->segment_header.data_len = image_len - sizeof(header->image_header) - sizeof(header->segment_header) - sizeof(uint32_t);
+    memset(&header->app_desc, 0, sizeof(header->app_desc));
+    header->app_desc.magic_word = ESP_APP_DESC_MAGIC_WORD;
+    snprintf(header->app_desc.project_name, sizeof(header->app_desc.project_name), "host");
+    snprintf(header->app_desc.version, sizeof(header->app_desc.version), "%u", seed);
+    for(size_t i = 0; i < sizeof(header->app_desc.app_elf_sha256); ++i)
+    {
+        header->app_desc.app_elf_sha256[i] = host_xorshift(&prng);
+    }
+    const uint32_t crc = esp_rom_crc32_le(0, image, image_len - sizeof(uint32_t));
+    memcpy(&image[image_len - sizeof(uint32_t)], &crc, sizeof(crc));
+}
+
+esp_err_t bootloader_common_check_chip_validity(const esp_image_header_t* img_hdr, esp_image_type type)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, const esp_partition_pos_t *part, esp_image_metadata_t *data)
+{
+    host_flash_check_access();
+    if(part->offset > HOST_FLASH_SIZE || part->size > HOST_FLASH_SIZE - part->offset || part->size < sizeof(host_image_t) + sizeof(uint32_t))
+    {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    const host_image_t *header = (const host_image_t*)&host_flash[part->offset];
+    const size_t image_len = sizeof(header->image_header) + sizeof(header->segment_header) + (size_t)header->segment_header.data_len + sizeof(uint32_t);
+    if(
+        header->image_header.magic != ESP_IMAGE_HEADER_MAGIC ||
+        header->image_header.segment_count != 1 ||
+        header->app_desc.magic_word != ESP_APP_DESC_MAGIC_WORD ||
+        header->segment_header.data_len > part->size ||
+        image_len > part->size
+    )
+    {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    uint32_t crc;
+    memcpy(&crc, &host_flash[part->offset + image_len - sizeof(uint32_t)], sizeof(crc));
+    if(crc != esp_rom_crc32_le(0, &host_flash[part->offset], image_len - sizeof(uint32_t)))
+    {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    memset(data, 0, sizeof(*data));
+    data->start_addr = part->offset;
+    data->image = header->image_header;
+    data->segments[0] = header->segment_header;
+    data->image_len = image_len;
+    return ESP_OK;
+}
+
+esp_err_t bootloader_load_image_no_verify(const esp_partition_pos_t *part, esp_image_metadata_t *data)
+{
+    return esp_image_verify(ESP_IMAGE_LOAD, part, data);
+}
+
+// ---- ROM ----
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    // As the ROM: the CRC is inverted before and after, so esp_rom_crc32_le(0, ...) matches zlib's crc32().
+    crc = ~crc;
+    for(uint32_t i = 0; i < len; ++i)
+    {
+        crc ^= buf[i];
+        for(int b = 0; b < 8; ++b)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+uint16_t esp_rom_crc16_le(uint16_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    for(uint32_t i = 0; i < len; ++i)
+    {
+        crc ^= buf[i];
+        for(int b = 0; b < 8; ++b)
+        {
+            crc = (crc >> 1) ^ (0x8408 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+int esp_rom_printf(const char *fmt, ...)
+{
+    if(!host_verbose)
+    {
+        return 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    const int len = vprintf(fmt, args);
+    va_end(args);
+    return len;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    host_ccount += us * 240;
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 240;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return host_ccount / (240 * 1000);
+}
+
+uint32_t esp_log_early_timestamp(void)
+{
+    return esp_log_timestamp();
+}
+
+soc_reset_reason_t esp_rom_get_reset_reason(int cpu)
+{
+    return RESET_REASON_CHIP_POWER_ON;
+}
+
+void esp_rom_uart_tx_wait_idle(int uart) {}
+void esp_rom_gpio_pad_select_gpio(int gpio) {}
+void gpio_pad_pulldown(int gpio) {}
+void gpio_pad_pullup(int gpio) {}
+void gpio_output_set(uint32_t set, uint32_t clear, uint32_t enable, uint32_t disable) {}
+void gpio_output_set_high(uint32_t set, uint32_t clear, uint32_t enable, uint32_t disable) {}
+int gpio_ll_get_level(gpio_dev_t *hw, int gpio) { return 1; }
+void gpio_ll_output_enable(gpio_dev_t *hw, int gpio) {}
+void gpio_ll_output_disable(gpio_dev_t *hw, int gpio) {}
+void rwdt_ll_write_protect_disable(rtc_cntl_dev_t *hw) {}
+void rwdt_ll_write_protect_enable(rtc_cntl_dev_t *hw) {}
+void rwdt_ll_feed(rtc_cntl_dev_t *hw) {}
+void rtc_clk_init(rtc_clk_config_t cfg) {}
+uint32_t efuse_hal_get_rated_freq_mhz(void) { return 240; }
+uint32_t efuse_hal_get_major_chip_version(void) { return 3; }
+uint32_t efuse_hal_get_minor_chip_version(void) { return 0; }
+
+// ---- Retained RTC memory ----
+
+static rtc_retain_mem_t host_rtc_retain_mem;
+uint32_t host_rtc_commits;
+
+rtc_retain_mem_t* bootloader_common_get_rtc_retain_mem(void)
+{
+    return &host_rtc_retain_mem;
+}
+
+void bootloader_common_update_rtc_retain_mem(esp_partition_pos_t* partition, bool reboot_counter)
+{
+    if(partition)
+    {
+        host_rtc_retain_mem.partition = *partition;
+    }
+    if(reboot_counter)
+    {
+        ++host_rtc_retain_mem.reboot_counter;
+    }
+    ++host_rtc_commits;
+    host_rtc_retain_mem.crc = esp_rom_crc32_le(UINT32_MAX, (const uint8_t*)&host_rtc_retain_mem, sizeof(host_rtc_retain_mem) - sizeof(host_rtc_retain_mem.crc));
+}
+
+void bootloader_common_reset_rtc_retain_mem(void)
+{
+    memset(&host_rtc_retain_mem, 0, sizeof(host_rtc_retain_mem));
+}
+
+// ---- SHA-256 ----
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t len;
+    uint8_t block[64];
+    size_t fill;
+} host_sha256_t;
+
+static host_sha256_t host_sha256;
+
+#define HOST_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void host_sha256_block(host_sha256_t *ctx, const uint8_t *block)
+{
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+    uint32_t w[64];
+    for(int i = 0; i < 16; ++i)
+    {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for(int i = 16; i < 64; ++i)
+    {
+        const uint32_t s0 = HOST_ROR(w[i - 15], 7) ^ HOST_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = HOST_ROR(w[i - 2], 17) ^ HOST_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for(int i = 0; i < 64; ++i)
+    {
+        const uint32_t t1 = h + (HOST_ROR(e, 6) ^ HOST_ROR(e, 11) ^ HOST_ROR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        const uint32_t t2 = (HOST_ROR(a, 2) ^ HOST_ROR(a, 13) ^ HOST_ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+bootloader_sha256_handle_t bootloader_sha256_start(void)
+{
+    static const uint32_t init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    memset(&host_sha256, 0, sizeof(host_sha256));
+    memcpy(host_sha256.state, init, sizeof(init));
+    return &host_sha256;
+}
+
+void bootloader_sha256_data(bootloader_sha256_handle_t handle, const void *data, size_t data_len)
+{
+    host_sha256_t *ctx = handle;
+    const uint8_t *bytes = data;
+    ctx->len += data_len;
+    while(data_len > 0)
+    {
+        const size_t n = MIN(data_len, sizeof(ctx->block) - ctx->fill);
+        memcpy(&ctx->block[ctx->fill], bytes, n);
+        ctx->fill += n;
+        bytes += n;
+        data_len -= n;
+        if(ctx->fill == sizeof(ctx->block))
+        {
+            host_sha256_block(ctx, ctx->block);
+            ctx->fill = 0;
+        }
+    }
+}
+
+void bootloader_sha256_finish(bootloader_sha256_handle_t handle, uint8_t *digest)
+{
+    host_sha256_t *ctx = handle;
+    if(!digest)
+    {
+        return;
+    }
+    const uint64_t bits = ctx->len * 8;
+    const uint8_t pad = 0x80;
+    bootloader_sha256_data(ctx, &pad, 1);
+    const uint8_t zero = 0;
+    while(ctx->fill != 56)
+    {
+        bootloader_sha256_data(ctx, &zero, 1);
+    }
+    uint8_t len_be[8];
+    for(int i = 0; i < 8; ++i)
+    {
+        len_be[i] = bits >> (56 - i * 8);
+    }
+    bootloader_sha256_data(ctx, len_be, sizeof(len_be));
+    for(int i = 0; i < 8; ++i)
+    {
+        digest[i * 4 + 0] = ctx->state[i] >> 24;
+        digest[i * 4 + 1] = ctx->state[i] >> 16;
+        digest[i * 4 + 2] = ctx->state[i] >> 8;
+        digest[i * 4 + 3] = ctx->state[i];
+    }
+}
+
+// ----
+
+void host_reset(void)
+{
+    memset(host_flash, 0xFF, sizeof(host_flash));
+    esp_partition_info_t *partitions = (esp_partition_info_t*)&host_flash[ESP_PARTITION_TABLE_OFFSET];
+    host_partition_add(&partitions[0], PART_TYPE_DATA, 0x02, 0x9000, 0x4000, "nvs");
+    host_partition_add(&partitions[1], PART_TYPE_DATA, PART_SUBTYPE_DATA_OTA, HOST_OTADATA_OFFSET, HOST_OTADATA_SIZE, "otadata");
+    host_partition_add(&partitions[2], PART_TYPE_APP, PART_SUBTYPE_OTA_FLAG | 0, HOST_OTA0_OFFSET, HOST_OTA_SIZE, "ota_0");
+    host_partition_add(&partitions[3], PART_TYPE_APP, PART_SUBTYPE_OTA_FLAG | 1, HOST_OTA1_OFFSET, HOST_OTA_SIZE, "ota_1");
+    host_partition_add(&partitions[4], PART_TYPE_DATA, 0x81, HOST_STORAGE_OFFSET, HOST_STORAGE_SIZE, "storage");
+    host_partition_add(&partitions[5], PART_TYPE_DATA, 0x82, HOST_CONFIG_OFFSET, HOST_CONFIG_SIZE, "config");
+    memset(host_regs, 0, sizeof(host_regs));
+    memset(&host_spi1, 0, sizeof(host_spi1));
+    memset(&host_rtc_retain_mem, 0, sizeof(host_rtc_retain_mem));
+    host_rtc_commits = 0;
+    host_flash_unguard();
+    host_flash_erases = 0;
+    host_flash_writes = 0;
+    host_flash_write_cycles = 0;
+    host_ccount = 0;
+    host_gpio_in = host_gpio_in_idle;
+    host_verbose = (getenv("HOST_VERBOSE") != NULL);
+}
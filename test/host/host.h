@@ -0,0 +1,83 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Emulation of the ESP32 bootloader environment for running bo_dfu on a host (see stubs/host_idf.h for the declarations).
+ * Flash is a RAM array holding a fixed partition table, the cycle counter advances by host_ccount_step on every read, and the
+ * USB lines read back whatever host_gpio_in returns.
+*/
+
+#define HOST_FLASH_SIZE         (4 * 1024 * 1024)
+#define HOST_SECTOR_SIZE        0x1000
+
+#define HOST_OTADATA_OFFSET     0xD000
+#define HOST_OTADATA_SIZE       0x2000
+#define HOST_OTA0_OFFSET        0x10000
+#define HOST_OTA1_OFFSET        0x110000
+#define HOST_OTA_SIZE           0x100000
+#define HOST_STORAGE_OFFSET     0x210000
+#define HOST_STORAGE_SIZE       0x10000
+#define HOST_CONFIG_OFFSET      0x220000
+#define HOST_CONFIG_SIZE        0x8000
+
+extern uint8_t host_flash[HOST_FLASH_SIZE];
+
+extern uint32_t host_ccount;
+extern uint32_t host_ccount_step;
+
+// Raw GPIO_IN_REG value. By default, the idle (J) state of the USB lines.
+extern uint32_t (*host_gpio_in)(void);
+uint32_t host_gpio_in_idle(void);
+
+// Number of status reads for which a sector erase begun via SPI1 (CONFIG_BO_DFU_BACKGROUND_FLASH) remains in progress.
+extern uint32_t host_flash_erase_polls;
+
+// Cycles by which each bootloader_flash_write advances the cycle counter, as the page program it waits for. 0 after host_reset.
+extern uint32_t host_flash_write_cycles;
+
+// Counts of flash operations since host_reset.
+extern uint32_t host_flash_erases;
+extern uint32_t host_flash_writes;
+
+// Calls to bootloader_common_update_rtc_retain_mem since host_reset.
+extern uint32_t host_rtc_commits;
+
+// Erases flash, writes the partition table (nvs, otadata, ota_0, ota_1, storage, config) and clears all other state.
+void host_reset(void);
+
+/**
+ * Restricts flash writes and erases to the regions given, aborting on any other. Regions accumulate until host_flash_unguard.
+ * Until the first call, any address within the flash is allowed.
+*/
+void host_flash_guard(uint32_t offset, uint32_t size);
+void host_flash_unguard(void);
+
+// Marks OTA data as selecting ota_<slot> with the given sequence number (or erases it if seq is 0).
+void host_otadata_set(uint32_t seq);
+
+// Writes an OTA data entry with the given sequence number and state, replacing only the one in the same sector.
+void host_otadata_add(uint32_t seq, uint32_t state);
+
+// The sequence number of the active OTA data entry, or 0 if there is none.
+uint32_t host_otadata_seq(void);
+
+/**
+ * Fills image (of image_len bytes) with an app image which passes the emulated esp_image_verify: a header with a single segment,
+ * the segment header, the app description (with app_elf_sha256 derived from seed), pseudorandom data, then a CRC32 of it all.
+*/
+void host_image_build(uint8_t *image, size_t image_len, uint32_t seed);
+
+// Prints a message and aborts. For broken invariants, so that a fuzzer records the input.
+void host_fail(const char *format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+// Fails with the file, line and expression if x is false.
+#define CHECK(x) do { if(!(x)) host_fail("%s:%d: %s", __FILE__, __LINE__, #x); } while(0)
+
+// Logs from the library are printed if HOST_VERBOSE is set in the environment.
+extern bool host_verbose;
+
+#endif /* HOST_H */
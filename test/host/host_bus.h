@@ -0,0 +1,100 @@
+#ifndef HOST_BUS_H
+#define HOST_BUS_H
+
+/**
+ * A simulated low-speed bus: packets are NRZI encoded and bit stuffed here, then presented on the GPIO input register with cycle
+ * timing once host_gpio_in is host_bus_gpio_in, for bo_dfu_usb_rx_next_packet to sample as it would on the device.
+ * One packet (or sequence of them, with idle between) is on the bus at a time, beginning at s_host_bus.start.
+*/
+
+#include "host.h"
+
+#include "bo_dfu_util.h"
+#include "bo_dfu_gpio.h"
+#include "bo_dfu_time.h"
+
+#define HOST_BUS_MAX_BITS 256
+
+// Shorter than the majority vote's sample spacing, less the time between reads of the host's cycle counter.
+#define HOST_BUS_GLITCH_CYCLES 15
+
+static struct {
+    uint32_t start;                     // ccount at which the first bit begins
+    uint32_t len;
+    uint32_t bits[HOST_BUS_MAX_BITS];   // Line state of each bit (J, K, SE0 or SE1), as raw GPIO_IN values
+    uint32_t glitch_start;              // Cycles from start
+    uint32_t glitch_mask;               // Lines inverted for HOST_BUS_GLITCH_CYCLES from glitch_start
+} s_host_bus;
+
+static uint32_t host_bus_gpio_in(void)
+{
+    const uint32_t t = host_ccount - s_host_bus.start;
+    // Idle before and after the packet, wrapping as the cycle count does.
+    if(t >= 0x80000000u || t / BO_DFU_USB_CPU_CYCLES_PER_BIT >= s_host_bus.len)
+    {
+        return BO_DFU_BUS_J;
+    }
+    const uint32_t glitch = (t - s_host_bus.glitch_start < HOST_BUS_GLITCH_CYCLES) ? s_host_bus.glitch_mask : 0;
+    return s_host_bus.bits[t / BO_DFU_USB_CPU_CYCLES_PER_BIT] ^ glitch;
+}
+
+// The ccount just after the end of the bus' packet.
+static uint32_t host_bus_end(void)
+{
+    return s_host_bus.start + s_host_bus.len * BO_DFU_USB_CPU_CYCLES_PER_BIT;
+}
+
+static void host_bus_bit(uint32_t bus)
+{
+    if(s_host_bus.len >= HOST_BUS_MAX_BITS)
+    {
+        host_fail("bus overflow");
+    }
+    s_host_bus.bits[s_host_bus.len++] = bus;
+}
+
+// NRZI encodes and bit stuffs bytes onto the bus, beginning from idle (J). The sync byte is the caller's.
+static void host_bus_encode(const uint8_t *bytes, size_t len)
+{
+    uint32_t bus = BO_DFU_BUS_J;
+    int ones = 0;
+    for(size_t i = 0; i < len; ++i)
+    {
+        for(int b = 0; b < 8; ++b)
+        {
+            if(bytes[i] & (1 << b))
+            {
+                host_bus_bit(bus);
+                if(++ones == 6)
+                {
+                    bus ^= BO_DFU_BUS_J ^ BO_DFU_BUS_K;
+                    host_bus_bit(bus);
+                    ones = 0;
+                }
+            }
+            else
+            {
+                bus ^= BO_DFU_BUS_J ^ BO_DFU_BUS_K;
+                host_bus_bit(bus);
+                ones = 0;
+            }
+        }
+    }
+}
+
+static void host_bus_eop(void)
+{
+    host_bus_bit(BO_DFU_BUS_SE0);
+    host_bus_bit(BO_DFU_BUS_SE0);
+    host_bus_bit(BO_DFU_BUS_J);
+}
+
+static void host_bus_idle(uint32_t bits)
+{
+    for(uint32_t i = 0; i < bits; ++i)
+    {
+        host_bus_bit(BO_DFU_BUS_J);
+    }
+}
+
+#endif /* HOST_BUS_H */
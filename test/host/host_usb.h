@@ -0,0 +1,482 @@
+#ifndef HOST_USB_H
+#define HOST_USB_H
+
+/**
+ * A USB host for driving bo_dfu at the packet level, in place of the bit-banged bus. Include this instead of bo_dfu.h.
+ * Received packets come from a queue filled here, and transmitted ones are recorded rather than clocked out, so that the
+ * transaction and DFU layers run unmodified while the sampling and encoding of bits (bo_dfu_rx.h, bo_dfu_tx.h) are bypassed.
+ * With host_usb_use_bus, queued packets are instead clocked onto the simulated bus (host_bus.h) for the receiver to sample, and
+ * transmitted ones take their time on the bus, so that the whole receive path (including any injected faults) is exercised.
+ * As a host controller would, each transaction is attempted up to three times before the transfer fails; the repeats are
+ * counted in host_usb_retries.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+#include "host_bus.h"
+
+#include "bo_dfu_usb.h"
+#include "bo_dfu_util.h"
+#include "bo_dfu_crc.h"
+#include "bo_dfu_tx.h"
+#include "bo_dfu_rx.h"
+
+static int host_usb_rx_next_packet(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet, int token_address);
+static uint32_t host_usb_tx_data(uint8_t pid_with_check, const uint8_t *data, size_t data_len);
+static void host_usb_tx_handshake(uint8_t pid_with_check);
+
+#define bo_dfu_usb_rx_next_packet host_usb_rx_next_packet
+#define bo_dfu_usb_tx_data host_usb_tx_data
+#define bo_dfu_usb_tx_handshake host_usb_tx_handshake
+#include "bo_dfu.h"
+#undef bo_dfu_usb_rx_next_packet
+#undef bo_dfu_usb_tx_data
+#undef bo_dfu_usb_tx_handshake
+
+#define HOST_USB_QUEUE_MAX 8
+#define HOST_USB_TX_MAX 8
+#define HOST_USB_ATTEMPTS 3
+
+typedef struct {
+    uint8_t pid;
+    uint8_t len;
+    uint8_t data[BO_DFU_USB_LOW_SPEED_PACKET_SIZE];
+} host_usb_tx_t;
+
+static struct {
+    struct {
+        uint8_t buffer[sizeof(((bo_dfu_usb_rx_packet_t*)0)->buffer)];
+        int len;    // Or a bo_dfu_bus_state_t to return in place of a packet
+        bool reply; // Only sent if the device has sent a data packet, as the host's handshake to it
+    } queue[HOST_USB_QUEUE_MAX];
+    uint32_t head;
+    uint32_t count;
+    host_usb_tx_t tx[HOST_USB_TX_MAX];
+    uint32_t tx_count;
+    uint8_t address;
+    bool bus;
+    uint32_t prng;
+} s_host_usb;
+
+// Transactions repeated after an error, since host_usb_reset.
+static uint32_t host_usb_retries;
+
+static uint32_t host_usb_se0(void)
+{
+    return 0;
+}
+
+static uint32_t host_usb_random(void)
+{
+    uint32_t x = s_host_usb.prng ? s_host_usb.prng : 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return s_host_usb.prng = x;
+}
+
+static bool host_usb_is_data(uint8_t pid_with_check)
+{
+    return pid_with_check == BO_DFU_USB_PID_CHECK_DATA0 || pid_with_check == BO_DFU_USB_PID_CHECK_DATA1;
+}
+
+// Clocks the packet onto the simulated bus, a few bit times after the device begins waiting for it, and receives it.
+static int host_usb_rx_bus(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet, int token_address, const uint8_t *bytes, int len)
+{
+    s_host_bus.len = 0;
+    s_host_bus.glitch_mask = 0;
+    s_host_bus.start = host_ccount + (2 + host_usb_random() % 4) * BO_DFU_USB_CPU_CYCLES_PER_BIT + host_usb_random() % BO_DFU_USB_CPU_CYCLES_PER_BIT;
+    host_bus_encode(bytes, len);
+    host_bus_eop();
+    const int result = bo_dfu_usb_rx_next_packet(bit_time, packet, token_address);
+    // Whatever the receiver made of it, the packet ends before the next one begins.
+    if((int32_t)(host_bus_end() - host_ccount) > 0)
+    {
+        host_ccount = host_bus_end();
+    }
+    return result;
+}
+
+static int host_usb_rx_next_packet(uint32_t *bit_time, bo_dfu_usb_rx_packet_t *packet, int token_address)
+{
+    if(host_gpio_in == host_usb_se0)
+    {
+        return BO_DFU_BUS_RESET;
+    }
+    if(s_host_usb.count == 0)
+    {
+        // As the timeout while waiting for a packet
+        return BO_DFU_BUS_SYNCED;
+    }
+    const uint32_t i = s_host_usb.head;
+    s_host_usb.head = (s_host_usb.head + 1) % HOST_USB_QUEUE_MAX;
+    --s_host_usb.count;
+    if(s_host_usb.queue[i].reply && !(s_host_usb.tx_count > 0 && host_usb_is_data(s_host_usb.tx[s_host_usb.tx_count - 1].pid)))
+    {
+        // Nothing to reply to, so the device times out.
+        return BO_DFU_BUS_SYNCED;
+    }
+    const int len = s_host_usb.queue[i].len;
+    if(s_host_usb.bus && len > 0)
+    {
+        return host_usb_rx_bus(bit_time, packet, token_address, s_host_usb.queue[i].buffer, len);
+    }
+    if(len > 0)
+    {
+        memcpy(packet->buffer, s_host_usb.queue[i].buffer, len);
+    }
+    *bit_time = bo_dfu_ccount();
+    return len;
+}
+
+static uint32_t host_usb_tx_data(uint8_t pid_with_check, const uint8_t *data, size_t data_len)
+{
+    if(data_len > BO_DFU_USB_LOW_SPEED_PACKET_SIZE)
+    {
+        host_fail("transmitted %zu bytes", data_len);
+    }
+    if(s_host_usb.tx_count < HOST_USB_TX_MAX)
+    {
+        host_usb_tx_t *tx = &s_host_usb.tx[s_host_usb.tx_count++];
+        tx->pid = pid_with_check;
+        tx->len = data_len;
+        if(data_len > 0)
+        {
+            memcpy(tx->data, data, data_len);
+        }
+    }
+    if(s_host_usb.bus)
+    {
+        // Sync, PID, any data and CRC, and EOP, without stuffing.
+        host_ccount += ((2 + data_len + (host_usb_is_data(pid_with_check) ? 2 : 0)) * 8 + 3) * BO_DFU_USB_CPU_CYCLES_PER_BIT;
+    }
+    return bo_dfu_ccount();
+}
+
+static void host_usb_tx_handshake(uint8_t pid_with_check)
+{
+    // As bo_dfu_usb_tx_handshake, which this replaces.
+    if(pid_with_check == BO_DFU_USB_PID_CHECK_ACK && BO_DFU_FAULT(drop_ack))
+    {
+        return;
+    }
+    host_usb_tx_data(pid_with_check, NULL, 0);
+}
+
+// Queues a packet as received: sync, PID, then len bytes of payload (eg. a token, or data with its CRC).
+static void host_usb_queue_raw(uint8_t pid_with_check, const uint8_t *payload, size_t len)
+{
+    if(s_host_usb.count >= HOST_USB_QUEUE_MAX || len + 2 > sizeof(s_host_usb.queue[0].buffer))
+    {
+        host_fail("packet queue overflow");
+    }
+    const uint32_t i = (s_host_usb.head + s_host_usb.count++) % HOST_USB_QUEUE_MAX;
+    s_host_usb.queue[i].buffer[0] = BO_DFU_USB_SYNC_BYTE;
+    s_host_usb.queue[i].buffer[1] = pid_with_check;
+    if(len > 0)
+    {
+        memcpy(&s_host_usb.queue[i].buffer[2], payload, len);
+    }
+    s_host_usb.queue[i].len = 2 + len;
+    s_host_usb.queue[i].reply = false;
+}
+
+static void host_usb_queue_token(uint8_t pid_with_check)
+{
+    const uint16_t token = (s_host_usb.address & 0x7F);
+    const uint16_t token_with_crc = token | (bo_dfu_crc_token(token) << 11);
+    const uint8_t bytes[2] = { token_with_crc & 0xFF, token_with_crc >> 8 };
+    host_usb_queue_raw(pid_with_check, bytes, sizeof(bytes));
+}
+
+static void host_usb_queue_data(uint8_t pid_with_check, const void *data, size_t len)
+{
+    uint8_t bytes[BO_DFU_USB_LOW_SPEED_PACKET_SIZE + 2];
+    if(len > 0)
+    {
+        memcpy(bytes, data, len);
+    }
+    const uint16_t crc = bo_dfu_crc_data(data, len);
+    bytes[len] = crc & 0xFF;
+    bytes[len + 1] = crc >> 8;
+    host_usb_queue_raw(pid_with_check, bytes, len + 2);
+}
+
+static void host_usb_queue_handshake(uint8_t pid_with_check)
+{
+    host_usb_queue_raw(pid_with_check, NULL, 0);
+}
+
+// Queues an ACK which is only sent if the device responds with data, as the host's reply to it.
+static void host_usb_queue_reply_ack(void)
+{
+    host_usb_queue_handshake(BO_DFU_USB_PID_CHECK_ACK);
+    s_host_usb.queue[(s_host_usb.head + s_host_usb.count - 1) % HOST_USB_QUEUE_MAX].reply = true;
+}
+
+// Runs bo_dfu_fsm until the queued packets are consumed, then returns the number of packets the device sent.
+static uint32_t host_usb_run(bo_dfu_t *dfu)
+{
+    s_host_usb.tx_count = 0;
+    for(int i = 0; s_host_usb.count > 0; ++i)
+    {
+        if(i > HOST_USB_QUEUE_MAX * 2)
+        {
+            host_fail("packets not consumed");
+        }
+        bo_dfu_fsm(dfu);
+    }
+    return s_host_usb.tx_count;
+}
+
+static bool host_usb_sent(uint32_t index, uint8_t pid_with_check)
+{
+    return index < s_host_usb.tx_count && s_host_usb.tx[index].pid == pid_with_check;
+}
+
+// Empties the packet queues and returns the bus to idle, for a new device.
+static void host_usb_reset(void)
+{
+    memset(&s_host_usb, 0, sizeof(s_host_usb));
+    host_usb_retries = 0;
+    host_gpio_in = host_gpio_in_idle;
+}
+
+// Clocks packets through the simulated bus from now on, until host_usb_reset.
+static void host_usb_use_bus(void)
+{
+    s_host_usb.bus = true;
+    s_host_bus.len = 0;
+    host_gpio_in = host_bus_gpio_in;
+}
+
+// Signals a bus reset (SE0) for long enough to be seen by bo_dfu_fsm, then returns the bus to idle.
+static void host_usb_bus_reset(bo_dfu_t *dfu)
+{
+    host_gpio_in = host_usb_se0;
+    bo_dfu_fsm(dfu);
+    host_gpio_in = s_host_usb.bus ? host_bus_gpio_in : host_gpio_in_idle;
+    bo_dfu_fsm(dfu);
+    s_host_usb.address = 0;
+    s_host_usb.count = 0;
+}
+
+typedef enum {
+    HOST_USB_DONE,
+    HOST_USB_ERROR,     // No valid response, or data with the other toggle (which is acknowledged but discarded)
+    HOST_USB_STALLED,
+} host_usb_result_t;
+
+/**
+ * One transaction, repeated after an error up to HOST_USB_ATTEMPTS times in all. For SETUP or OUT, sends len bytes of data with
+ * data_pid; for IN, expects data with data_pid, left in s_host_usb.tx[0]. Returns false if it stalled or every attempt failed.
+*/
+static bool host_usb_transaction(bo_dfu_t *dfu, uint8_t token_pid, uint8_t data_pid, const void *data, size_t len)
+{
+    for(int attempt = 0; attempt < HOST_USB_ATTEMPTS; ++attempt)
+    {
+        host_usb_queue_token(token_pid);
+        if(token_pid == BO_DFU_USB_PID_CHECK_IN)
+        {
+            host_usb_queue_reply_ack();
+        }
+        else
+        {
+            host_usb_queue_data(data_pid, data, len);
+        }
+        const uint32_t sent = host_usb_run(dfu);
+        host_usb_result_t result = HOST_USB_ERROR;
+        if(sent == 1 && s_host_usb.tx[0].pid == BO_DFU_USB_PID_CHECK_STALL)
+        {
+            result = HOST_USB_STALLED;
+        }
+        else if(sent == 1 && s_host_usb.tx[0].pid == ((token_pid == BO_DFU_USB_PID_CHECK_IN) ? data_pid : BO_DFU_USB_PID_CHECK_ACK))
+        {
+            result = HOST_USB_DONE;
+        }
+        if(result != HOST_USB_ERROR)
+        {
+            return result == HOST_USB_DONE;
+        }
+        ++host_usb_retries;
+    }
+    return false;
+}
+
+/**
+ * Performs a control transfer: SETUP, any data stage (from or into data, by the direction in bmRequestType) and the status
+ * stage. Returns the length of the data stage, or -1 if the device stalled or failed to respond at any point.
+*/
+static int host_usb_control(bo_dfu_t *dfu, uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, uint16_t wLength, void *data)
+{
+    const uint8_t setup[8] = { bmRequestType, bRequest, wValue & 0xFF, wValue >> 8, wIndex & 0xFF, wIndex >> 8, wLength & 0xFF, wLength >> 8 };
+    if(!host_usb_transaction(dfu, BO_DFU_USB_PID_CHECK_SETUP, BO_DFU_USB_PID_CHECK_DATA0, setup, sizeof(setup)))
+    {
+        return -1;
+    }
+
+    uint8_t *bytes = data;
+    size_t done = 0;
+    uint8_t pid = BO_DFU_USB_PID_CHECK_DATA1;
+    if(bmRequestType & 0x80)
+    {
+        for(;;)
+        {
+            if(!host_usb_transaction(dfu, BO_DFU_USB_PID_CHECK_IN, pid, NULL, 0))
+            {
+                return -1;
+            }
+            const size_t len = MIN(s_host_usb.tx[0].len, wLength - done);
+            memcpy(&bytes[done], s_host_usb.tx[0].data, len);
+            done += len;
+            pid ^= (BO_DFU_USB_PID_CHECK_DATA0 ^ BO_DFU_USB_PID_CHECK_DATA1);
+            if(s_host_usb.tx[0].len < BO_DFU_USB_LOW_SPEED_PACKET_SIZE || done >= wLength)
+            {
+                break;
+            }
+        }
+        if(!host_usb_transaction(dfu, BO_DFU_USB_PID_CHECK_OUT, BO_DFU_USB_PID_CHECK_DATA1, NULL, 0))
+        {
+            return -1;
+        }
+        return done;
+    }
+
+    while(done < wLength)
+    {
+        const size_t len = MIN(BO_DFU_USB_LOW_SPEED_PACKET_SIZE, wLength - done);
+        if(!host_usb_transaction(dfu, BO_DFU_USB_PID_CHECK_OUT, pid, &bytes[done], len))
+        {
+            return -1;
+        }
+        done += len;
+        pid ^= (BO_DFU_USB_PID_CHECK_DATA0 ^ BO_DFU_USB_PID_CHECK_DATA1);
+    }
+    if(!host_usb_transaction(dfu, BO_DFU_USB_PID_CHECK_IN, BO_DFU_USB_PID_CHECK_DATA1, NULL, 0) || s_host_usb.tx[0].len != 0)
+    {
+        return -1;
+    }
+    return done;
+}
+
+// Resets the bus, then assigns an address and sets the configuration, as on enumeration.
+static void host_usb_enumerate(bo_dfu_t *dfu)
+{
+    host_usb_bus_reset(dfu);
+    if(host_usb_control(dfu, 0x00, BO_DFU_USB_BREQUEST_SET_ADDRESS, 1, 0, 0, NULL) != 0)
+    {
+        host_fail("SET_ADDRESS failed");
+    }
+    s_host_usb.address = 1;
+    if(host_usb_control(dfu, 0x00, BO_DFU_USB_BREQUEST_SET_CONFIGURATION, 1, 0, 0, NULL) != 0)
+    {
+        host_fail("SET_CONFIGURATION failed");
+    }
+}
+
+// ---- DFU class requests ----
+
+typedef struct {
+    uint8_t bStatus;
+    uint32_t bwPollTimeout;
+    uint8_t bState;
+    uint8_t iString;
+} host_dfu_status_t;
+
+static int host_dfu_dnload(bo_dfu_t *dfu, uint16_t block, const void *data, uint16_t len)
+{
+    #ifdef CONFIG_BO_DFU_BLOCK_CRC
+        const uint16_t wIndex = (len > 0) ? esp_rom_crc16_le(0, data, len) : 0;
+    #else
+        const uint16_t wIndex = 0;
+    #endif
+    return host_usb_control(dfu, 0x21, BO_DFU_BREQUEST_DNLOAD, block, wIndex, len, (void*)data);
+}
+
+static bool host_dfu_getstatus(bo_dfu_t *dfu, host_dfu_status_t *status)
+{
+    uint8_t response[6];
+    if(host_usb_control(dfu, 0xA1, BO_DFU_BREQUEST_GETSTATUS, 0, 0, sizeof(response), response) != sizeof(response))
+    {
+        return false;
+    }
+    status->bStatus = response[0];
+    status->bwPollTimeout = response[1] | (response[2] << 8) | (response[3] << 16);
+    status->bState = response[4];
+    status->iString = response[5];
+    return true;
+}
+
+static int host_dfu_getstate(bo_dfu_t *dfu)
+{
+    uint8_t state;
+    if(host_usb_control(dfu, 0xA1, BO_DFU_BREQUEST_GETSTATE, 0, 0, sizeof(state), &state) != sizeof(state))
+    {
+        return -1;
+    }
+    return state;
+}
+
+static bool host_dfu_abort(bo_dfu_t *dfu)
+{
+    return host_usb_control(dfu, 0x21, BO_DFU_BREQUEST_ABORT, 0, 0, 0, NULL) == 0;
+}
+
+static bool host_dfu_clrstatus(bo_dfu_t *dfu)
+{
+    return host_usb_control(dfu, 0x21, BO_DFU_BREQUEST_CLRSTATUS, 0, 0, 0, NULL) == 0;
+}
+
+// Polls GETSTATUS until the device leaves the busy states, as a host would. Returns the final status, or false if it didn't respond.
+static bool host_dfu_wait(bo_dfu_t *dfu, host_dfu_status_t *status)
+{
+    for(int i = 0; i < 1000; ++i)
+    {
+        if(!host_dfu_getstatus(dfu, status))
+        {
+            return false;
+        }
+        if(
+            status->bState != BO_DFU_STATE_PROTOCOL_dfuDNLOAD_SYNC &&
+            status->bState != BO_DFU_STATE_PROTOCOL_dfuDNBUSY &&
+            status->bState != BO_DFU_STATE_PROTOCOL_dfuMANIFEST_SYNC &&
+            status->bState != BO_DFU_STATE_PROTOCOL_dfuMANIFEST
+        )
+        {
+            return true;
+        }
+    }
+    host_fail("device busy");
+}
+
+/**
+ * Downloads image in blocks of block_size, then the zero-length block and manifestation, as dfu-util does. Returns the final
+ * status (bStatus OK and bState appIDLE on success, or dfuIDLE for a data partition).
+*/
+static host_dfu_status_t host_dfu_download(bo_dfu_t *dfu, const uint8_t *image, size_t image_len, size_t block_size)
+{
+    host_dfu_status_t status = { .bStatus = BO_DFU_STATUS_errUNKNOWN };
+    uint16_t block = 0;
+    for(size_t offset = 0; offset < image_len; offset += block_size, ++block)
+    {
+        const size_t len = MIN(block_size, image_len - offset);
+        if(host_dfu_dnload(dfu, block, &image[offset], len) != (int)len || !host_dfu_wait(dfu, &status))
+        {
+            status.bStatus = BO_DFU_STATUS_errSTALLEDPKT;
+            return status;
+        }
+        if(status.bStatus != BO_DFU_STATUS_OK)
+        {
+            return status;
+        }
+    }
+    if(host_dfu_dnload(dfu, block, NULL, 0) != 0 || !host_dfu_wait(dfu, &status))
+    {
+        status.bStatus = BO_DFU_STATUS_errSTALLEDPKT;
+    }
+    return status;
+}
+
+#endif /* HOST_USB_H */
@@ -0,0 +1,266 @@
+#ifndef HOST_IDF_H
+#define HOST_IDF_H
+
+/**
+ * Stand-ins for the parts of ESP-IDF (bootloader_support, hal, soc, esp_rom) used by bo_dfu, for building it on a host.
+ * Only declarations live here; the behaviour (flash, partition table, registers, cycle counter) is emulated in host.c.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/param.h>
+#include "sdkconfig.h"
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_IMAGE_INVALID 0x2002
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define FORCE_INLINE_ATTR static inline __attribute__((always_inline))
+#define BIT(n) (1u << (n))
+
+/**
+ * The library's asm("error") statements are assertions which fail the build if the compiler can't prove them unreachable. On the
+ * host, where the proof often depends on the address of a bo_dfu_t that isn't known, they abort at runtime instead.
+*/
+void host_asm_fail(const char *what) __attribute__((noreturn));
+#define asm(x) host_asm_fail(x)
+#define ESP_LOGE(tag, fmt, ...) esp_rom_printf(fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) esp_rom_printf(fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) esp_rom_printf(fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) esp_rom_printf(fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) esp_rom_printf(fmt, ##__VA_ARGS__)
+#define ESP_EARLY_LOGI ESP_LOGI
+#define LOG_LOCAL_LEVEL 3
+#define LOG_COLOR_E ""
+#define LOG_COLOR_W ""
+#define LOG_COLOR_I ""
+#define LOG_COLOR_D ""
+#define LOG_COLOR_V ""
+#define LOG_RESET_COLOR ""
+#define LOG_FORMAT(letter, format)  LOG_COLOR_ ## letter #letter " (%u) %s: " format LOG_RESET_COLOR "\n"
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+uint32_t esp_log_timestamp(void);
+uint32_t esp_log_early_timestamp(void);
+int esp_rom_printf(const char *fmt, ...);
+void esp_rom_delay_us(uint32_t us);
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+uint16_t esp_rom_crc16_le(uint16_t crc, const uint8_t *buf, uint32_t len);
+void esp_rom_uart_tx_wait_idle(int);
+void esp_rom_gpio_pad_select_gpio(int);
+void gpio_pad_pulldown(int); void gpio_pad_pullup(int);
+void gpio_output_set(uint32_t, uint32_t, uint32_t, uint32_t);
+void gpio_output_set_high(uint32_t, uint32_t, uint32_t, uint32_t);
+// Registers are small indices into an emulated register file (see host.c).
+uint32_t host_reg_read(uint32_t reg);
+void host_reg_write(uint32_t reg, uint32_t value);
+#define REG_READ(r) host_reg_read(r)
+#define REG_WRITE(r, v) host_reg_write((r), (v))
+#define REG_SET_BIT(r, b) host_reg_write((r), host_reg_read(r) | (b))
+#define REG_CLR_BIT(r, b) host_reg_write((r), host_reg_read(r) & ~(b))
+#define REG_GET_BIT(r, b) (host_reg_read(r) & (b))
+#define GPIO_IN_REG 1
+#define GPIO_IN1_REG 2
+#define GPIO_OUT_REG 3
+#define GPIO_OUT1_REG 4
+#define GPIO_ENABLE_W1TS_REG 5
+#define GPIO_ENABLE_W1TC_REG 6
+#define GPIO_ENABLE1_W1TS_REG 7
+#define GPIO_ENABLE1_W1TC_REG 8
+#define GPIO_OUT_W1TS_REG 9
+#define GPIO_OUT_W1TC_REG 10
+#define GPIO_OUT1_W1TS_REG 11
+#define GPIO_OUT1_W1TC_REG 12
+// Memory mapped, so read through a pointer rather than REG_READ.
+extern uint32_t host_efuse_blk0[8];
+#define EFUSE_BLK0_RDATA1_REG ((uintptr_t)&host_efuse_blk0[1])
+#define SOC_GPIO_PIN_COUNT 40
+#define RTC_IO_TOUCH_PAD0_REG 20
+#define RTC_IO_TOUCH_PAD1_REG 21
+#define RTC_IO_TOUCH_PAD2_REG 22
+#define RTC_IO_TOUCH_PAD3_REG 23
+#define RTC_IO_TOUCH_PAD4_REG 24
+#define RTC_IO_TOUCH_PAD5_REG 25
+#define RTC_IO_TOUCH_PAD6_REG 26
+#define RTC_IO_TOUCH_PAD7_REG 27
+#define RTC_IO_PAD_DAC1_REG 28
+#define RTC_IO_PAD_DAC2_REG 29
+#define RTC_IO_XTAL_32K_PAD_REG 30
+#define RTC_IO_ADC_PAD_REG 31
+#define RTC_IO_SENSOR_PADS_REG 32
+#define RTC_IO_TOUCH_PAD0_RUE_M 1
+#define RTC_IO_TOUCH_PAD0_RDE_M 2
+#define RTC_IO_TOUCH_PAD1_RUE_M 1
+#define RTC_IO_TOUCH_PAD1_RDE_M 2
+#define RTC_IO_TOUCH_PAD2_RUE_M 1
+#define RTC_IO_TOUCH_PAD2_RDE_M 2
+#define RTC_IO_TOUCH_PAD3_RUE_M 1
+#define RTC_IO_TOUCH_PAD3_RDE_M 2
+#define RTC_IO_TOUCH_PAD4_RUE_M 1
+#define RTC_IO_TOUCH_PAD4_RDE_M 2
+#define RTC_IO_TOUCH_PAD5_RUE_M 1
+#define RTC_IO_TOUCH_PAD5_RDE_M 2
+#define RTC_IO_TOUCH_PAD6_RUE_M 1
+#define RTC_IO_TOUCH_PAD6_RDE_M 2
+#define RTC_IO_TOUCH_PAD7_RUE_M 1
+#define RTC_IO_TOUCH_PAD7_RDE_M 2
+#define RTC_IO_PDAC1_RUE_M 1
+#define RTC_IO_PDAC1_RDE_M 2
+#define RTC_IO_PDAC2_RUE_M 1
+#define RTC_IO_PDAC2_RDE_M 2
+#define RTC_IO_X32P_RUE_M 1
+#define RTC_IO_X32P_RDE_M 2
+#define RTC_IO_X32N_RUE_M 1
+#define RTC_IO_X32N_RDE_M 2
+#define IO_MUX_GPIO0_REG 40
+#define IO_MUX_GPIO1_REG 40
+#define IO_MUX_GPIO2_REG 40
+#define IO_MUX_GPIO3_REG 40
+#define IO_MUX_GPIO4_REG 40
+#define IO_MUX_GPIO5_REG 40
+#define IO_MUX_GPIO6_REG 40
+#define IO_MUX_GPIO7_REG 40
+#define IO_MUX_GPIO8_REG 40
+#define IO_MUX_GPIO9_REG 40
+#define IO_MUX_GPIO10_REG 40
+#define IO_MUX_GPIO11_REG 40
+#define IO_MUX_GPIO12_REG 40
+#define IO_MUX_GPIO13_REG 40
+#define IO_MUX_GPIO14_REG 40
+#define IO_MUX_GPIO15_REG 40
+#define IO_MUX_GPIO16_REG 40
+#define IO_MUX_GPIO17_REG 40
+#define IO_MUX_GPIO18_REG 40
+#define IO_MUX_GPIO19_REG 40
+#define IO_MUX_GPIO20_REG 40
+#define IO_MUX_GPIO21_REG 40
+#define IO_MUX_GPIO22_REG 40
+#define IO_MUX_GPIO23_REG 40
+#define IO_MUX_GPIO25_REG 40
+#define IO_MUX_GPIO26_REG 40
+#define IO_MUX_GPIO27_REG 40
+#define IO_MUX_GPIO32_REG 40
+#define IO_MUX_GPIO33_REG 40
+#define IO_MUX_GPIO34_REG 40
+#define IO_MUX_GPIO35_REG 40
+#define IO_MUX_GPIO36_REG 40
+#define IO_MUX_GPIO37_REG 40
+#define IO_MUX_GPIO38_REG 40
+#define IO_MUX_GPIO39_REG 40
+#define FUN_PU 1
+#define FUN_PD 2
+extern const uint32_t GPIO_PIN_MUX_REG[40];
+#define PIN_INPUT_ENABLE(r) REG_SET_BIT(r, 4)
+typedef struct { int dummy; } gpio_dev_t;
+extern gpio_dev_t GPIO;
+int gpio_ll_get_level(gpio_dev_t*, int);
+void gpio_ll_output_enable(gpio_dev_t*, int);
+void gpio_ll_output_disable(gpio_dev_t*, int);
+typedef struct { struct { uint32_t val; } wdt_feed; } rtc_cntl_dev_t;
+extern rtc_cntl_dev_t RTCCNTL;
+#define RTC_CNTL_WDT_FEED_S 31
+void rwdt_ll_write_protect_disable(rtc_cntl_dev_t*);
+void rwdt_ll_write_protect_enable(rtc_cntl_dev_t*);
+void rwdt_ll_feed(rtc_cntl_dev_t*);
+typedef struct { int cpu_freq_mhz; } rtc_clk_config_t;
+#define RTC_CLK_CONFIG_DEFAULT() ((rtc_clk_config_t){0})
+void rtc_clk_init(rtc_clk_config_t);
+uint32_t efuse_hal_get_rated_freq_mhz(void);
+uint32_t efuse_hal_get_major_chip_version(void);
+uint32_t efuse_hal_get_minor_chip_version(void);
+uint32_t esp_cpu_get_cycle_count(void);
+typedef enum { RESET_REASON_CHIP_POWER_ON = 1, RESET_REASON_CORE_SW = 3, RESET_REASON_CORE_DEEP_SLEEP = 5, RESET_REASON_SYS_BROWN_OUT = 15, RESET_REASON_SYS_RTC_WDT = 16, RESET_REASON_CPU0_SW = 12 } soc_reset_reason_t;
+soc_reset_reason_t esp_rom_get_reset_reason(int);
+uint32_t esp_rom_get_cpu_ticks_per_us(void);
+typedef struct { uint32_t offset; uint32_t size; } esp_partition_pos_t;
+typedef struct { uint32_t ota_seq; uint8_t seq_label[20]; uint32_t ota_state; uint32_t crc; } esp_ota_select_entry_t;
+#define ESP_OTA_IMG_VALID 2
+#define ESP_OTA_IMG_INVALID 3
+#define ESP_OTA_IMG_ABORTED 4
+#define ESP_OTA_IMG_NEW 0
+#define ESP_OTA_IMG_PENDING_VERIFY 1
+#define ESP_OTA_IMG_UNDEFINED 0xFFFFFFFF
+#define MAX_OTA_SLOTS 16
+typedef struct {
+    esp_partition_pos_t ota_info;
+    esp_partition_pos_t factory;
+    esp_partition_pos_t test;
+    esp_partition_pos_t ota[MAX_OTA_SLOTS];
+    uint32_t app_count;
+    uint32_t selected_subtype;
+} bootloader_state_t;
+bool bootloader_utility_load_partition_table(bootloader_state_t *bs);
+bool bootloader_common_ota_select_invalid(const esp_ota_select_entry_t *s);
+bool bootloader_common_ota_select_valid(const esp_ota_select_entry_t *s);
+int bootloader_common_get_active_otadata(esp_ota_select_entry_t *two_otadata);
+uint32_t bootloader_common_ota_select_crc(const esp_ota_select_entry_t *s);
+typedef struct __attribute__((packed)) {
+    uint8_t magic; uint8_t segment_count; uint8_t spi_mode; uint8_t spi_speed: 4; uint8_t spi_size: 4;
+    uint32_t entry_addr; uint8_t wp_pin; uint8_t spi_pin_drv[3]; uint16_t chip_id; uint8_t min_chip_rev;
+    uint16_t min_chip_rev_full; uint16_t max_chip_rev_full; uint8_t reserved[4]; uint8_t hash_appended;
+} esp_image_header_t;
+_Static_assert(sizeof(esp_image_header_t) == 24, "");
+typedef struct { uint32_t load_addr; uint32_t data_len; } esp_image_segment_header_t;
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+#define ESP_IMAGE_MAX_SEGMENTS 16
+typedef enum { ESP_IMAGE_BOOTLOADER, ESP_IMAGE_APPLICATION } esp_image_type;
+typedef struct {
+    uint32_t magic_word; uint32_t secure_version; uint32_t reserv1[2];
+    char version[32]; char project_name[32]; char time[16]; char date[16]; char idf_ver[32];
+    uint8_t app_elf_sha256[32]; uint32_t reserv2[20];
+} esp_app_desc_t;
+#define ESP_APP_DESC_MAGIC_WORD 0xABCD5432
+typedef struct {
+    uint32_t start_addr; esp_image_header_t image; esp_image_segment_header_t segments[ESP_IMAGE_MAX_SEGMENTS];
+    uint32_t segment_data[ESP_IMAGE_MAX_SEGMENTS]; uint32_t image_len; uint8_t image_digest[32];
+} esp_image_metadata_t;
+typedef enum { ESP_IMAGE_VERIFY, ESP_IMAGE_VERIFY_SILENT, ESP_IMAGE_LOAD } esp_image_load_mode_t;
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, const esp_partition_pos_t *part, esp_image_metadata_t *data);
+esp_err_t bootloader_load_image_no_verify(const esp_partition_pos_t *part, esp_image_metadata_t *data);
+esp_err_t bootloader_common_check_chip_validity(const esp_image_header_t* img_hdr, esp_image_type type);
+esp_err_t bootloader_flash_read(size_t src_addr, void *dest, size_t size, bool allow_decrypt);
+esp_err_t bootloader_flash_write(size_t dest_addr, void *src, size_t size, bool write_encrypted);
+esp_err_t bootloader_flash_erase_range(uint32_t start_addr, uint32_t size);
+esp_err_t bootloader_flash_erase_sector(size_t sector);
+const void *bootloader_mmap(uint32_t src_addr, uint32_t size);
+void bootloader_munmap(const void *mapping);
+#define ESP_PARTITION_TABLE_OFFSET 0x8000
+#define ESP_PARTITION_TABLE_MAX_LEN 0xC00
+#define ESP_PARTITION_MAGIC 0x50AA
+#define ESP_PARTITION_MAGIC_MD5 0xEBEB
+#define PART_TYPE_APP 0
+#define PART_TYPE_DATA 1
+#define PART_SUBTYPE_FACTORY 0
+#define PART_SUBTYPE_OTA_FLAG 0x10
+#define PART_SUBTYPE_OTA_MASK 0x0f
+#define PART_SUBTYPE_TEST 0x20
+#define PART_SUBTYPE_DATA_OTA 0x00
+#define PART_FLAG_ENCRYPTED (1 << 0)
+typedef struct { uint16_t magic; uint8_t type; uint8_t subtype; esp_partition_pos_t pos; uint8_t label[16]; uint32_t flags; } esp_partition_info_t;
+typedef struct {
+    esp_partition_pos_t partition; uint16_t reboot_counter; uint16_t reserve; uint8_t custom[CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE]; uint32_t crc;
+} rtc_retain_mem_t;
+rtc_retain_mem_t* bootloader_common_get_rtc_retain_mem(void);
+void bootloader_common_update_rtc_retain_mem(esp_partition_pos_t* partition, bool reboot_counter);
+void bootloader_common_reset_rtc_retain_mem(void);
+typedef struct { uint8_t dummy[108]; } bootloader_sha256_ctx;
+typedef void *bootloader_sha256_handle_t;
+bootloader_sha256_handle_t bootloader_sha256_start(void);
+void bootloader_sha256_data(bootloader_sha256_handle_t handle, const void *data, size_t data_len);
+void bootloader_sha256_finish(bootloader_sha256_handle_t handle, uint8_t *digest);
+#define SPI_FLASH_MMU_PAGE_SIZE 0x10000
+#define SPI_CMD_REG(i) (60 + (i))
+#define SPI_ADDR_REG(i) (62 + (i))
+#define SPI_RD_STATUS_REG(i) (64 + (i))
+#define SPI_W0_REG(i) (66 + (i))
+#define SPI_FLASH_RDSR (1u << 27)
+#define SPI_FLASH_WREN (1u << 30)
+#define SPI_FLASH_SE (1u << 24)
+#define SPI_FLASH_PP (1u << 25)
+
+#endif /* HOST_IDF_H */
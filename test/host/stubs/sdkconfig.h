@@ -0,0 +1,35 @@
+#pragma once
+
+// The Kconfig defaults. A test selects other options with a header of its own (see ../config), named by HOST_SDKCONFIG.
+
+#define CONFIG_BO_DFU_GPIO_DN 25
+#define CONFIG_BO_DFU_GPIO_DP 26
+#define CONFIG_BO_DFU_USE_EN 1
+#define CONFIG_BO_DFU_GPIO_EN 27
+#define CONFIG_BO_DFU_MANUFACTURER_NAME "espressif"
+#define CONFIG_BO_DFU_DEVICE_NAME "ESP32"
+#define CONFIG_BO_DFU_INTERFACE_NAME "BO DFU"
+#define CONFIG_BO_DFU_VENDOR_ID 0x303a
+#define CONFIG_BO_DFU_PRODUCT_ID 0x8000
+#define CONFIG_BO_DFU_MAX_POWER_MA 100
+#define CONFIG_BO_DFU_DNLOAD_SYNC_POLL_TIMEOUT_MS 250
+#define CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS 8
+#define CONFIG_BO_DFU_DNLOAD_MANIFEST_POLL_TIMEOUT_MS 1000
+#define CONFIG_BO_DFU_ANY_BLOCK_SIZE 1
+#define CONFIG_BO_DFU_SPARSE_SECTOR_POLL_TIMEOUT_MS 60
+#define CONFIG_BO_DFU_FINGERPRINT_SECTOR_POLL_TIMEOUT_MS 2
+#define CONFIG_BO_DFU_BUNDLE_MAX_ENTRIES 8
+#define CONFIG_BO_DFU_ALT_SETTINGS_MAX 8
+#define CONFIG_BO_DFU_DEFERRED_LOG_RECORDS 32
+#define CONFIG_BO_DFU_TRACE_EVENTS 64
+#define CONFIG_BO_DFU_SCHEDULER_MAX_TASKS 4
+#define CONFIG_BO_DFU_RX_MAJORITY_SPACING_CYCLES 24
+
+#define CONFIG_BOOTLOADER_WDT_ENABLE 1
+#define CONFIG_BOOTLOADER_LOG_LEVEL 3
+#define CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC 1
+#define CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE 0x400
+
+#ifdef HOST_SDKCONFIG
+    #include HOST_SDKCONFIG
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_usb.h"
+
+/**
+ * Bundles: the app and two data partitions in one download, a header naming the same partition twice, and a data payload that
+ * fails verification after it has been written.
+*/
+
+#define APP_LEN (3 * 0x1000 + 0x200)
+#define STORAGE_LEN (2 * 0x1000 + 0x10)
+#define CONFIG_LEN 0x100
+
+#define BUNDLE_APP_OFFSET 0x1000
+#define BUNDLE_STORAGE_OFFSET (BUNDLE_APP_OFFSET + 4 * 0x1000)
+#define BUNDLE_CONFIG_OFFSET (BUNDLE_STORAGE_OFFSET + 3 * 0x1000)
+#define BUNDLE_LEN (BUNDLE_CONFIG_OFFSET + CONFIG_LEN)
+
+static uint8_t s_bundle[BUNDLE_LEN];
+static bo_dfu_t s_dfu;
+
+static void bundle_entry(uint32_t index, const char *label, uint32_t offset, uint32_t length)
+{
+    bo_dfu_bundle_header_t *header = (bo_dfu_bundle_header_t*)s_bundle;
+    bo_dfu_bundle_entry_t *entry = &header->entries[index];
+    memset(entry, 0, sizeof(*entry));
+    strncpy((char*)entry->label, label, sizeof(entry->label));
+    entry->offset = offset;
+    entry->length = length;
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    bootloader_sha256_data(sha, &s_bundle[offset], length);
+    bootloader_sha256_finish(sha, entry->sha256);
+    header->entry_count = MAX(header->entry_count, index + 1);
+}
+
+static void bundle_build(void)
+{
+    memset(s_bundle, 0, sizeof(s_bundle));
+    host_image_build(&s_bundle[BUNDLE_APP_OFFSET], APP_LEN, 1);
+    for(uint32_t i = 0; i < STORAGE_LEN; ++i)
+    {
+        s_bundle[BUNDLE_STORAGE_OFFSET + i] = i * 3;
+    }
+    for(uint32_t i = 0; i < CONFIG_LEN; ++i)
+    {
+        s_bundle[BUNDLE_CONFIG_OFFSET + i] = ~i;
+    }
+    bo_dfu_bundle_header_t *header = (bo_dfu_bundle_header_t*)s_bundle;
+    header->magic = BO_DFU_BUNDLE_MAGIC;
+    header->version = BO_DFU_BUNDLE_VERSION;
+    header->entry_count = 0;
+    bundle_entry(0, "", BUNDLE_APP_OFFSET, APP_LEN);
+    bundle_entry(1, "storage", BUNDLE_STORAGE_OFFSET, STORAGE_LEN);
+    bundle_entry(2, "config", BUNDLE_CONFIG_OFFSET, CONFIG_LEN);
+}
+
+static bo_dfu_t *dfu_start(void)
+{
+    host_reset();
+    // ota_0 is running, so ota_1 is the target.
+    host_otadata_set(1);
+    bo_dfu_t *dfu = &s_dfu;
+    CHECK(bo_dfu_init(dfu) == ESP_OK);
+    host_usb_enumerate(dfu);
+    return dfu;
+}
+
+static void test_bundle(void)
+{
+    bundle_build();
+    bo_dfu_t *dfu = dfu_start();
+    const host_dfu_status_t status = host_dfu_download(dfu, s_bundle, BUNDLE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(dfu));
+    CHECK(memcmp(&host_flash[HOST_OTA1_OFFSET], &s_bundle[BUNDLE_APP_OFFSET], APP_LEN) == 0);
+    CHECK(memcmp(&host_flash[HOST_STORAGE_OFFSET], &s_bundle[BUNDLE_STORAGE_OFFSET], STORAGE_LEN) == 0);
+    CHECK(memcmp(&host_flash[HOST_CONFIG_OFFSET], &s_bundle[BUNDLE_CONFIG_OFFSET], CONFIG_LEN) == 0);
+    CHECK(host_otadata_seq() == 2);
+    bo_dfu_deinit(dfu);
+}
+
+static void test_duplicate(void)
+{
+    bundle_build();
+    // The config payload, but to storage a second time.
+    bundle_entry(2, "storage", BUNDLE_CONFIG_OFFSET, CONFIG_LEN);
+    bo_dfu_t *dfu = dfu_start();
+    host_dfu_status_t status;
+    CHECK(host_dfu_dnload(dfu, 0, s_bundle, 0x1000) == 0x1000);
+    CHECK(host_dfu_wait(dfu, &status));
+    CHECK(status.bStatus == BO_DFU_STATUS_errFILE && status.bState == BO_DFU_STATE_PROTOCOL_dfuERROR);
+    CHECK(host_flash_writes == 0);
+    bo_dfu_deinit(dfu);
+}
+
+static void test_verify_failure(void)
+{
+    bundle_build();
+    // Corrupt the storage payload after its hash was taken.
+    s_bundle[BUNDLE_STORAGE_OFFSET + 0x1000] ^= 1;
+    bo_dfu_t *dfu = dfu_start();
+    const host_dfu_status_t status = host_dfu_download(dfu, s_bundle, BUNDLE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_errVERIFY);
+    CHECK(!BO_DFU_T_IS_COMPLETE(dfu));
+    // The running app stays active, but the bundle isn't atomic: the data partitions were already written.
+    CHECK(host_otadata_seq() == 1);
+    CHECK(memcmp(&host_flash[HOST_STORAGE_OFFSET], &s_bundle[BUNDLE_STORAGE_OFFSET], STORAGE_LEN) == 0);
+    bo_dfu_deinit(dfu);
+}
+
+int main(void)
+{
+    test_bundle();
+    test_duplicate();
+    test_verify_failure();
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_usb.h"
+
+/**
+ * Downloads over the packet-level host: a complete download, and downloads begun after an abandoned one, which must start at
+ * the beginning of the sector buffer however much of the last sector was received.
+*/
+
+#define IMAGE_LEN (3 * 0x1000 + 0x200)
+
+static uint8_t s_image[IMAGE_LEN];
+
+// A global of its own, so that the sanitizer's redzones catch any write beyond the sector buffer.
+static bo_dfu_t s_dfu;
+
+static bo_dfu_t *dfu_start(void)
+{
+    host_reset();
+    bo_dfu_t *dfu = &s_dfu;
+    CHECK(bo_dfu_init(dfu) == ESP_OK);
+    host_usb_enumerate(dfu);
+    return dfu;
+}
+
+static void dfu_finish(bo_dfu_t *dfu)
+{
+    CHECK(BO_DFU_T_IS_COMPLETE(dfu));
+    CHECK(memcmp(&host_flash[dfu->ota.partition.offset], s_image, IMAGE_LEN) == 0);
+    bo_dfu_deinit(dfu);
+}
+
+static void test_download(size_t block_size)
+{
+    bo_dfu_t *dfu = dfu_start();
+    const host_dfu_status_t status = host_dfu_download(dfu, s_image, IMAGE_LEN, block_size);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    dfu_finish(dfu);
+}
+
+static void test_abort_then_full_sector(void)
+{
+    bo_dfu_t *dfu = dfu_start();
+    host_dfu_status_t status;
+    static const uint8_t junk[1024] = { 0xA5 };
+    CHECK(host_dfu_dnload(dfu, 0, junk, sizeof(junk)) == sizeof(junk));
+    CHECK(host_dfu_wait(dfu, &status) && status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE);
+    CHECK(host_dfu_abort(dfu));
+    CHECK(host_dfu_getstate(dfu) == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+    CHECK(dfu->dfu.fill == 0 && dfu->dfu.host_block == 0);
+
+    // A full sector as the first block of a new download.
+    CHECK(host_dfu_dnload(dfu, 0, s_image, 0x1000) == 0x1000);
+    CHECK(host_dfu_abort(dfu));
+
+    status = host_dfu_download(dfu, s_image, IMAGE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    dfu_finish(dfu);
+}
+
+static void test_clrstatus_then_full_sector(void)
+{
+    bo_dfu_t *dfu = dfu_start();
+    host_dfu_status_t status;
+    CHECK(host_dfu_dnload(dfu, 0, s_image, 1024) == 1024);
+    CHECK(host_dfu_wait(dfu, &status) && status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE);
+    // Out of sequence, so stalled.
+    CHECK(host_dfu_dnload(dfu, 5, s_image, 1024) < 0);
+    CHECK(host_dfu_getstate(dfu) == BO_DFU_STATE_PROTOCOL_dfuERROR);
+    CHECK(host_dfu_clrstatus(dfu));
+    CHECK(host_dfu_getstate(dfu) == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+    #ifdef CONFIG_BO_DFU_RESUME
+        // The interrupted download may still be resumed, so its progress is kept.
+        CHECK(dfu->dfu.resumable && dfu->dfu.fill == 1024);
+    #else
+        CHECK(dfu->dfu.fill == 0);
+    #endif
+
+    status = host_dfu_download(dfu, s_image, IMAGE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    dfu_finish(dfu);
+}
+
+#ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+/**
+ * With every page program taking the worst-case time, a sector after the first is reported as dfuDNBUSY with the short poll
+ * timeout for several polls, each of which returns to the bus within half of it, then as dfuDNLOAD-IDLE.
+*/
+static void test_background_polls(void)
+{
+    bo_dfu_t *dfu = dfu_start();
+    host_dfu_status_t status;
+    CHECK(host_dfu_dnload(dfu, 0, s_image, 0x1000) == 0x1000);
+    CHECK(host_dfu_wait(dfu, &status) && status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE);
+
+    host_flash_write_cycles = BO_DFU_FLASH_PAGE_PROGRAM_MAX_US * BO_DFU_CPU_FREQ_MHZ;
+    CHECK(host_dfu_dnload(dfu, 1, &s_image[0x1000], 0x1000) == 0x1000);
+    uint32_t busy = 0;
+    for(;;)
+    {
+        const uint32_t start = host_ccount;
+        CHECK(host_dfu_getstatus(dfu, &status));
+        CHECK(host_ccount - start <= BO_DFU_MS_TO_CCOUNT(CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS) / 2);
+        CHECK(status.bStatus == BO_DFU_STATUS_OK);
+        if(status.bState != BO_DFU_STATE_PROTOCOL_dfuDNBUSY)
+        {
+            break;
+        }
+        CHECK(status.bwPollTimeout == CONFIG_BO_DFU_BUSY_POLL_TIMEOUT_MS);
+        ++busy;
+    }
+    CHECK(status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE);
+    // At least a poll per page, plus the erase.
+    CHECK(busy >= 0x1000 / BO_DFU_FLASH_PAGE_SIZE);
+    host_flash_write_cycles = 0;
+
+    for(uint16_t block = 2; block * 0x1000 < IMAGE_LEN; ++block)
+    {
+        const uint16_t len = MIN(0x1000, IMAGE_LEN - block * 0x1000);
+        CHECK(host_dfu_dnload(dfu, block, &s_image[block * 0x1000], len) == len);
+        CHECK(host_dfu_wait(dfu, &status) && status.bStatus == BO_DFU_STATUS_OK);
+    }
+    CHECK(host_dfu_dnload(dfu, IMAGE_LEN / 0x1000 + 1, NULL, 0) == 0);
+    CHECK(host_dfu_wait(dfu, &status) && status.bStatus == BO_DFU_STATUS_OK);
+    dfu_finish(dfu);
+}
+#endif
+
+#ifdef CONFIG_BO_DFU_BLOCK_CRC
+// A block with a bad CRC fails with errVERIFY, and may be sent again after CLRSTATUS.
+static void test_block_crc_retry(size_t block_size, uint16_t bad_block)
+{
+    bo_dfu_t *dfu = dfu_start();
+    host_dfu_status_t status;
+    uint16_t block = 0;
+    for(size_t offset = 0; offset < IMAGE_LEN; offset += block_size, ++block)
+    {
+        const uint16_t len = MIN(block_size, IMAGE_LEN - offset);
+        if(block == bad_block)
+        {
+            const uint16_t crc = esp_rom_crc16_le(0, &s_image[offset], len);
+            CHECK(host_usb_control(dfu, 0x21, BO_DFU_BREQUEST_DNLOAD, block, crc ^ 1, len, &s_image[offset]) == len);
+            CHECK(host_dfu_getstatus(dfu, &status));
+            CHECK(status.bStatus == BO_DFU_STATUS_errVERIFY && status.bState == BO_DFU_STATE_PROTOCOL_dfuERROR);
+            CHECK(host_dfu_clrstatus(dfu));
+            CHECK(host_dfu_getstate(dfu) == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+        }
+        CHECK(host_dfu_dnload(dfu, block, &s_image[offset], len) == len);
+        CHECK(host_dfu_wait(dfu, &status) && status.bStatus == BO_DFU_STATUS_OK);
+    }
+    CHECK(host_dfu_dnload(dfu, block, NULL, 0) == 0);
+    CHECK(host_dfu_wait(dfu, &status) && status.bStatus == BO_DFU_STATUS_OK);
+    dfu_finish(dfu);
+}
+#endif
+
+#ifdef CONFIG_BO_DFU_STATS
+// Data that the host fails to ACK, by timing out or answering with something else, is counted and sent again.
+static void test_ack_timeouts(void)
+{
+    bo_dfu_t *dfu = dfu_start();
+    const uint8_t setup[8] = { 0xA1, BO_DFU_BREQUEST_GETSTATE, 0, 0, 0, 0, 1, 0 };
+    host_usb_queue_token(BO_DFU_USB_PID_CHECK_SETUP);
+    host_usb_queue_data(BO_DFU_USB_PID_CHECK_DATA0, setup, sizeof(setup));
+    CHECK(host_usb_run(dfu) == 1 && host_usb_sent(0, BO_DFU_USB_PID_CHECK_ACK));
+    const uint32_t ack_timeouts = dfu->stats.ack_timeouts;
+
+    // No handshake at all.
+    host_usb_queue_token(BO_DFU_USB_PID_CHECK_IN);
+    CHECK(host_usb_run(dfu) == 1 && host_usb_sent(0, BO_DFU_USB_PID_CHECK_DATA1));
+    bo_dfu_fsm(dfu);
+    CHECK(dfu->stats.ack_timeouts == ack_timeouts + 1);
+
+    // Something other than an ACK.
+    host_usb_queue_token(BO_DFU_USB_PID_CHECK_IN);
+    host_usb_queue_handshake(BO_DFU_USB_PID_CHECK_STALL);
+    CHECK(host_usb_run(dfu) == 1 && host_usb_sent(0, BO_DFU_USB_PID_CHECK_DATA1));
+    CHECK(dfu->stats.ack_timeouts == ack_timeouts + 2);
+
+    // Sent again, and ACKed.
+    host_usb_queue_token(BO_DFU_USB_PID_CHECK_IN);
+    host_usb_queue_handshake(BO_DFU_USB_PID_CHECK_ACK);
+    CHECK(host_usb_run(dfu) == 1 && host_usb_sent(0, BO_DFU_USB_PID_CHECK_DATA1));
+    CHECK(s_host_usb.tx[0].len == 1 && s_host_usb.tx[0].data[0] == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+    CHECK(dfu->stats.ack_timeouts == ack_timeouts + 2);
+    bo_dfu_deinit(dfu);
+}
+#endif
+
+int main(void)
+{
+    host_image_build(s_image, IMAGE_LEN, 1);
+    test_download(0x1000);
+    test_download(1024);
+    test_download(64);
+    test_abort_then_full_sector();
+    test_clrstatus_then_full_sector();
+    #ifdef CONFIG_BO_DFU_BACKGROUND_FLASH
+        test_background_polls();
+    #endif
+    #ifdef CONFIG_BO_DFU_BLOCK_CRC
+        test_block_crc_retry(0x1000, 0);
+        test_block_crc_retry(0x1000, 2);
+        // Part way through a sector.
+        test_block_crc_retry(1024, 6);
+    #endif
+    #ifdef CONFIG_BO_DFU_STATS
+        test_ack_timeouts();
+    #endif
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
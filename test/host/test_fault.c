@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_usb.h"
+
+/**
+ * CONFIG_BO_DFU_FAULT_INJECTION: the faults drawn for each packet occur at the configured rates, and land within the packet.
+*/
+
+#define DRAWS 100000
+#define BUS_READS (BO_DFU_USB_RX_PACKET_MAX_BITS * BO_DFU_USB_RX_READS_PER_BIT)
+
+// Within 1% (absolute) of the expected rate.
+static void check_rate(const char *name, uint32_t count, uint32_t per_mille)
+{
+    const int32_t per_mille_seen = (int32_t)(((uint64_t)count * 1000) / DRAWS);
+    if(abs(per_mille_seen - (int32_t)per_mille) > 10)
+    {
+        host_fail("%s: %d per mille, expected %u", name, per_mille_seen, per_mille);
+    }
+}
+
+int main(void)
+{
+    host_reset();
+    bo_dfu_fault_init();
+    uint32_t se0 = 0, drop_ack = 0, lost_ack = 0, bit_flip = 0, glitch = 0;
+    int32_t jitter_min = 0, jitter_max = 0;
+    for(uint32_t i = 0; i < DRAWS; ++i)
+    {
+        bo_dfu_fault_draw(BUS_READS);
+        se0 += BO_DFU_FAULT(se0);
+        drop_ack += BO_DFU_FAULT(drop_ack);
+        lost_ack += BO_DFU_FAULT(lost_ack);
+        jitter_min = MIN(jitter_min, s_bo_dfu_fault.jitter);
+        jitter_max = MAX(jitter_max, s_bo_dfu_fault.jitter);
+
+        // Exactly one read of the packet is glitched, if any.
+        uint32_t glitched = 0;
+        for(uint32_t read = 0; read < BUS_READS; ++read)
+        {
+            glitched += (bo_dfu_fault_glitch(0) != 0);
+        }
+        CHECK(glitched <= 1);
+        glitch += glitched;
+
+        // Exactly one bit is flipped, if any, and within the packet.
+        uint8_t packet[3] = { 0 };
+        bo_dfu_fault_bit_flip(packet, 2);
+        const uint32_t flipped = __builtin_popcount(packet[0]) + __builtin_popcount(packet[1]);
+        CHECK(flipped <= 1 && packet[2] == 0);
+        bit_flip += flipped;
+    }
+    check_rate("se0", se0, CONFIG_BO_DFU_FAULT_SE0_PER_MILLE);
+    check_rate("drop_ack", drop_ack, CONFIG_BO_DFU_FAULT_DROP_ACK_PER_MILLE);
+    check_rate("lost_ack", lost_ack, CONFIG_BO_DFU_FAULT_LOST_ACK_PER_MILLE);
+    check_rate("bit_flip", bit_flip, CONFIG_BO_DFU_FAULT_BIT_FLIP_PER_MILLE);
+    check_rate("glitch", glitch, CONFIG_BO_DFU_FAULT_RX_GLITCH_PER_MILLE);
+    CHECK(jitter_min == -CONFIG_BO_DFU_FAULT_RX_JITTER_CYCLES && jitter_max == CONFIG_BO_DFU_FAULT_RX_JITTER_CYCLES);
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
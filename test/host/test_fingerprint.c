@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_usb.h"
+
+/**
+ * Sector fingerprints: the hashes returned for the active slot, the poll timeout covering them, and the states reported for a HASH
+ * outside of a download (dfuIDLE throughout) and within one (as a block).
+*/
+
+#define IMAGE_LEN (3 * 0x1000 + 0x200)
+
+static uint8_t s_image[IMAGE_LEN];
+static bo_dfu_t s_dfu;
+
+static bo_dfu_t *dfu_start(void)
+{
+    host_reset();
+    // ota_0 is running, so ota_1 is the target.
+    host_otadata_set(1);
+    for(uint32_t i = 0; i < HOST_OTA_SIZE; ++i)
+    {
+        host_flash[HOST_OTA0_OFFSET + i] = (i / HOST_SECTOR_SIZE) * 7 + (i & 0x1F);
+    }
+    bo_dfu_t *dfu = &s_dfu;
+    CHECK(bo_dfu_init(dfu) == ESP_OK);
+    host_usb_enumerate(dfu);
+    return dfu;
+}
+
+static bool hash(bo_dfu_t *dfu, uint16_t sector, uint16_t slot)
+{
+    return host_usb_control(dfu, 0x40, BO_DFU_VENDOR_BREQUEST_HASH, sector, slot, 0, NULL) == 0;
+}
+
+static void check_hashes(bo_dfu_t *dfu, uint16_t sector)
+{
+    uint32_t hashes[BO_DFU_FINGERPRINT_SECTORS];
+    CHECK(host_usb_control(dfu, 0xC0, BO_DFU_VENDOR_BREQUEST_GET_HASHES, 0, 0, sizeof(hashes), hashes) == sizeof(hashes));
+    for(uint32_t i = 0; i < BO_DFU_FINGERPRINT_SECTORS; ++i)
+    {
+        const uint32_t offset = (sector + i) * HOST_SECTOR_SIZE;
+        const uint32_t expected = (offset < HOST_OTA_SIZE) ? esp_rom_crc32_le(0, &host_flash[HOST_OTA0_OFFSET + offset], HOST_SECTOR_SIZE) : 0;
+        CHECK(hashes[i] == expected);
+    }
+}
+
+static void test_hash_from_idle(uint16_t sector)
+{
+    bo_dfu_t *dfu = dfu_start();
+    CHECK(hash(dfu, sector, BO_DFU_VENDOR_SLOT_ACTIVE));
+    // Not part of a download, so dfuIDLE throughout, with a poll timeout long enough for every sector.
+    CHECK(host_dfu_getstate(dfu) == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+    host_dfu_status_t status;
+    CHECK(host_dfu_getstatus(dfu, &status));
+    CHECK(status.bStatus == BO_DFU_STATUS_OK && status.bState == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+    CHECK(status.bwPollTimeout == CONFIG_BO_DFU_DNLOAD_SYNC_POLL_TIMEOUT_MS + BO_DFU_FINGERPRINT_SECTORS * CONFIG_BO_DFU_FINGERPRINT_SECTOR_POLL_TIMEOUT_MS);
+    CHECK(host_dfu_getstate(dfu) == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+    CHECK(host_dfu_getstatus(dfu, &status));
+    CHECK(status.bStatus == BO_DFU_STATUS_OK && status.bState == BO_DFU_STATE_PROTOCOL_dfuIDLE && status.bwPollTimeout == 0);
+    check_hashes(dfu, sector);
+
+    // A download may follow.
+    status = host_dfu_download(dfu, s_image, IMAGE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(dfu));
+    CHECK(memcmp(&host_flash[HOST_OTA1_OFFSET], s_image, IMAGE_LEN) == 0);
+    bo_dfu_deinit(dfu);
+}
+
+static void test_hash_in_download(void)
+{
+    bo_dfu_t *dfu = dfu_start();
+    host_dfu_status_t status;
+    CHECK(host_dfu_dnload(dfu, 0, s_image, 0x1000) == 0x1000);
+    CHECK(host_dfu_wait(dfu, &status) && status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE);
+
+    // As a block: dfuDNLOAD-SYNC, dfuDNBUSY, then back to dfuDNLOAD-IDLE.
+    CHECK(hash(dfu, 0, BO_DFU_VENDOR_SLOT_ACTIVE));
+    CHECK(host_dfu_getstate(dfu) == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_SYNC);
+    CHECK(host_dfu_getstatus(dfu, &status));
+    CHECK(status.bState == BO_DFU_STATE_PROTOCOL_dfuDNBUSY);
+    CHECK(host_dfu_wait(dfu, &status) && status.bStatus == BO_DFU_STATUS_OK && status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE);
+    check_hashes(dfu, 0);
+
+    for(uint16_t block = 1; block * 0x1000 < IMAGE_LEN; ++block)
+    {
+        const uint16_t len = MIN(0x1000, IMAGE_LEN - block * 0x1000);
+        CHECK(host_dfu_dnload(dfu, block, &s_image[block * 0x1000], len) == len);
+        CHECK(host_dfu_wait(dfu, &status) && status.bStatus == BO_DFU_STATUS_OK);
+    }
+    CHECK(host_dfu_dnload(dfu, IMAGE_LEN / 0x1000 + 1, NULL, 0) == 0);
+    CHECK(host_dfu_wait(dfu, &status) && status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(dfu));
+    CHECK(memcmp(&host_flash[HOST_OTA1_OFFSET], s_image, IMAGE_LEN) == 0);
+    bo_dfu_deinit(dfu);
+}
+
+int main(void)
+{
+    host_image_build(s_image, IMAGE_LEN, 1);
+    test_hash_from_idle(0);
+    // The last 64 sectors, half beyond the end of the partition.
+    test_hash_from_idle(HOST_OTA_SIZE / HOST_SECTOR_SIZE - BO_DFU_FINGERPRINT_SECTORS / 2);
+    test_hash_in_download();
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_usb.h"
+
+/**
+ * CONFIG_BO_DFU_SKIP_INSTALLED: a download of an app already in a slot is discarded, and that slot is activated unless it's the
+ * active one. A match in a slot rejected by rollback, or one which no longer verifies, is written to the next slot as usual.
+*/
+
+#define IMAGE_LEN (2 * 0x1000 + 0x100)
+
+static bo_dfu_t s_dfu;
+static uint8_t s_image[IMAGE_LEN];
+static uint8_t s_other[IMAGE_LEN];
+
+// ota_0 is active (OTA data sequence 1) and holds active_image, and ota_1 holds inactive_image.
+static void setup(const uint8_t *active_image, const uint8_t *inactive_image)
+{
+    host_reset();
+    host_otadata_set(1);
+    memcpy(&host_flash[HOST_OTA0_OFFSET], active_image, IMAGE_LEN);
+    memcpy(&host_flash[HOST_OTA1_OFFSET], inactive_image, IMAGE_LEN);
+    CHECK(bo_dfu_init(&s_dfu) == ESP_OK);
+    host_usb_enumerate(&s_dfu);
+    host_flash_erases = 0;
+    host_flash_writes = 0;
+}
+
+static void test_active_is_skipped(void)
+{
+    setup(s_image, s_other);
+    const host_dfu_status_t status = host_dfu_download(&s_dfu, s_image, IMAGE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(&s_dfu));
+    CHECK(host_flash_erases == 0 && host_flash_writes == 0);
+    CHECK(host_otadata_seq() == 1);
+    bo_dfu_deinit(&s_dfu);
+}
+
+static void test_inactive_is_activated(void)
+{
+    setup(s_other, s_image);
+    const host_dfu_status_t status = host_dfu_download(&s_dfu, s_image, IMAGE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(&s_dfu));
+    // Only the OTA data.
+    CHECK(host_flash_erases == 1);
+    CHECK(host_otadata_seq() == 2);
+    CHECK(memcmp(&host_flash[HOST_OTA0_OFFSET], s_other, IMAGE_LEN) == 0);
+    CHECK(memcmp(&host_flash[HOST_OTA1_OFFSET], s_image, IMAGE_LEN) == 0);
+    bo_dfu_deinit(&s_dfu);
+}
+
+static void test_rejected_is_written(uint32_t state)
+{
+    // ota_1 matches, but was rolled back.
+    setup(s_other, s_image);
+    host_otadata_add(2, state);
+    CHECK(host_otadata_seq() == 1);
+    const host_dfu_status_t status = host_dfu_download(&s_dfu, s_image, IMAGE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(&s_dfu));
+    // Every sector, as well as the OTA data.
+    CHECK(host_flash_erases == IMAGE_LEN / 0x1000 + 2);
+    CHECK(host_otadata_seq() == 2);
+    CHECK(memcmp(&host_flash[HOST_OTA0_OFFSET], s_other, IMAGE_LEN) == 0);
+    bo_dfu_deinit(&s_dfu);
+}
+
+static void test_corrupt_active_is_written(void)
+{
+    static uint8_t corrupt[IMAGE_LEN];
+    memcpy(corrupt, s_image, IMAGE_LEN);
+    corrupt[IMAGE_LEN - 0x100] ^= 1;
+    setup(corrupt, s_other);
+    const host_dfu_status_t status = host_dfu_download(&s_dfu, s_image, IMAGE_LEN, 0x1000);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(&s_dfu));
+    CHECK(memcmp(&host_flash[HOST_OTA1_OFFSET], s_image, IMAGE_LEN) == 0);
+    CHECK(host_otadata_seq() == 2);
+    // Left for rollback, not erased.
+    CHECK(memcmp(&host_flash[HOST_OTA0_OFFSET], corrupt, IMAGE_LEN) == 0);
+    bo_dfu_deinit(&s_dfu);
+}
+
+int main(void)
+{
+    host_image_build(s_image, IMAGE_LEN, 1);
+    host_image_build(s_other, IMAGE_LEN, 2);
+    test_active_is_skipped();
+    test_inactive_is_activated();
+    test_rejected_is_written(ESP_OTA_IMG_INVALID);
+    test_rejected_is_written(ESP_OTA_IMG_ABORTED);
+    test_corrupt_active_is_written();
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
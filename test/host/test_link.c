@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_usb.h"
+
+/**
+ * CONFIG_BO_DFU_FAULT_INJECTION through the simulated bus (host_usb_use_bus): each fault is swept on its own, downloading an app
+ * RUNS times at each rate (each from another seed), and the transactions retried, downloads restarted, downloads completed and
+ * effective throughput are printed as a table.
+ * A failed download is recovered as a host tool would (CLRSTATUS or ABORT back to dfuIDLE) and restarted from the beginning.
+ * Throughput is the length of the images completed over the device's cycle count for all of the runs: the time taken on the bus
+ * and by the device, but not the host's scheduling (eg. of transactions into frames), so only the relative values mean much.
+ * The download must complete without a retry when there are no faults, and whenever the device completes one, it must be intact.
+*/
+
+#define IMAGE_LEN (0x1000 + 0x100)
+#define BLOCK_SIZE 0x400
+#define DOWNLOAD_ATTEMPTS 8
+#define RUNS 8
+
+host_link_rates_t host_link_rates;
+
+static uint8_t s_image[IMAGE_LEN];
+static bo_dfu_t s_dfu;
+
+typedef struct {
+    uint32_t retries;
+    uint32_t restarts;
+    uint32_t completed;
+    uint64_t cycles;
+} link_result_t;
+
+// Returns the device to dfuIDLE after a failed download, or false if it can't be.
+static bool link_recover(void)
+{
+    host_dfu_status_t status;
+    if(!host_dfu_wait(&s_dfu, &status))
+    {
+        return false;
+    }
+    switch(status.bState)
+    {
+        case BO_DFU_STATE_PROTOCOL_dfuERROR:
+            return host_dfu_clrstatus(&s_dfu);
+        case BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE:
+            return host_dfu_abort(&s_dfu);
+        default:
+            return status.bState == BO_DFU_STATE_PROTOCOL_dfuIDLE;
+    }
+}
+
+// One download at the given rates, adding to result. The faults are seeded from the cycle count when bo_dfu_init is called.
+static void link_download(const host_link_rates_t *rates, uint32_t seed, link_result_t *result)
+{
+    host_reset();
+    host_usb_reset();
+    host_usb_use_bus();
+    host_ccount = seed;
+    host_link_rates = (host_link_rates_t){ 0 };
+    CHECK(bo_dfu_init(&s_dfu) == ESP_OK);
+    host_usb_enumerate(&s_dfu);
+
+    host_link_rates = *rates;
+    const uint32_t start = host_ccount;
+    for(uint32_t attempt = 0; attempt < DOWNLOAD_ATTEMPTS && !BO_DFU_T_IS_COMPLETE(&s_dfu); ++attempt)
+    {
+        if(attempt > 0)
+        {
+            ++result->restarts;
+            if(!link_recover())
+            {
+                continue;
+            }
+        }
+        host_dfu_download(&s_dfu, s_image, IMAGE_LEN, BLOCK_SIZE);
+    }
+    result->cycles += host_ccount - start;
+    result->retries += host_usb_retries;
+    host_link_rates = (host_link_rates_t){ 0 };
+    if(BO_DFU_T_IS_COMPLETE(&s_dfu))
+    {
+        CHECK(memcmp(&host_flash[s_dfu.ota.partition.offset], s_image, IMAGE_LEN) == 0);
+        ++result->completed;
+    }
+    bo_dfu_deinit(&s_dfu);
+}
+
+// RUNS downloads at the given rates, with the same seeds for every rate.
+static link_result_t link_run(const host_link_rates_t *rates)
+{
+    link_result_t result = { 0 };
+    for(uint32_t run = 0; run < RUNS; ++run)
+    {
+        link_download(rates, run * 0x9E3779B9u, &result);
+    }
+    return result;
+}
+
+static void link_print(const char *name, int32_t rate, const link_result_t *result)
+{
+    const double seconds = (double)result->cycles / (BO_DFU_CPU_FREQ_MHZ * 1e6);
+    printf(
+        "%s: %-9s %4d %8u %8u %6u/%u %9.0f\n", HOST_TEST_NAME, name, rate, result->retries, result->restarts,
+        result->completed, RUNS, result->completed * IMAGE_LEN / seconds
+    );
+}
+
+// One row per rate, with the named fault at that rate and no others.
+#define LINK_SWEEP(field, ...) \
+    do { \
+        static const int32_t rates[] = { __VA_ARGS__ }; \
+        for(size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i) \
+        { \
+            host_link_rates_t link_rates = { 0 }; \
+            link_rates.field = rates[i]; \
+            const link_result_t result = link_run(&link_rates); \
+            link_print(#field, rates[i], &result); \
+        } \
+    } while(0)
+
+int main(void)
+{
+    host_image_build(s_image, IMAGE_LEN, 1);
+
+    printf("%s: fault     rate  retries restarts complete   bytes/s\n", HOST_TEST_NAME);
+    const link_result_t clean = link_run(&(host_link_rates_t){ 0 });
+    CHECK(clean.completed == RUNS && clean.retries == 0 && clean.restarts == 0);
+    link_print("none", 0, &clean);
+
+    // Per mille of packets (or of handshakes, for ACKs).
+    LINK_SWEEP(bit_flip, 10, 20, 50, 100, 200);
+    LINK_SWEEP(se0, 10, 20, 50, 100, 200);
+    LINK_SWEEP(drop_ack, 10, 20, 50, 100, 200);
+    LINK_SWEEP(lost_ack, 10, 20, 50, 100, 200);
+    // CPU cycles (of 160 per bit) either side of the sampling point, and per bit.
+    LINK_SWEEP(rx_jitter, 2, 4, 8, 16, 32, 60);
+    LINK_SWEEP(rx_skew, -2, -1, 1, 2, 4);
+
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_bus.h"
+
+#include "bo_dfu_usb.h"
+#include "bo_dfu_util.h"
+#include "bo_dfu_crc.h"
+#include "bo_dfu_tx.h"
+#include "bo_dfu_rx.h"
+
+/**
+ * The receiver (bo_dfu_rx.h) against the simulated bus (host_bus.h), sampling packets as it would on the device. The result of
+ * each is compared against a reference decoder working on the ideal line states, for valid packets and for corrupted ones.
+ * Packets with a brief glitch on the lines must also be received intact if CONFIG_BO_DFU_RX_MAJORITY.
+ * With CONFIG_BO_DFU_RX_EARLY_REJECT, tokens for other devices must be skipped in time to receive the next packet, as must PRE.
+*/
+
+#define PACKETS 20000
+
+static uint32_t sim_prng = 1;
+
+static uint32_t sim_random(void)
+{
+    sim_prng ^= sim_prng << 13;
+    sim_prng ^= sim_prng >> 17;
+    sim_prng ^= sim_prng << 5;
+    return sim_prng;
+}
+
+/**
+ * The expected result for line states bits[0] to bits[len] followed by a valid EOP: the number of bytes, decoded into buffer,
+ * or -1 if the packet must be rejected (invalid line state, stuffing error, SE0 within a byte or too long).
+ * With CONFIG_BO_DFU_RX_EARLY_REJECT, SIM_PRE if a PRE PID is decoded; the receiver then resynchronises to whatever follows.
+*/
+#define SIM_PRE (-2)
+
+static int sim_reference(const uint32_t *bits, uint32_t len, uint8_t *buffer, size_t buffer_len)
+{
+    uint32_t previous = BO_DFU_BUS_J;
+    int ones = 0;
+    int received = 0;
+    int bit = 0;
+    uint8_t byte = 0;
+    for(uint32_t i = 0; i < len; ++i)
+    {
+        if(bits[i] != BO_DFU_BUS_J && bits[i] != BO_DFU_BUS_K)
+        {
+            return -1;
+        }
+        const bool one = (bits[i] == previous);
+        previous = bits[i];
+        if(ones == 6)
+        {
+            // Stuffing bit
+            if(one)
+            {
+                return -1;
+            }
+            ones = 0;
+            continue;
+        }
+        if(bit == 0 && received == buffer_len)
+        {
+            return -1;
+        }
+        ones = one ? (ones + 1) : 0;
+        byte = (byte >> 1) | (one ? 0x80 : 0);
+        if(++bit == 8)
+        {
+            buffer[received++] = byte;
+            bit = 0;
+            #ifdef CONFIG_BO_DFU_RX_EARLY_REJECT
+                if(received == 2 && byte == BO_DFU_USB_PID_CHECK_PRE)
+                {
+                    return SIM_PRE;
+                }
+            #endif
+        }
+    }
+    // A stuffing bit due at the end would be seen as SE0 instead.
+    return (bit == 0 && ones < 6) ? received : -1;
+}
+
+// Places the bus' packet a random number of bit times (and fraction of a bit) ahead, and receives it.
+static int sim_receive(bo_dfu_usb_rx_packet_t *packet, int token_address)
+{
+    uint32_t bit_time = host_ccount;
+    s_host_bus.start = host_ccount + (1 + sim_random() % 8) * BO_DFU_USB_CPU_CYCLES_PER_BIT + sim_random() % BO_DFU_USB_CPU_CYCLES_PER_BIT;
+    memset(packet, 0xEE, sizeof(*packet));
+    const int result = bo_dfu_usb_rx_next_packet(&bit_time, packet, token_address);
+    // Past the packet, so that it isn't seen again.
+    host_ccount = s_host_bus.start + (s_host_bus.len + 4) * BO_DFU_USB_CPU_CYCLES_PER_BIT;
+    return result;
+}
+
+static void sim_random_packet(uint8_t *bytes, size_t len)
+{
+    bytes[0] = BO_DFU_USB_SYNC_BYTE;
+    for(size_t i = 1; i < len; ++i)
+    {
+        // Plenty of runs of 1s, for stuffing.
+        bytes[i] = (sim_random() & 1) ? 0xFF : sim_random();
+    }
+    if(len > 1 && bytes[1] == BO_DFU_USB_PID_CHECK_PRE)
+    {
+        // Unlike any other packet, PRE has no EOP.
+        bytes[1] = BO_DFU_USB_PID_CHECK_DATA0;
+    }
+}
+
+// Valid packets of every length up to one byte too long for the buffer, and the same corrupted by a changed line state.
+static void test_packets(bool corrupt)
+{
+    uint32_t rejected = 0;
+    for(uint32_t n = 0; n < PACKETS; ++n)
+    {
+        uint8_t bytes[sizeof(((bo_dfu_usb_rx_packet_t*)0)->buffer) + 1];
+        const size_t len = 1 + sim_random() % sizeof(bytes);
+        sim_random_packet(bytes, len);
+        s_host_bus.len = 0;
+        s_host_bus.glitch_mask = 0;
+        host_bus_encode(bytes, len);
+        if(corrupt)
+        {
+            // Any bit after the first (whose transition is the SOP) toggled, made invalid, dropped or repeated.
+            const uint32_t i = 1 + sim_random() % (s_host_bus.len - 1);
+            switch(sim_random() % 4)
+            {
+                case 0:
+                    s_host_bus.bits[i] ^= BO_DFU_BUS_J ^ BO_DFU_BUS_K;
+                    break;
+                case 1:
+                    s_host_bus.bits[i] = BO_DFU_BUS_SE1;
+                    break;
+                case 2:
+                    memmove(&s_host_bus.bits[i], &s_host_bus.bits[i + 1], (s_host_bus.len - i - 1) * sizeof(s_host_bus.bits[0]));
+                    --s_host_bus.len;
+                    break;
+                case 3:
+                    memmove(&s_host_bus.bits[i + 1], &s_host_bus.bits[i], (s_host_bus.len - i) * sizeof(s_host_bus.bits[0]));
+                    ++s_host_bus.len;
+                    break;
+            }
+        }
+        uint8_t expected_bytes[sizeof(((bo_dfu_usb_rx_packet_t*)0)->buffer)];
+        const int expected = sim_reference(s_host_bus.bits, s_host_bus.len, expected_bytes, sizeof(expected_bytes));
+        if(!corrupt)
+        {
+            CHECK(expected == len || (expected < 0 && len > sizeof(expected_bytes)));
+        }
+        host_bus_eop();
+
+        bo_dfu_usb_rx_packet_t packet;
+        const int result = sim_receive(&packet, BO_DFU_USB_RX_ANY_PACKET);
+        if(expected == SIM_PRE)
+        {
+            // Corrupted into PRE; what follows is received as another packet, for the transaction layer to reject.
+            continue;
+        }
+        if(expected < 0)
+        {
+            CHECK(result < 0);
+            ++rejected;
+        }
+        else if(result != expected || memcmp(packet.buffer, expected_bytes, expected) != 0)
+        {
+            host_fail("packet %u of %zu bytes: received %d, expected %d", n, len, result, expected);
+        }
+    }
+    printf("%s: %u %s packets, %u rejected\n", HOST_TEST_NAME, PACKETS, corrupt ? "corrupted" : "valid", rejected);
+}
+
+// Valid packets, each with one glitch on D+, D- or both, anywhere after the SOP and before the EOP.
+static void test_glitches(void)
+{
+    static const uint32_t masks[] = { 1 << BO_DFU_GPIO_DP, 1 << BO_DFU_GPIO_DN, (1 << BO_DFU_GPIO_DP) | (1 << BO_DFU_GPIO_DN) };
+    uint32_t failed = 0;
+    for(uint32_t n = 0; n < PACKETS; ++n)
+    {
+        uint8_t bytes[sizeof(((bo_dfu_usb_rx_packet_t*)0)->buffer)];
+        const size_t len = 1 + sim_random() % sizeof(bytes);
+        sim_random_packet(bytes, len);
+        s_host_bus.len = 0;
+        host_bus_encode(bytes, len);
+        s_host_bus.glitch_start = BO_DFU_USB_CPU_CYCLES_PER_BIT + sim_random() % ((s_host_bus.len - 1) * BO_DFU_USB_CPU_CYCLES_PER_BIT - HOST_BUS_GLITCH_CYCLES);
+        s_host_bus.glitch_mask = masks[sim_random() % 3];
+        host_bus_eop();
+
+        bo_dfu_usb_rx_packet_t packet;
+        const int result = sim_receive(&packet, BO_DFU_USB_RX_ANY_PACKET);
+        if(result != len || memcmp(packet.buffer, bytes, len) != 0)
+        {
+            #ifdef CONFIG_BO_DFU_RX_MAJORITY
+                host_fail("packet %u of %zu bytes, glitched at %u: received %d", n, len, s_host_bus.glitch_start, result);
+            #endif
+            ++failed;
+        }
+    }
+    s_host_bus.glitch_mask = 0;
+    printf("%s: %u glitched packets, %u failed\n", HOST_TEST_NAME, PACKETS, failed);
+    #ifndef CONFIG_BO_DFU_RX_MAJORITY
+        // A single read per bit is caught by some of them, else the glitches aren't landing.
+        CHECK(failed > 0);
+    #endif
+}
+
+#ifdef CONFIG_BO_DFU_RX_EARLY_REJECT
+
+#define SIM_ADDRESS 5
+
+static void sim_token(uint8_t sync, uint8_t pid, uint8_t address, uint8_t endpoint)
+{
+    const uint16_t token = address | (endpoint << 7);
+    const uint16_t token_with_crc = token | (bo_dfu_crc_token(token) << 11);
+    const uint8_t bytes[] = { sync, pid, token_with_crc & 0xFF, token_with_crc >> 8 };
+    host_bus_encode(bytes, sizeof(bytes));
+}
+
+/**
+ * Tokens, some for another address or with another PID or sync, each followed closely by an IN for this device. Those which
+ * aren't for this device must be rejected with the receiver ready for the IN.
+*/
+static void test_early_reject(void)
+{
+    static const uint8_t pids[] = {
+        BO_DFU_USB_PID_CHECK_SETUP, BO_DFU_USB_PID_CHECK_OUT, BO_DFU_USB_PID_CHECK_IN,
+        BO_DFU_USB_PID_CHECK_DATA0, BO_DFU_USB_PID_CHECK_DATA1, BO_DFU_USB_PID_CHECK_ACK, BO_DFU_USB_PID_CHECK_STALL,
+    };
+    uint32_t rejected = 0;
+    for(uint32_t n = 0; n < PACKETS; ++n)
+    {
+        // Any other sync byte which still begins with the SOP transition.
+        const uint8_t sync = (sim_random() % 8) ? BO_DFU_USB_SYNC_BYTE : (BO_DFU_USB_SYNC_BYTE ^ (2 << sim_random() % 7));
+        const uint8_t pid = pids[sim_random() % sizeof(pids)];
+        const uint8_t address = (sim_random() & 1) ? SIM_ADDRESS : (sim_random() & 0x7F);
+        const bool foreign = (
+            sync != BO_DFU_USB_SYNC_BYTE ||
+            (pid != BO_DFU_USB_PID_CHECK_SETUP && pid != BO_DFU_USB_PID_CHECK_OUT && pid != BO_DFU_USB_PID_CHECK_IN) ||
+            address != SIM_ADDRESS
+        );
+
+        s_host_bus.len = 0;
+        sim_token(sync, pid, address, sim_random() & 0xF);
+        host_bus_eop();
+        // The minimum inter-packet delay is 2 bit times.
+        host_bus_idle(2 + sim_random() % 4);
+        const uint32_t next_sop = s_host_bus.len;
+        sim_token(BO_DFU_USB_SYNC_BYTE, BO_DFU_USB_PID_CHECK_IN, SIM_ADDRESS, 0);
+        host_bus_eop();
+
+        bo_dfu_usb_rx_packet_t packet;
+        const int result = sim_receive(&packet, SIM_ADDRESS);
+        if(!foreign)
+        {
+            CHECK(result == 4 && packet.sync == sync && packet.pid_with_check == pid && packet.address == address);
+            continue;
+        }
+        CHECK(result == BO_DFU_BUS_SYNCED);
+        ++rejected;
+        // sim_receive moved on past the whole bus, so again from the end of the first packet, as the receiver left it.
+        host_ccount = s_host_bus.start + (next_sop - 1) * BO_DFU_USB_CPU_CYCLES_PER_BIT;
+        uint32_t bit_time = host_ccount;
+        CHECK(bo_dfu_usb_rx_next_packet(&bit_time, &packet, SIM_ADDRESS) == 4);
+        CHECK(packet.pid_with_check == BO_DFU_USB_PID_CHECK_IN && packet.address == SIM_ADDRESS);
+        host_ccount = s_host_bus.start + (s_host_bus.len + 4) * BO_DFU_USB_CPU_CYCLES_PER_BIT;
+    }
+    printf("%s: %u tokens, %u rejected\n", HOST_TEST_NAME, PACKETS, rejected);
+    CHECK(rejected > 0);
+}
+
+// PRE, with no EOP, followed by a token for this device: the token must be received, whatever packet is expected.
+static void test_pre(void)
+{
+    for(uint32_t n = 0; n < 100; ++n)
+    {
+        s_host_bus.len = 0;
+        const uint8_t pre[] = { BO_DFU_USB_SYNC_BYTE, BO_DFU_USB_PID_CHECK_PRE };
+        host_bus_encode(pre, sizeof(pre));
+        host_bus_idle(4);
+        sim_token(BO_DFU_USB_SYNC_BYTE, BO_DFU_USB_PID_CHECK_SETUP, SIM_ADDRESS, 0);
+        host_bus_eop();
+
+        bo_dfu_usb_rx_packet_t packet;
+        CHECK(sim_receive(&packet, (n & 1) ? SIM_ADDRESS : BO_DFU_USB_RX_ANY_PACKET) == 4);
+        CHECK(packet.pid_with_check == BO_DFU_USB_PID_CHECK_SETUP && packet.address == SIM_ADDRESS);
+    }
+}
+
+#else
+
+static void test_early_reject(void) {}
+static void test_pre(void) {}
+
+#endif
+
+int main(void)
+{
+    host_reset();
+    host_gpio_in = host_bus_gpio_in;
+    // Near the wrap of the cycle count.
+    host_ccount = 0xFFF00000;
+
+    test_packets(false);
+    test_packets(true);
+    test_glitches();
+    test_early_reject();
+    test_pre();
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "host_usb.h"
+
+/**
+ * Round trip of tools/bo_dfu_sparse.py and the sparse decoder: images are packed on the host, with and without a base image to
+ * leave in place, then decoded with bo_dfu_sparse_process into emulated flash holding the base image, both directly in pieces
+ * of various sizes and as a DFU download. The result must match the new image, padded with 0xFF to a whole sector.
+*/
+
+#define IMAGE_LEN (12 * HOST_SECTOR_SIZE + 0x234)
+#define IMAGE_PADDED_LEN ((IMAGE_LEN + HOST_SECTOR_SIZE - 1) & ~(HOST_SECTOR_SIZE - 1))
+#define SPARSE_MAX (2 * IMAGE_PADDED_LEN)
+
+static uint8_t s_old[IMAGE_LEN];
+static uint8_t s_new[IMAGE_LEN];
+static uint8_t s_sparse[SPARSE_MAX];
+static char s_dir[] = "/tmp/bo_dfu_sparse_XXXXXX";
+static bo_dfu_t s_dfu;
+
+static void file_write(const char *path, const uint8_t *data, size_t len)
+{
+    FILE *f = fopen(path, "wb");
+    CHECK(f && fwrite(data, 1, len, f) == len);
+    fclose(f);
+}
+
+// Packs s_new with the host tool, optionally against s_old, into s_sparse.
+static size_t sparse_pack(bool with_base)
+{
+    char old_path[64], new_path[64], out_path[64], command[512];
+    snprintf(old_path, sizeof(old_path), "%s/old.bin", s_dir);
+    snprintf(new_path, sizeof(new_path), "%s/new.bin", s_dir);
+    snprintf(out_path, sizeof(out_path), "%s/new.simg", s_dir);
+    file_write(old_path, s_old, IMAGE_LEN);
+    file_write(new_path, s_new, IMAGE_LEN);
+    snprintf(command, sizeof(command), "python3 %s/tools/bo_dfu_sparse.py %s%s %s %s 2>/dev/null", HOST_REPO_DIR,
+        with_base ? "--base " : "", with_base ? old_path : "", new_path, out_path);
+    CHECK(system(command) == 0);
+
+    FILE *f = fopen(out_path, "rb");
+    CHECK(f);
+    const size_t len = fread(s_sparse, 1, sizeof(s_sparse), f);
+    CHECK(feof(f));
+    fclose(f);
+    remove(old_path);
+    remove(new_path);
+    remove(out_path);
+    return len;
+}
+
+static void image_check(uint32_t offset)
+{
+    CHECK(memcmp(&host_flash[offset], s_new, IMAGE_LEN) == 0);
+    for(uint32_t i = IMAGE_LEN; i < IMAGE_PADDED_LEN; ++i)
+    {
+        CHECK(host_flash[offset + i] == 0xFF);
+    }
+}
+
+static void test_decode(bool with_base, size_t piece)
+{
+    const size_t sparse_len = sparse_pack(with_base);
+    host_reset();
+    memcpy(&host_flash[HOST_OTA1_OFFSET], s_old, IMAGE_LEN);
+    host_flash_guard(HOST_OTA1_OFFSET, IMAGE_PADDED_LEN);
+
+    const esp_partition_pos_t partition = { .offset = HOST_OTA1_OFFSET, .size = HOST_OTA_SIZE };
+    bo_dfu_sparse_t sparse;
+    bo_dfu_sparse_init(&sparse, s_sparse, sparse_len);
+    CHECK(sparse.active);
+    uint32_t sectors_erased = 0;
+    for(size_t offset = 0; offset < sparse_len; offset += piece)
+    {
+        const size_t n = MIN(piece, sparse_len - offset);
+        CHECK(bo_dfu_sparse_process(&sparse, &partition, &s_sparse[offset], n, &sectors_erased) == BO_DFU_STATUS_OK);
+    }
+    CHECK(bo_dfu_sparse_is_done(&sparse));
+    image_check(HOST_OTA1_OFFSET);
+    host_flash_unguard();
+}
+
+static void test_download(bool with_base, size_t block_size)
+{
+    const size_t sparse_len = sparse_pack(with_base);
+    host_reset();
+    // ota_0 is running, so the download goes to ota_1.
+    host_otadata_set(1);
+    memcpy(&host_flash[HOST_OTA1_OFFSET], s_old, IMAGE_LEN);
+    CHECK(bo_dfu_init(&s_dfu) == ESP_OK);
+    host_usb_enumerate(&s_dfu);
+    const host_dfu_status_t status = host_dfu_download(&s_dfu, s_sparse, sparse_len, block_size);
+    CHECK(status.bStatus == BO_DFU_STATUS_OK);
+    CHECK(BO_DFU_T_IS_COMPLETE(&s_dfu));
+    CHECK(s_dfu.ota.partition.offset == HOST_OTA1_OFFSET);
+    image_check(HOST_OTA1_OFFSET);
+    bo_dfu_deinit(&s_dfu);
+}
+
+int main(void)
+{
+    CHECK(mkdtemp(s_dir));
+    host_image_build(s_old, IMAGE_LEN, 1);
+    // A new app in the first 3 sectors (RAW), then the old image's data with sectors unchanged (DONT_CARE with a base), erased
+    // and uniform (FILL), and changed (RAW).
+    memcpy(s_new, s_old, IMAGE_LEN);
+    host_image_build(s_new, 3 * HOST_SECTOR_SIZE, 2);
+    memset(&s_new[4 * HOST_SECTOR_SIZE], 0xFF, HOST_SECTOR_SIZE);
+    memset(&s_new[6 * HOST_SECTOR_SIZE], 0x5A, HOST_SECTOR_SIZE);
+    s_new[9 * HOST_SECTOR_SIZE + 123] ^= 0x80;
+
+    for(int with_base = 0; with_base <= 1; ++with_base)
+    {
+        test_decode(with_base, 4096);
+        test_decode(with_base, 1000);
+        test_decode(with_base, 7);
+        test_download(with_base, 0x1000);
+        test_download(with_base, 64);
+    }
+    rmdir(s_dir);
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
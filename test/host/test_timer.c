@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+
+#include "bo_dfu_timer.h"
+
+/**
+ * bo_dfu_ccount64 and the timers of bo_dfu_timer.h across wraps of the 32 bit cycle count, which is stepped here by hand as a
+ * loop would advance it.
+*/
+
+// One loop iteration.
+#define STEP_US 100
+#define STEP_CYCLES BO_DFU_US_TO_CCOUNT64(STEP_US)
+
+enum {
+    TIMER_PERIODIC,
+    TIMER_ONE_SHOT,
+    TIMER_STOPPED,
+};
+
+// Over 60s, from just before a wrap, so covering four: a 250ms periodic timer fires on time every time, and a 30s one-shot once.
+static void test_wraps(void)
+{
+    host_ccount = 0xF0000000;
+    bo_dfu_timers_t timers;
+    bo_dfu_timers_init(&timers);
+    const uint64_t start = bo_dfu_ccount64();
+    bo_dfu_timer_start_ms(&timers, TIMER_PERIODIC, 250, true);
+    bo_dfu_timer_start_ms(&timers, TIMER_ONE_SHOT, 30000, false);
+    bo_dfu_timer_start_us(&timers, TIMER_STOPPED, 500, false);
+    bo_dfu_timer_stop(&timers, TIMER_STOPPED);
+
+    uint32_t periodic = 0, one_shot = 0;
+    uint64_t previous = start;
+    for(uint32_t step = 1; step <= 60 * 1000 * 1000 / STEP_US; ++step)
+    {
+        host_ccount += STEP_CYCLES;
+        const uint32_t expired = bo_dfu_timers_poll(&timers);
+        const uint64_t now = bo_dfu_ccount64();
+        CHECK(now - previous == STEP_CYCLES);
+        previous = now;
+        CHECK(!(expired & (1 << TIMER_STOPPED)));
+        if(expired & (1 << TIMER_PERIODIC))
+        {
+            ++periodic;
+            // On the first poll at or after each deadline.
+            CHECK(now - start == periodic * BO_DFU_MS_TO_CCOUNT64(250));
+        }
+        if(expired & (1 << TIMER_ONE_SHOT))
+        {
+            ++one_shot;
+            CHECK(now - start == BO_DFU_MS_TO_CCOUNT64(30000));
+            CHECK(!bo_dfu_timer_is_running(&timers, TIMER_ONE_SHOT));
+        }
+    }
+    CHECK(periodic == 240);
+    CHECK(one_shot == 1);
+    CHECK(bo_dfu_timer_is_running(&timers, TIMER_PERIODIC));
+}
+
+// A periodic timer polled late fires once, keeping its phase if less than a period late, else restarting from the poll.
+static void test_late(void)
+{
+    host_ccount = 0;
+    bo_dfu_timers_t timers;
+    bo_dfu_timers_init(&timers);
+    const uint64_t start = bo_dfu_ccount64();
+    bo_dfu_timer_start_ms(&timers, TIMER_PERIODIC, 100, true);
+
+    host_ccount += BO_DFU_MS_TO_CCOUNT64(150);
+    CHECK(bo_dfu_timers_poll(&timers) == (1 << TIMER_PERIODIC));
+    CHECK(timers.deadline[TIMER_PERIODIC] - start == BO_DFU_MS_TO_CCOUNT64(200));
+
+    host_ccount += BO_DFU_MS_TO_CCOUNT64(1000);
+    CHECK(bo_dfu_timers_poll(&timers) == (1 << TIMER_PERIODIC));
+    CHECK(timers.deadline[TIMER_PERIODIC] - start == BO_DFU_MS_TO_CCOUNT64(1150 + 100));
+    CHECK(bo_dfu_timers_poll(&timers) == 0);
+}
+
+int main(void)
+{
+    host_reset();
+    // The cycle count only advances here.
+    host_ccount_step = 0;
+    test_wraps();
+    test_late();
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
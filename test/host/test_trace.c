@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_usb.h"
+
+/**
+ * CONFIG_BO_DFU_TRACE: the trace's CRC is committed as the session goes, so that it's valid even if DFU mode never ends cleanly,
+ * but only after a GETSTATUS which told the host to wait. The END event records whether the download completed.
+*/
+
+#define IMAGE_LEN (2 * 0x1000 + 0x100)
+
+static uint8_t s_image[IMAGE_LEN];
+static bo_dfu_t s_dfu;
+
+static const bo_dfu_trace_event_t *trace_find(const bo_dfu_trace_t *trace, bo_dfu_trace_event_type_t type, uint8_t arg8, uint16_t arg16)
+{
+    for(uint32_t i = 0; i < trace->count; ++i)
+    {
+        const bo_dfu_trace_event_t *event = bo_dfu_trace_event_get(trace, i);
+        if(event->type == type && event->arg8 == arg8 && event->arg16 == arg16)
+        {
+            return event;
+        }
+    }
+    return NULL;
+}
+
+static const bo_dfu_trace_event_t *trace_last(const bo_dfu_trace_t *trace)
+{
+    return bo_dfu_trace_event_get(trace, trace->count - 1);
+}
+
+static void dfu_start(void)
+{
+    host_reset();
+    CHECK(bo_dfu_init(&s_dfu) == ESP_OK);
+    host_usb_enumerate(&s_dfu);
+}
+
+// Interrupted after the first block, without bo_dfu_deinit: the trace is already valid, up to that block.
+static void test_interrupted(void)
+{
+    dfu_start();
+    host_dfu_status_t status;
+    CHECK(host_dfu_dnload(&s_dfu, 0, s_image, 0x1000) == 0x1000);
+    CHECK(host_dfu_wait(&s_dfu, &status) && status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE);
+    const bo_dfu_trace_t *trace = bo_dfu_rtc_get_trace();
+    CHECK(trace);
+    CHECK(trace_find(trace, BO_DFU_TRACE_EVENT_BLOCK, BO_DFU_STATUS_OK, 0));
+    CHECK(trace_last(trace)->type != BO_DFU_TRACE_EVENT_END);
+}
+
+// Events are only committed in the poll timeout given by a GETSTATUS, never after other requests.
+static void test_commit_windows(void)
+{
+    dfu_start();
+    CHECK(host_dfu_getstate(&s_dfu) == BO_DFU_STATE_PROTOCOL_dfuIDLE);
+    CHECK(host_dfu_dnload(&s_dfu, 0, s_image, 0x1000) == 0x1000);
+    // dfuDNLOAD-SYNC, recorded but not yet committed.
+    CHECK(host_rtc_commits == 0);
+
+    host_dfu_status_t status;
+    CHECK(host_dfu_getstatus(&s_dfu, &status));
+    CHECK(status.bState == BO_DFU_STATE_PROTOCOL_dfuDNBUSY && status.bwPollTimeout > 0);
+    CHECK(host_rtc_commits == 1);
+    // Including the block, written in the same window.
+    CHECK(trace_find(bo_dfu_rtc_get_trace(), BO_DFU_TRACE_EVENT_BLOCK, BO_DFU_STATUS_OK, 0));
+
+    // dfuDNLOAD-IDLE, with no poll timeout.
+    CHECK(host_dfu_getstatus(&s_dfu, &status));
+    CHECK(status.bState == BO_DFU_STATE_PROTOCOL_dfuDNLOAD_IDLE && status.bwPollTimeout == 0);
+    CHECK(host_dfu_abort(&s_dfu));
+    CHECK(host_rtc_commits == 1);
+
+    bo_dfu_deinit(&s_dfu);
+    CHECK(host_rtc_commits == 2);
+}
+
+static void test_end(bool complete)
+{
+    dfu_start();
+    if(complete)
+    {
+        CHECK(host_dfu_download(&s_dfu, s_image, IMAGE_LEN, 0x1000).bStatus == BO_DFU_STATUS_OK);
+    }
+    bo_dfu_deinit(&s_dfu);
+    const bo_dfu_trace_t *trace = bo_dfu_rtc_get_trace();
+    CHECK(trace);
+    CHECK(trace_last(trace)->type == BO_DFU_TRACE_EVENT_END && trace_last(trace)->arg8 == complete);
+}
+
+int main(void)
+{
+    host_image_build(s_image, IMAGE_LEN, 1);
+    test_interrupted();
+    test_commit_windows();
+    test_end(false);
+    test_end(true);
+    printf("%s: ok\n", HOST_TEST_NAME);
+    return 0;
+}
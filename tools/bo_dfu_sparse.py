@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Packs a binary into the Android sparse image format (v1.0) with a 4096 byte block size, as accepted with
+CONFIG_BO_DFU_SPARSE.
+
+Blocks of 0xFF are encoded as erase-only FILL chunks, blocks of any other repeated 32 bit value as FILL chunks, and the
+rest as RAW chunks. With --base, blocks identical to those of the given image (eg. the app already in the destination
+slot) are encoded as DONT_CARE chunks, so they're neither sent nor written. The output is then only valid for a
+partition holding exactly that image.
+
+The input is padded with 0xFF to a whole number of blocks.
+
+    bo_dfu_sparse.py build/app.bin app.simg
+    bo_dfu_sparse.py --base old.bin build/app.bin app.simg
+"""
+
+import argparse
+import struct
+import sys
+
+SPARSE_MAGIC = 0xED26FF3A
+BLOCK_SIZE = 4096
+FILE_HEADER_SIZE = 28
+CHUNK_HEADER_SIZE = 12
+
+CHUNK_RAW = 0xCAC1
+CHUNK_FILL = 0xCAC2
+CHUNK_DONT_CARE = 0xCAC3
+
+
+def blocks_of(data):
+    if len(data) % BLOCK_SIZE:
+        data += b"\xff" * (BLOCK_SIZE - len(data) % BLOCK_SIZE)
+    return [data[i:i + BLOCK_SIZE] for i in range(0, len(data), BLOCK_SIZE)]
+
+
+def classify(block, base_block):
+    """Returns (chunk type, fill value) for a single block."""
+    if base_block is not None and block == base_block:
+        return (CHUNK_DONT_CARE, None)
+    word = block[:4]
+    if block == word * (BLOCK_SIZE // 4):
+        return (CHUNK_FILL, struct.unpack("<I", word)[0])
+    return (CHUNK_RAW, None)
+
+
+def pack(data, base=None):
+    blocks = blocks_of(bytearray(data))
+    base_blocks = blocks_of(bytearray(base)) if base is not None else []
+
+    # Runs of blocks of the same kind (and fill value) become one chunk each.
+    runs = []
+    for i, block in enumerate(blocks):
+        kind = classify(block, base_blocks[i] if i < len(base_blocks) else None)
+        if runs and runs[-1][0] == kind:
+            runs[-1][1].append(block)
+        else:
+            runs.append((kind, [block]))
+
+    chunks = []
+    for (chunk_type, fill), run in runs:
+        if chunk_type == CHUNK_RAW:
+            payload = b"".join(run)
+        elif chunk_type == CHUNK_FILL:
+            payload = struct.pack("<I", fill)
+        else:
+            payload = b""
+        chunks.append(struct.pack("<HHII", chunk_type, 0, len(run), CHUNK_HEADER_SIZE + len(payload)) + payload)
+
+    header = struct.pack("<IHHHHIIII", SPARSE_MAGIC, 1, 0, FILE_HEADER_SIZE, CHUNK_HEADER_SIZE, BLOCK_SIZE,
+                         len(blocks), len(chunks), 0)
+    return header + b"".join(chunks)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--base", type=argparse.FileType("rb"),
+                        help="image already in the destination partition; unchanged blocks are skipped")
+    parser.add_argument("input", type=argparse.FileType("rb"))
+    parser.add_argument("output", type=argparse.FileType("wb"))
+    args = parser.parse_args()
+
+    data = args.input.read()
+    sparse = pack(data, args.base.read() if args.base else None)
+    args.output.write(sparse)
+    print("%s: %u bytes -> %u bytes" % (args.output.name, len(data), len(sparse)), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()